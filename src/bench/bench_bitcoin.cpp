@@ -4,6 +4,7 @@
 
 #include <bench/bench.h>
 
+#include <crypto/scrypt.h>
 #include <crypto/sha256.h>
 #include <key.h>
 #include <util/system.h>
@@ -63,6 +64,7 @@ int main(int argc, char** argv)
     const fs::path bench_datadir{SetDataDir()};
 
     SHA256AutoDetect();
+    ScryptAutoDetect();
     ECC_Start();
     SetupEnvironment();
 
@@ -43,6 +43,7 @@ static CTxIn MineBlock(const CScript& coinbase_scriptPubKey)
 
     while (!CheckProofOfWork(block->GetPoWHash(), block->nBits, Params().GetConsensus())) {
         ++block->nNonce;
+        block->InvalidateHash();
         assert(block->nNonce);
     }
 
@@ -0,0 +1,120 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <chainparams.h>
+#include <consensus/merkle.h>
+#include <consensus/validation.h>
+#include <miner.h>
+#include <pow.h>
+#include <primitives/block.h>
+#include <scheduler.h>
+#include <streams.h>
+#include <txdb.h>
+#include <util/time.h>
+#include <validation.h>
+#include <validationinterface.h>
+#include <version.h>
+
+#include <boost/thread.hpp>
+
+#include <iostream>
+
+static std::shared_ptr<const CBlock> MineRelayedBlock(const CScript& coinbase_scriptPubKey)
+{
+    CBlock block = BlockAssembler{Params()}.CreateNewBlock(coinbase_scriptPubKey)->block;
+    {
+        LOCK(cs_main);
+        unsigned int extra_nonce = 0;
+        IncrementExtraNonce(&block, ::chainActive.Tip(), extra_nonce);
+    }
+    while (!CheckProofOfWork(block.GetPoWHash(), block.nBits, Params().GetConsensus())) {
+        ++block.nNonce;
+        block.InvalidateHash();
+    }
+
+    // Round-trip through the wire format, so the block arrives without a
+    // memoized hash just like one received from a peer.
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << block;
+    auto relayed = std::make_shared<CBlock>();
+    stream >> *relayed;
+    return relayed;
+}
+
+/**
+ * Count scrypt invocations per block on the ProcessNewBlock path (header
+ * checks, AcceptBlock, ActivateBestChain and the validation callbacks) with
+ * and without the header hash memoization.
+ */
+static void ProcessNewBlockHashes(benchmark::State& state, bool hash_cache)
+{
+    const CScript coinbase_scriptPubKey = CScript() << OP_TRUE;
+
+    SelectParams(CBaseChainParams::REGTEST);
+    InitScriptExecutionCache();
+    UnloadBlockIndex();
+
+    boost::thread_group thread_group;
+    CScheduler scheduler;
+    {
+        LOCK(cs_main);
+        ::pblocktree.reset(new CBlockTreeDB(1 << 20, true));
+        ::pcoinsdbview.reset(new CCoinsViewDB(1 << 23, true));
+        ::pcoinsTip.reset(new CCoinsViewCache(pcoinsdbview.get()));
+    }
+    thread_group.create_thread(std::bind(&CScheduler::serviceQueue, &scheduler));
+    GetMainSignals().RegisterBackgroundSignalScheduler(scheduler);
+    LoadGenesisBlock(Params());
+    {
+        CValidationState validation_state;
+        ActivateBestChain(validation_state, Params());
+        assert(::chainActive.Tip() != nullptr);
+    }
+
+    SetBlockHashCache(hash_cache);
+    int64_t mock_time = GetTime();
+    uint64_t blocks = 0;
+    uint64_t hashes = 0;
+    while (state.KeepRunning()) {
+        // Keep block timestamps strictly increasing
+        SetMockTime(++mock_time);
+        std::shared_ptr<const CBlock> block = MineRelayedBlock(coinbase_scriptPubKey);
+        const uint64_t hashes_before = GetBlockHashCount();
+        bool processed{ProcessNewBlock(Params(), block, true, nullptr)};
+        assert(processed);
+        SyncWithValidationInterfaceQueue();
+        hashes += GetBlockHashCount() - hashes_before;
+        ++blocks;
+    }
+    SetBlockHashCache(true);
+    SetMockTime(0);
+
+    std::cerr << state.m_name << ": " << (blocks ? (double)hashes / blocks : 0.0) << " scrypt hashes per block" << std::endl;
+
+    thread_group.interrupt_all();
+    thread_group.join_all();
+    GetMainSignals().FlushBackgroundCallbacks();
+    GetMainSignals().UnregisterBackgroundSignalScheduler();
+    UnloadBlockIndex();
+    {
+        LOCK(cs_main);
+        ::pcoinsTip.reset();
+        ::pcoinsdbview.reset();
+        ::pblocktree.reset();
+    }
+}
+
+static void ProcessNewBlockHashCache(benchmark::State& state)
+{
+    ProcessNewBlockHashes(state, true);
+}
+
+static void ProcessNewBlockNoHashCache(benchmark::State& state)
+{
+    ProcessNewBlockHashes(state, false);
+}
+
+BENCHMARK(ProcessNewBlockHashCache, 50);
+BENCHMARK(ProcessNewBlockNoHashCache, 50);
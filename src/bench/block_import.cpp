@@ -0,0 +1,104 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <arith_uint256.h>
+#include <blockimport.h>
+#include <chainparams.h>
+#include <checkqueue.h>
+#include <clientversion.h>
+#include <consensus/merkle.h>
+#include <fs.h>
+#include <pow.h>
+#include <random.h>
+#include <streams.h>
+
+#include <memory>
+
+#include <boost/thread.hpp>
+
+static const int IMPORT_BLOCKS = 64;
+static const int IMPORT_BLOCK_TXS = 250;
+
+/**
+ * Write a block file of synthetic blocks that pass CheckBlock (merkle root,
+ * regtest proof of work), laid out like blk?????.dat.
+ */
+static fs::path WriteSyntheticBlockFile(const CChainParams& params)
+{
+    FastRandomContext rng(true);
+    const fs::path path = fs::temp_directory_path() / fs::unique_path("bench_blockimport_%%%%%%%%.dat");
+    CAutoFile fileout(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
+    assert(!fileout.IsNull());
+
+    uint256 hashPrev = params.GetConsensus().hashGenesisBlock;
+    for (int i = 0; i < IMPORT_BLOCKS; ++i) {
+        CBlock block;
+        CMutableTransaction coinbase;
+        coinbase.vin.resize(1);
+        coinbase.vin[0].scriptSig = CScript() << (i + 1) << OP_0;
+        coinbase.vout.emplace_back(50 * COIN, CScript() << OP_TRUE);
+        block.vtx.push_back(MakeTransactionRef(std::move(coinbase)));
+        for (int j = 1; j < IMPORT_BLOCK_TXS; ++j) {
+            CMutableTransaction tx;
+            tx.vin.emplace_back(COutPoint(rng.rand256(), 0), CScript() << std::vector<unsigned char>(72, 1) << std::vector<unsigned char>(33, 2));
+            tx.vout.emplace_back(COIN, CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 3) << OP_EQUALVERIFY << OP_CHECKSIG);
+            tx.vout.emplace_back(COIN, CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 4) << OP_EQUALVERIFY << OP_CHECKSIG);
+            block.vtx.push_back(MakeTransactionRef(std::move(tx)));
+        }
+        block.nVersion = 1;
+        block.hashPrevBlock = hashPrev;
+        block.hashMerkleRoot = BlockMerkleRoot(block);
+        block.nTime = 1546300800 + i * 60;
+        block.nBits = UintToArith256(params.GetConsensus().powLimit).GetCompact();
+        while (!CheckProofOfWork(block.GetPoWHash(), block.nBits, params.GetConsensus())) {
+            ++block.nNonce;
+            block.InvalidateHash();
+        }
+        hashPrev = block.GetHash();
+
+        fileout << params.MessageStart() << (unsigned int)GetSerializeSize(block, CLIENT_VERSION) << block;
+    }
+    return path;
+}
+
+// Decodes a block file the way -reindex and -loadblock do ahead of
+// AcceptBlock: scan, deserialize, hash and CheckBlock. Blocks/sec for a given
+// thread count is IMPORT_BLOCKS divided by the reported time per iteration.
+static void BlockImportRead(benchmark::State& state, int threads)
+{
+    const auto params = CreateChainParams(CBaseChainParams::REGTEST);
+    const fs::path path = WriteSyntheticBlockFile(*params);
+    CCheckQueue<CTaskCheck> queue(1);
+    boost::thread_group tg;
+    for (int i = 0; i < threads - 1; ++i) {
+        tg.create_thread([&queue] { queue.Thread(); });
+    }
+
+    while (state.KeepRunning()) {
+        FILE* file = fsbridge::fopen(path, "rb");
+        assert(file);
+        CBlockImportReader reader(file, params->MessageStart(), params->GetConsensus(), &queue, threads);
+        CImportedBlock imported;
+        int blocks = 0;
+        while (reader.Next(imported)) {
+            assert(imported.pblock && imported.pblock->fChecked);
+            ++blocks;
+        }
+        assert(blocks == IMPORT_BLOCKS);
+    }
+    tg.interrupt_all();
+    tg.join_all();
+    fs::remove(path);
+}
+
+static void BlockImportRead1Thread(benchmark::State& state) { BlockImportRead(state, 1); }
+static void BlockImportRead2Threads(benchmark::State& state) { BlockImportRead(state, 2); }
+static void BlockImportRead4Threads(benchmark::State& state) { BlockImportRead(state, 4); }
+static void BlockImportRead8Threads(benchmark::State& state) { BlockImportRead(state, 8); }
+
+BENCHMARK(BlockImportRead1Thread, 1);
+BENCHMARK(BlockImportRead2Threads, 1);
+BENCHMARK(BlockImportRead4Threads, 1);
+BENCHMARK(BlockImportRead8Threads, 1);
@@ -0,0 +1,88 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <blockencodings.h>
+#include <chainparams.h>
+#include <consensus/merkle.h>
+#include <pow.h>
+#include <random.h>
+#include <streams.h>
+#include <txmempool.h>
+#include <validation.h>
+
+/**
+ * Latency of reconstructing a block announced by a high-bandwidth compact
+ * block peer: from the cmpctblock message off the wire, through matching its
+ * short IDs against the mempool, to the checked block. All of the block's
+ * transactions are in the mempool, along with as many unrelated ones.
+ */
+static void CompactBlockReconstruction(benchmark::State& state, size_t nBlockTx)
+{
+    SelectParams(CBaseChainParams::REGTEST);
+    FastRandomContext rand(true);
+
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig = CScript() << OP_TRUE << OP_TRUE;
+    tx.vout.resize(1);
+    tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    tx.vout[0].nValue = COIN;
+
+    CBlock block;
+    block.nVersion = 4;
+    block.hashPrevBlock = rand.rand256();
+    block.nBits = 0x207fffff;
+    block.vtx.push_back(MakeTransactionRef(tx));
+
+    CTxMemPool pool;
+    {
+        LOCK2(cs_main, pool.cs);
+        LockPoints lp;
+        for (size_t i = 0; i < 2 * nBlockTx; i++) {
+            tx.vin[0].prevout = COutPoint(rand.rand256(), 0);
+            CTransactionRef txref = MakeTransactionRef(tx);
+            pool.addUnchecked(CTxMemPoolEntry(txref, 1000, 0, 1, false, 4, lp));
+            if (i % 2 == 0) block.vtx.push_back(txref);
+        }
+    }
+    bool mutated;
+    block.hashMerkleRoot = BlockMerkleRoot(block, &mutated);
+    while (!CheckProofOfWork(block.GetPoWHash(), block.nBits, Params().GetConsensus())) {
+        ++block.nNonce;
+        block.InvalidateHash();
+    }
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << CBlockHeaderAndShortTxIDs(block, true);
+    const std::vector<char> message(stream.begin(), stream.end());
+    const std::vector<std::pair<uint256, CTransactionRef>> extra_txn;
+
+    while (state.KeepRunning()) {
+        CDataStream recv(message.data(), message.data() + message.size(), SER_NETWORK, PROTOCOL_VERSION);
+        CBlockHeaderAndShortTxIDs cmpctblock;
+        recv >> cmpctblock;
+        const uint256 hash = cmpctblock.header.GetHash();
+
+        PartiallyDownloadedBlock partialBlock(&pool);
+        ReadStatus status = partialBlock.InitData(cmpctblock, extra_txn, hash);
+        assert(status == READ_STATUS_OK);
+        CBlock reconstructed;
+        status = partialBlock.FillBlock(reconstructed, {});
+        assert(status == READ_STATUS_OK);
+    }
+}
+
+static void CompactBlockReconstruction1000(benchmark::State& state)
+{
+    CompactBlockReconstruction(state, 1000);
+}
+
+static void CompactBlockReconstruction5000(benchmark::State& state)
+{
+    CompactBlockReconstruction(state, 5000);
+}
+
+BENCHMARK(CompactBlockReconstruction1000, 100);
+BENCHMARK(CompactBlockReconstruction5000, 20);
@@ -7,6 +7,7 @@
 #include <policy/policy.h>
 #include <wallet/crypter.h>
 
+#include <iostream>
 #include <vector>
 
 // FIXME: Dedup with SetupDummyInputs in test/transaction_tests.cpp.
@@ -85,4 +86,28 @@ static void CCoinsCaching(benchmark::State& state)
     }
 }
 
+// Fill a cache with pay-to-pubkey-hash coins, whose scripts fit inline, and
+// report the cache's accounted memory per coin. That is the figure -dbcache
+// is divided by, so it shows how many UTXOs a given cache size holds.
+static void CCoinsCachingFill(benchmark::State& state)
+{
+    static const int COINS = 10000;
+    CCoinsView coinsDummy;
+    CScript script = CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 1) << OP_EQUALVERIFY << OP_CHECKSIG;
+    size_t usage = 0;
+    unsigned int cached = 0;
+    uint32_t n = 0;
+    while (state.KeepRunning()) {
+        CCoinsViewCache coins(&coinsDummy);
+        for (int i = 0; i < COINS; i++) {
+            COutPoint outpoint(uint256(), n++);
+            coins.AddCoin(outpoint, Coin(CTxOut(i, script), 1000000 + i, false, i & 1, 1546300800 + i), false);
+        }
+        usage = coins.DynamicMemoryUsage();
+        cached = coins.GetCacheSize();
+    }
+    std::cerr << state.m_name << ": " << (cached ? (double)usage / cached : 0.0) << " bytes per cached coin (sizeof(Coin) = " << sizeof(Coin) << ")" << std::endl;
+}
+
 BENCHMARK(CCoinsCaching, 170 * 1000);
+BENCHMARK(CCoinsCachingFill, 50);
@@ -7,7 +7,11 @@
 #include <chainparams.h>
 #include <validation.h>
 #include <streams.h>
+#include <consensus/merkle.h>
 #include <consensus/validation.h>
+#include <random.h>
+
+#include <boost/thread/thread.hpp>
 
 namespace block_bench {
 #include <bench/data/block413567.raw.h>
@@ -55,5 +59,75 @@ static void DeserializeAndCheckBlockTest(benchmark::State& state)
     }
 }
 
+// A large block of simple transactions, as received during a burst, to time
+// hashing its transactions (on deserialization, or deferred to CheckBlock and
+// spread over the block transaction threads) along with the merkle tree and
+// the transaction checks.
+static const int SYNTHETIC_BLOCK_TXS = 4000;
+
+static CDataStream SerializeSyntheticBlock()
+{
+    FastRandomContext rng(true);
+    CBlock block;
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << 1 << OP_0;
+    coinbase.vout.emplace_back(50 * COIN, CScript() << OP_TRUE);
+    block.vtx.push_back(MakeTransactionRef(std::move(coinbase)));
+    for (int i = 1; i < SYNTHETIC_BLOCK_TXS; ++i) {
+        CMutableTransaction tx;
+        tx.vin.emplace_back(COutPoint(rng.rand256(), 0), CScript() << std::vector<unsigned char>(72, 1) << std::vector<unsigned char>(33, 2));
+        tx.vout.emplace_back(COIN, CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 3) << OP_EQUALVERIFY << OP_CHECKSIG);
+        tx.vout.emplace_back(COIN, CScript() << OP_DUP << OP_HASH160 << std::vector<unsigned char>(20, 4) << OP_EQUALVERIFY << OP_CHECKSIG);
+        block.vtx.push_back(MakeTransactionRef(std::move(tx)));
+    }
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << block;
+    char a = '\0';
+    stream.write(&a, 1); // Prevent compaction
+    return stream;
+}
+
+static void DeserializeAndCheckSyntheticBlock(benchmark::State& state, int threads, bool defer)
+{
+    CDataStream stream = SerializeSyntheticBlock();
+    const size_t size = stream.size() - 1;
+    stream.SetVersion(PROTOCOL_VERSION | (defer ? SERIALIZE_TRANSACTION_DEFER_HASH : 0));
+    const auto chainParams = CreateChainParams(CBaseChainParams::REGTEST);
+
+    const int nScriptCheckThreadsPrev = nScriptCheckThreads;
+    nScriptCheckThreads = threads;
+    boost::thread_group tg;
+    for (int i = 0; i < threads - 1; ++i) {
+        tg.create_thread(&ThreadBlockTxCheck);
+    }
+
+    while (state.KeepRunning()) {
+        CBlock block;
+        stream >> block;
+        bool rewound = stream.Rewind(size);
+        assert(rewound);
+
+        CValidationState validationState;
+        bool checked = CheckBlock(block, validationState, chainParams->GetConsensus(), false);
+        assert(checked);
+    }
+
+    tg.interrupt_all();
+    tg.join_all();
+    nScriptCheckThreads = nScriptCheckThreadsPrev;
+}
+
+static void DeserializeAndCheckSyntheticBlockTest(benchmark::State& state) { DeserializeAndCheckSyntheticBlock(state, 0, false); }
+static void DeserializeDeferredAndCheckSyntheticBlock2Threads(benchmark::State& state) { DeserializeAndCheckSyntheticBlock(state, 2, true); }
+static void DeserializeDeferredAndCheckSyntheticBlock4Threads(benchmark::State& state) { DeserializeAndCheckSyntheticBlock(state, 4, true); }
+static void DeserializeDeferredAndCheckSyntheticBlock8Threads(benchmark::State& state) { DeserializeAndCheckSyntheticBlock(state, 8, true); }
+
 BENCHMARK(DeserializeBlockTest, 130);
 BENCHMARK(DeserializeAndCheckBlockTest, 160);
+BENCHMARK(DeserializeAndCheckSyntheticBlockTest, 10);
+BENCHMARK(DeserializeDeferredAndCheckSyntheticBlock2Threads, 10);
+BENCHMARK(DeserializeDeferredAndCheckSyntheticBlock4Threads, 10);
+BENCHMARK(DeserializeDeferredAndCheckSyntheticBlock8Threads, 10);
@@ -11,6 +11,7 @@
 #include <uint256.h>
 #include <util/time.h>
 #include <crypto/ripemd160.h>
+#include <crypto/scrypt.h>
 #include <crypto/sha1.h>
 #include <crypto/sha256.h>
 #include <crypto/sha512.h>
@@ -61,6 +62,35 @@ static void SHA256D64_1024(benchmark::State& state)
     }
 }
 
+static void Scrypt_1way(benchmark::State& state)
+{
+    std::vector<char> in(80, 0);
+    std::vector<char> out(32);
+    while (state.KeepRunning()) {
+        scrypt_1024_1_1_256(in.data(), out.data());
+        in[76]++;
+    }
+}
+
+static void ScryptMulti(benchmark::State& state, size_t n)
+{
+    std::vector<char> in(80 * n, 0);
+    std::vector<char> out(32 * n);
+    std::vector<const char*> inputs(n);
+    std::vector<char*> outputs(n);
+    for (size_t i = 0; i < n; ++i) {
+        in[80 * i + 76] = i;
+        inputs[i] = &in[80 * i];
+        outputs[i] = &out[32 * i];
+    }
+    while (state.KeepRunning()) {
+        scrypt_1024_1_1_256_multi(inputs.data(), outputs.data(), n);
+    }
+}
+
+static void Scrypt_multi8(benchmark::State& state) { ScryptMulti(state, 8); }
+static void Scrypt_multi16(benchmark::State& state) { ScryptMulti(state, 16); }
+
 static void SHA512(benchmark::State& state)
 {
     uint8_t hash[CSHA512::OUTPUT_SIZE];
@@ -102,5 +132,8 @@ BENCHMARK(SHA512, 330);
 BENCHMARK(SHA256_32b, 4700 * 1000);
 BENCHMARK(SipHash_32b, 40 * 1000 * 1000);
 BENCHMARK(SHA256D64_1024, 7400);
+BENCHMARK(Scrypt_1way, 400);
+BENCHMARK(Scrypt_multi8, 50);
+BENCHMARK(Scrypt_multi16, 25);
 BENCHMARK(FastRandom_32bit, 110 * 1000 * 1000);
 BENCHMARK(FastRandom_1bit, 440 * 1000 * 1000);
@@ -0,0 +1,60 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <checkqueue.h>
+#include <primitives/block.h>
+#include <random.h>
+#include <validation.h>
+
+#include <boost/thread/thread.hpp>
+
+#include <vector>
+
+// A full headers message (MAX_HEADERS_RESULTS)
+static const size_t HEADERS_BATCH = 2000;
+static const unsigned int QUEUE_BATCH_SIZE = 16;
+
+// Hashes a full headers batch the way ProcessNewBlockHeaders does before
+// validating it. Headers/sec for a given thread count is HEADERS_BATCH
+// divided by the reported time per iteration.
+static void HeaderHashBatch(benchmark::State& state, int threads)
+{
+    FastRandomContext insecure_rand(true);
+    std::vector<CBlockHeader> headers(HEADERS_BATCH);
+    uint256 prev = insecure_rand.rand256();
+    for (CBlockHeader& header : headers) {
+        header.nVersion = 1;
+        header.hashPrevBlock = prev;
+        header.hashMerkleRoot = insecure_rand.rand256();
+        header.nTime = 1500000000;
+        header.nBits = 0x1e0fffff;
+        header.nNonce = insecure_rand.rand32();
+        prev = insecure_rand.rand256();
+    }
+
+    CCheckQueue<CHeaderHashCheck> queue{QUEUE_BATCH_SIZE};
+    boost::thread_group tg;
+    for (int i = 0; i < threads - 1; ++i) {
+        tg.create_thread([&]{queue.Thread();});
+    }
+    while (state.KeepRunning()) {
+        for (CBlockHeader& header : headers) {
+            header.InvalidateHash();
+        }
+        HashBlockHeaders(headers, threads > 1 ? &queue : nullptr);
+    }
+    tg.interrupt_all();
+    tg.join_all();
+}
+
+static void HeaderHashBatch1Thread(benchmark::State& state) { HeaderHashBatch(state, 1); }
+static void HeaderHashBatch2Threads(benchmark::State& state) { HeaderHashBatch(state, 2); }
+static void HeaderHashBatch4Threads(benchmark::State& state) { HeaderHashBatch(state, 4); }
+static void HeaderHashBatch8Threads(benchmark::State& state) { HeaderHashBatch(state, 8); }
+
+BENCHMARK(HeaderHashBatch1Thread, 1);
+BENCHMARK(HeaderHashBatch2Threads, 2);
+BENCHMARK(HeaderHashBatch4Threads, 4);
+BENCHMARK(HeaderHashBatch8Threads, 8);
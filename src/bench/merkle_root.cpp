@@ -23,4 +23,31 @@ static void MerkleRoot(benchmark::State& state)
     }
 }
 
+// The same tree, computed as CheckBlock does when it spreads a block's
+// transactions over several threads: subtrees of 64 leaves (one per thread
+// task), then the tree over their roots. Shows the cost of the split itself.
+static void MerkleRootSubtrees(benchmark::State& state)
+{
+    FastRandomContext rng(true);
+    std::vector<uint256> leaves;
+    leaves.resize(9001);
+    for (auto& item : leaves) {
+        item = rng.rand256();
+    }
+    const size_t width = 64;
+    while (state.KeepRunning()) {
+        bool mutation = false;
+        std::vector<uint256> roots;
+        for (size_t pos = 0; pos < leaves.size(); pos += width) {
+            bool subtreeMutated = false;
+            roots.push_back(ComputeMerkleSubtreeRoot(std::vector<uint256>(leaves.begin() + pos, leaves.begin() + std::min(pos + width, leaves.size())), 6, &subtreeMutated));
+            mutation |= subtreeMutated;
+        }
+        bool topMutated = false;
+        uint256 hash = ComputeMerkleRoot(std::move(roots), &topMutated);
+        leaves[mutation || topMutated] = hash;
+    }
+}
+
 BENCHMARK(MerkleRoot, 800);
+BENCHMARK(MerkleRootSubtrees, 800);
@@ -0,0 +1,63 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <bench/bench.h>
+#include <chain.h>
+#include <chainparams.h>
+#include <pow.h>
+#include <primitives/block.h>
+
+#include <vector>
+
+/**
+ * Next target computation at the tip of a deep chain made of long PoS and
+ * flash PoS stretches with a PoW block only every few thousand blocks, so
+ * every lookup of the previous same-kind block has a long way to go back.
+ */
+static void RetargetMixedChain(benchmark::State& state, bool fBuildLinks)
+{
+    SelectParams(CBaseChainParams::MAIN);
+    const Consensus::Params& params = Params().GetConsensus();
+
+    std::vector<CBlockIndex> blocks(100000);
+    uint32_t nTime = 1546300800;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        blocks[i].pprev = i ? &blocks[i - 1] : nullptr;
+        blocks[i].nHeight = i ? 1000000 + i : 0;
+        blocks[i].nTime = nTime += 60;
+        blocks[i].nBits = 0x1e0fffff;
+        if (i % 20000 != 0) {
+            blocks[i].SetProofOfStake();
+        }
+        if (fBuildLinks) {
+            blocks[i].BuildPrevAlgo();
+        }
+    }
+    // Sits in the middle of a stretch, far from the previous PoW block.
+    const CBlockIndex* pindexLast = &blocks[blocks.size() - 10000];
+
+    CBlockHeader header;
+    header.nTime = pindexLast->nTime + 60;
+    while (state.KeepRunning()) {
+        for (bool fProofOfStake : {false, true}) {
+            for (uint32_t nOffset : {0, 3600, 7200, 10800}) {
+                header.nTime = pindexLast->nTime + 60 + nOffset;
+                GetNextTargetRequired(pindexLast, &header, params, fProofOfStake);
+            }
+        }
+    }
+}
+
+static void RetargetMixedChainLinks(benchmark::State& state)
+{
+    RetargetMixedChain(state, true);
+}
+
+static void RetargetMixedChainWalk(benchmark::State& state)
+{
+    RetargetMixedChain(state, false);
+}
+
+BENCHMARK(RetargetMixedChainLinks, 2000);
+BENCHMARK(RetargetMixedChainWalk, 20);
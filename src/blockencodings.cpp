@@ -14,7 +14,7 @@
 #include <validation.h>
 #include <util/system.h>
 
-#include <unordered_map>
+#include <algorithm>
 
 CBlockHeaderAndShortTxIDs::CBlockHeaderAndShortTxIDs(const CBlock& block, bool fUseWTXID) :
         nonce(GetRand(std::numeric_limits<uint64_t>::max())),
@@ -44,9 +44,81 @@ uint64_t CBlockHeaderAndShortTxIDs::GetShortID(const uint256& txhash) const {
     return SipHashUint256(shorttxidk0, shorttxidk1, txhash) & 0xffffffffffffL;
 }
 
+void CBlockHeaderAndShortTxIDs::GetShortIDs(const uint256* const* txhashes, uint64_t* out, size_t n) const {
+    static_assert(SHORTTXIDS_LENGTH == 6, "shorttxids calculation assumes 6-byte shorttxids");
+    SipHashUint256Multi(shorttxidk0, shorttxidk1, txhashes, out, n);
+    for (size_t i = 0; i < n; i++)
+        out[i] &= 0xffffffffffffL;
+}
+
+namespace {
+/**
+ * Map from short ID to transaction index, kept in one flat array with open
+ * addressing. An entry sits at most MAX_PROBES slots past the one its ID
+ * selects, which bounds every insertion and lookup whatever IDs the peer
+ * chose; a cmpctblock whose IDs cluster more than that is treated like one
+ * with a short ID collision. The table is kept at most a quarter full, where
+ * the uniformly distributed IDs of a well-formed cmpctblock rarely end up
+ * more than a dozen slots out.
+ */
+class ShortIDIndex
+{
+private:
+    static const uint64_t EMPTY = ~uint64_t{0};
+    static const size_t MAX_PROBES = 48;
+
+    // (short ID << 16) | transaction index, or EMPTY. Short IDs are 48 bits and
+    // indexes 16, as in the map this replaces; the one entry equal to EMPTY
+    // is simply never found, and that transaction requested from the peer.
+    std::vector<uint64_t> slots;
+    uint64_t mask;
+
+public:
+    explicit ShortIDIndex(size_t nIDs)
+    {
+        size_t nSlots = 1;
+        while (nSlots < 4 * nIDs)
+            nSlots <<= 1;
+        slots.assign(nSlots, uint64_t{EMPTY});
+        mask = nSlots - 1;
+    }
+
+    //! Returns false if shortid is present already, or too far from a free slot.
+    bool Insert(uint64_t shortid, uint16_t index)
+    {
+        for (size_t i = 0; i < MAX_PROBES; i++) {
+            uint64_t& slot = slots[(shortid + i) & mask];
+            if (slot == EMPTY) {
+                slot = (shortid << 16) | index;
+                return true;
+            }
+            if ((slot >> 16) == shortid)
+                return false;
+        }
+        return false;
+    }
+
+    //! The index of the transaction with this short ID, or -1.
+    int Find(uint64_t shortid) const
+    {
+        for (size_t i = 0; i < MAX_PROBES; i++) {
+            const uint64_t slot = slots[(shortid + i) & mask];
+            if (slot == EMPTY)
+                return -1;
+            if ((slot >> 16) == shortid)
+                return slot & 0xffff;
+        }
+        return -1;
+    }
+};
+
+// Short IDs of candidate transactions are computed this many at a time, ahead of the lookups
+static const size_t SHORTID_BATCH_SIZE = 256;
+} // namespace
+
 
 
-ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, const std::vector<std::pair<uint256, CTransactionRef>>& extra_txn) {
+ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& cmpctblock, const std::vector<std::pair<uint256, CTransactionRef>>& extra_txn, const uint256& block_hash_in) {
     if (cmpctblock.header.IsNull() || (cmpctblock.shorttxids.empty() && cmpctblock.prefilledtxn.empty()))
         return READ_STATUS_INVALID;
     if (cmpctblock.shorttxids.size() + cmpctblock.prefilledtxn.size() > MAX_BLOCK_WEIGHT / MIN_SERIALIZABLE_TRANSACTION_WEIGHT)
@@ -54,6 +126,7 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
 
     assert(header.IsNull() && txn_available.empty());
     header = cmpctblock.header;
+    block_hash = block_hash_in.IsNull() ? header.GetHash() : block_hash_in;
     txn_available.resize(cmpctblock.BlockTxCount());
 
     int32_t lastprefilledindex = -1;
@@ -77,93 +150,95 @@ ReadStatus PartiallyDownloadedBlock::InitData(const CBlockHeaderAndShortTxIDs& c
     // Calculate map of txids -> positions and check mempool to see what we have (or don't)
     // Because well-formed cmpctblock messages will have a (relatively) uniform distribution
     // of short IDs, any highly-uneven distribution of elements can be safely treated as a
-    // READ_STATUS_FAILED.
-    std::unordered_map<uint64_t, uint16_t> shorttxids(cmpctblock.shorttxids.size());
+    // READ_STATUS_FAILED (see ShortIDIndex).
+    ShortIDIndex shorttxids(cmpctblock.shorttxids.size());
     uint16_t index_offset = 0;
     for (size_t i = 0; i < cmpctblock.shorttxids.size(); i++) {
         while (txn_available[i + index_offset])
             index_offset++;
-        shorttxids[cmpctblock.shorttxids[i]] = i + index_offset;
-        // To determine the chance that the number of entries in a bucket exceeds N,
-        // we use the fact that the number of elements in a single bucket is
-        // binomially distributed (with n = the number of shorttxids S, and p =
-        // 1 / the number of buckets), that in the worst case the number of buckets is
-        // equal to S (due to std::unordered_map having a default load factor of 1.0),
-        // and that the chance for any bucket to exceed N elements is at most
-        // buckets * (the chance that any given bucket is above N elements).
-        // Thus: P(max_elements_per_bucket > N) <= S * (1 - cdf(binomial(n=S,p=1/S), N)).
-        // If we assume blocks of up to 16000, allowing 12 elements per bucket should
-        // only fail once per ~1 million block transfers (per peer and connection).
-        if (shorttxids.bucket_size(shorttxids.bucket(cmpctblock.shorttxids[i])) > 12)
-            return READ_STATUS_FAILED;
+        // TODO: in the shortid-collision case, we should instead request both transactions
+        // which collided. Falling back to full-block-request here is overkill.
+        if (!shorttxids.Insert(cmpctblock.shorttxids[i], i + index_offset))
+            return READ_STATUS_FAILED; // Short ID collision
     }
-    // TODO: in the shortid-collision case, we should instead request both transactions
-    // which collided. Falling back to full-block-request here is overkill.
-    if (shorttxids.size() != cmpctblock.shorttxids.size())
-        return READ_STATUS_FAILED; // Short ID collision
+    const size_t shorttxids_count = cmpctblock.shorttxids.size();
 
     std::vector<bool> have_txn(txn_available.size());
+    const uint256* batch_hashes[SHORTID_BATCH_SIZE];
+    uint64_t batch_shortids[SHORTID_BATCH_SIZE];
     {
     LOCK(pool->cs);
     const std::vector<std::pair<uint256, CTxMemPool::txiter> >& vTxHashes = pool->vTxHashes;
-    for (size_t i = 0; i < vTxHashes.size(); i++) {
-        uint64_t shortid = cmpctblock.GetShortID(vTxHashes[i].first);
-        std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(shortid);
-        if (idit != shorttxids.end()) {
-            if (!have_txn[idit->second]) {
-                txn_available[idit->second] = vTxHashes[i].second->GetSharedTx();
-                have_txn[idit->second]  = true;
-                mempool_count++;
-            } else {
-                // If we find two mempool txn that match the short id, just request it.
-                // This should be rare enough that the extra bandwidth doesn't matter,
-                // but eating a round-trip due to FillBlock failure would be annoying
-                if (txn_available[idit->second]) {
-                    txn_available[idit->second].reset();
-                    mempool_count--;
+    for (size_t start = 0; start < vTxHashes.size() && mempool_count < shorttxids_count; start += SHORTID_BATCH_SIZE) {
+        const size_t batch_size = std::min(SHORTID_BATCH_SIZE, vTxHashes.size() - start);
+        for (size_t j = 0; j < batch_size; j++)
+            batch_hashes[j] = &vTxHashes[start + j].first;
+        cmpctblock.GetShortIDs(batch_hashes, batch_shortids, batch_size);
+
+        for (size_t j = 0; j < batch_size; j++) {
+            int idx = shorttxids.Find(batch_shortids[j]);
+            if (idx >= 0) {
+                if (!have_txn[idx]) {
+                    txn_available[idx] = vTxHashes[start + j].second->GetSharedTx();
+                    have_txn[idx]  = true;
+                    mempool_count++;
+                } else {
+                    // If we find two mempool txn that match the short id, just request it.
+                    // This should be rare enough that the extra bandwidth doesn't matter,
+                    // but eating a round-trip due to FillBlock failure would be annoying
+                    if (txn_available[idx]) {
+                        txn_available[idx].reset();
+                        mempool_count--;
+                    }
                 }
             }
+            // Though ideally we'd continue scanning for the two-txn-match-shortid case,
+            // the performance win of an early exit here is too good to pass up and worth
+            // the extra risk.
+            if (mempool_count == shorttxids_count)
+                break;
         }
-        // Though ideally we'd continue scanning for the two-txn-match-shortid case,
-        // the performance win of an early exit here is too good to pass up and worth
-        // the extra risk.
-        if (mempool_count == shorttxids.size())
-            break;
     }
     }
 
-    for (size_t i = 0; i < extra_txn.size(); i++) {
-        uint64_t shortid = cmpctblock.GetShortID(extra_txn[i].first);
-        std::unordered_map<uint64_t, uint16_t>::iterator idit = shorttxids.find(shortid);
-        if (idit != shorttxids.end()) {
-            if (!have_txn[idit->second]) {
-                txn_available[idit->second] = extra_txn[i].second;
-                have_txn[idit->second]  = true;
-                mempool_count++;
-                extra_count++;
-            } else {
-                // If we find two mempool/extra txn that match the short id, just
-                // request it.
-                // This should be rare enough that the extra bandwidth doesn't matter,
-                // but eating a round-trip due to FillBlock failure would be annoying
-                // Note that we don't want duplication between extra_txn and mempool to
-                // trigger this case, so we compare witness hashes first
-                if (txn_available[idit->second] &&
-                        txn_available[idit->second]->GetWitnessHash() != extra_txn[i].second->GetWitnessHash()) {
-                    txn_available[idit->second].reset();
-                    mempool_count--;
-                    extra_count--;
+    for (size_t start = 0; start < extra_txn.size() && mempool_count < shorttxids_count; start += SHORTID_BATCH_SIZE) {
+        const size_t batch_size = std::min(SHORTID_BATCH_SIZE, extra_txn.size() - start);
+        for (size_t j = 0; j < batch_size; j++)
+            batch_hashes[j] = &extra_txn[start + j].first;
+        cmpctblock.GetShortIDs(batch_hashes, batch_shortids, batch_size);
+
+        for (size_t j = 0; j < batch_size; j++) {
+            int idx = shorttxids.Find(batch_shortids[j]);
+            if (idx >= 0) {
+                if (!have_txn[idx]) {
+                    txn_available[idx] = extra_txn[start + j].second;
+                    have_txn[idx]  = true;
+                    mempool_count++;
+                    extra_count++;
+                } else {
+                    // If we find two mempool/extra txn that match the short id, just
+                    // request it.
+                    // This should be rare enough that the extra bandwidth doesn't matter,
+                    // but eating a round-trip due to FillBlock failure would be annoying
+                    // Note that we don't want duplication between extra_txn and mempool to
+                    // trigger this case, so we compare witness hashes first
+                    if (txn_available[idx] &&
+                            txn_available[idx]->GetWitnessHash() != extra_txn[start + j].second->GetWitnessHash()) {
+                        txn_available[idx].reset();
+                        mempool_count--;
+                        extra_count--;
+                    }
                 }
             }
+            // Though ideally we'd continue scanning for the two-txn-match-shortid case,
+            // the performance win of an early exit here is too good to pass up and worth
+            // the extra risk.
+            if (mempool_count == shorttxids_count)
+                break;
         }
-        // Though ideally we'd continue scanning for the two-txn-match-shortid case,
-        // the performance win of an early exit here is too good to pass up and worth
-        // the extra risk.
-        if (mempool_count == shorttxids.size())
-            break;
     }
 
-    LogPrint(BCLog::CMPCTBLOCK, "Initialized PartiallyDownloadedBlock for block %s using a cmpctblock of size %lu\n", cmpctblock.header.GetHash().ToString(), GetSerializeSize(cmpctblock, PROTOCOL_VERSION));
+    LogPrint(BCLog::CMPCTBLOCK, "Initialized PartiallyDownloadedBlock for block %s using a cmpctblock of size %lu\n", block_hash.ToString(), GetSerializeSize(cmpctblock, PROTOCOL_VERSION));
 
     return READ_STATUS_OK;
 }
@@ -176,7 +251,7 @@ bool PartiallyDownloadedBlock::IsTxAvailable(size_t index) const {
 
 ReadStatus PartiallyDownloadedBlock::FillBlock(CBlock& block, const std::vector<CTransactionRef>& vtx_missing) {
     assert(!header.IsNull());
-    uint256 hash = header.GetHash();
+    const uint256 hash = block_hash;
     block = header;
     block.vtx.resize(txn_available.size());
 
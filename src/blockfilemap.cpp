@@ -0,0 +1,78 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfilemap.h>
+
+#include <util/system.h>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+CMappedFile::~CMappedFile()
+{
+#ifndef WIN32
+    munmap(const_cast<uint8_t*>(m_data), m_size);
+#endif
+}
+
+/** Map the file at path, or return null. */
+static std::shared_ptr<const CMappedFile> MapFile(const fs::path& path)
+{
+#ifdef WIN32
+    // Blocks are read through stdio instead.
+    return nullptr;
+#else
+    int fd = open(path.string().c_str(), O_RDONLY);
+    if (fd == -1) {
+        return nullptr;
+    }
+    std::shared_ptr<const CMappedFile> file;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        void* data = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (data != MAP_FAILED) {
+            file = std::make_shared<const CMappedFile>(static_cast<const uint8_t*>(data), st.st_size);
+        } else {
+            LogPrintf("Unable to map %s: %s\n", path.string(), strerror(errno));
+        }
+    }
+    // The mapping outlives the descriptor.
+    close(fd);
+    return file;
+#endif
+}
+
+std::shared_ptr<const CMappedFile> CBlockFileMap::Get(int nFile, const fs::path& path)
+{
+    if (nMaxFiles == 0) return nullptr;
+
+    LOCK(cs);
+    auto it = mapFiles.find(nFile);
+    if (it != mapFiles.end()) {
+        it->second.nLastUse = ++nUseCounter;
+        return it->second.file;
+    }
+
+    std::shared_ptr<const CMappedFile> file = MapFile(path);
+    if (!file) return nullptr;
+    if (mapFiles.size() >= nMaxFiles) {
+        auto itOldest = mapFiles.begin();
+        for (auto itEntry = mapFiles.begin(); itEntry != mapFiles.end(); ++itEntry) {
+            if (itEntry->second.nLastUse < itOldest->second.nLastUse) itOldest = itEntry;
+        }
+        mapFiles.erase(itOldest);
+    }
+    mapFiles.emplace(nFile, Entry{file, ++nUseCounter});
+    return file;
+}
+
+void CBlockFileMap::Drop(int nFile)
+{
+    LOCK(cs);
+    mapFiles.erase(nFile);
+}
@@ -0,0 +1,83 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKFILEMAP_H
+#define BITCOIN_BLOCKFILEMAP_H
+
+#include <fs.h>
+#include <span.h>
+#include <sync.h>
+
+#include <map>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+//! Block files kept mapped at once (each is at most MAX_BLOCKFILE_SIZE)
+static const size_t MAX_MAPPED_BLOCK_FILES = sizeof(void*) >= 8 ? 64 : 4;
+
+/** A file mapped read-only into memory, unmapped when destroyed. */
+class CMappedFile
+{
+private:
+    const uint8_t* m_data;
+    size_t m_size;
+
+public:
+    CMappedFile(const uint8_t* data, size_t size) : m_data(data), m_size(size) {}
+    ~CMappedFile();
+
+    CMappedFile(const CMappedFile&) = delete;
+    CMappedFile& operator=(const CMappedFile&) = delete;
+
+    Span<const uint8_t> GetData() const { return Span<const uint8_t>(m_data, m_size); }
+    size_t size() const { return m_size; }
+};
+
+/**
+ * Read-only mappings of block files, so that blocks can be served from the
+ * page cache without a seek, read and copy for each. Only files that are no
+ * longer appended to may be mapped: the mapping covers the file as it was
+ * when first requested. The least recently used mapping is released once
+ * more than nMaxFiles are held; callers still using it keep it alive.
+ */
+class CBlockFileMap
+{
+private:
+    struct Entry {
+        std::shared_ptr<const CMappedFile> file;
+        uint64_t nLastUse;
+    };
+
+    Mutex cs;
+    std::map<int, Entry> mapFiles GUARDED_BY(cs);
+    uint64_t nUseCounter GUARDED_BY(cs);
+    const size_t nMaxFiles;
+
+public:
+    explicit CBlockFileMap(size_t nMaxFilesIn) : nUseCounter(0), nMaxFiles(nMaxFilesIn) {}
+
+    //! Return the mapping of file nFile at path, mapping it if needed. Null if it cannot be mapped.
+    std::shared_ptr<const CMappedFile> Get(int nFile, const fs::path& path);
+    //! Release the mapping of file nFile, if any (e.g. because it is being deleted).
+    void Drop(int nFile);
+};
+
+/**
+ * A serialized block as stored on disk: either a view into a mapped block
+ * file, or a copy read into vBuffer for a file that cannot be mapped.
+ */
+struct CRawBlock
+{
+    Span<const uint8_t> data;
+    //! Keeps the mapping data points into alive; null if it points into vBuffer
+    std::shared_ptr<const CMappedFile> file;
+    std::vector<uint8_t> vBuffer;
+
+    CRawBlock() {}
+    CRawBlock(const CRawBlock&) = delete;
+    CRawBlock& operator=(const CRawBlock&) = delete;
+};
+
+#endif // BITCOIN_BLOCKFILEMAP_H
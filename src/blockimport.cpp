@@ -0,0 +1,192 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockimport.h>
+
+#include <checkqueue.h>
+#include <clientversion.h>
+#include <consensus/consensus.h>
+#include <consensus/validation.h>
+#include <crypto/scrypt.h>
+#include <streams.h>
+#include <util/system.h>
+#include <validation.h>
+
+bool CBlockImportCheck::operator()()
+{
+    std::vector<const CBlockHeader*> vHeaders;
+    for (size_t i = 0; i < nCount; ++i) {
+        CBlockImportReader::Entry& entry = *pentry[i];
+        try {
+            std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+            VectorReader(SER_DISK, CLIENT_VERSION, entry.vRaw, 0, *pblock);
+            entry.pblock = std::move(pblock);
+            vHeaders.push_back(entry.pblock.get());
+        } catch (const std::exception& e) {
+            entry.strError = e.what();
+        }
+        entry.vRaw.clear();
+        entry.vRaw.shrink_to_fit();
+    }
+    CBlockHeader::MemoizeHashes(vHeaders.data(), vHeaders.size());
+
+    // The import does not pass blocks it has stored already to AcceptBlock.
+    // Don't wait on cs_main to find them though: checking one is harmless.
+    std::vector<bool> vStored(nCount, false);
+    {
+        TRY_LOCK(cs_main, lockMain);
+        if (lockMain) {
+            for (size_t i = 0; i < nCount; ++i) {
+                if (!pentry[i]->pblock) continue;
+                const CBlockIndex* pindex = LookupBlockIndex(pentry[i]->pblock->GetHash());
+                vStored[i] = pindex && (pindex->nStatus & BLOCK_HAVE_DATA);
+            }
+        }
+    }
+    for (size_t i = 0; i < nCount; ++i) {
+        if (pentry[i]->pblock && !vStored[i]) {
+            // Memoizes the result (block.fChecked) if the block passes.
+            CValidationState state;
+            CheckBlock(*pentry[i]->pblock, state, *pconsensusParams);
+        }
+    }
+    return true;
+}
+
+CBlockImportReader::CBlockImportReader(FILE* fileIn, const CMessageHeader::MessageStartChars& messageStartIn, const Consensus::Params& consensusParamsIn, CCheckQueue<CTaskCheck>* queue, int nThreads) :
+    consensusParams(consensusParamsIn), messageStart(messageStartIn), pqueue(queue), nBatchSize(ScryptLanes() * std::max(nThreads, 1)),
+    nClaimed(0), nQueuedBytes(0), fEndOfFile(false), fInterrupt(false)
+{
+    threadDecoder = std::thread([this] { TraceThread("importdecode", [this] { ThreadDecoder(); }); });
+    threadReader = std::thread([this, fileIn] { TraceThread("importread", [this, fileIn] { ThreadReader(fileIn); }); });
+}
+
+CBlockImportReader::~CBlockImportReader()
+{
+    {
+        LOCK(cs);
+        fInterrupt = true;
+    }
+    condReader.notify_all();
+    condDecoder.notify_all();
+    threadReader.join();
+    threadDecoder.join();
+}
+
+void CBlockImportReader::ThreadReader(FILE* fileIn)
+{
+    try {
+        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
+        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
+        uint64_t nRewind = blkdat.GetPos();
+        while (!blkdat.eof()) {
+            blkdat.SetPos(nRewind);
+            nRewind++; // start one byte further next time, in case of failure
+            blkdat.SetLimit(); // remove former limit
+            unsigned int nSize = 0;
+            try {
+                // locate a header
+                unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
+                blkdat.FindByte(messageStart[0]);
+                nRewind = blkdat.GetPos()+1;
+                blkdat >> buf;
+                if (memcmp(buf, messageStart, CMessageHeader::MESSAGE_START_SIZE))
+                    continue;
+                // read size
+                blkdat >> nSize;
+                if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
+                    continue;
+            } catch (const std::exception&) {
+                // no valid block header found; don't complain
+                break;
+            }
+
+            std::shared_ptr<Entry> entry = std::make_shared<Entry>();
+            try {
+                // read block
+                entry->nPos = blkdat.GetPos();
+                entry->nSize = nSize;
+                blkdat.SetLimit(entry->nPos + nSize);
+                entry->vRaw.resize(nSize);
+                blkdat.read((char*)entry->vRaw.data(), nSize);
+                nRewind = blkdat.GetPos();
+            } catch (const std::exception& e) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+                continue;
+            }
+            entry->fDone = false;
+
+            WAIT_LOCK(cs, lock);
+            condReader.wait(lock, [this]() EXCLUSIVE_LOCKS_REQUIRED(cs) { return fInterrupt || queue.empty() || nQueuedBytes < MAX_IMPORT_QUEUE_BYTES; });
+            if (fInterrupt) break;
+            nQueuedBytes += nSize;
+            queue.push_back(std::move(entry));
+            condDecoder.notify_one();
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("%s: Error reading block file - %s\n", __func__, e.what());
+    }
+
+    {
+        LOCK(cs);
+        fEndOfFile = true;
+    }
+    condNext.notify_all();
+}
+
+void CBlockImportReader::ThreadDecoder()
+{
+    const size_t nLanes = ScryptLanes();
+    std::vector<std::shared_ptr<Entry>> vEntries;
+    std::vector<CTaskCheck> vChecks;
+    while (true) {
+        vEntries.clear();
+        {
+            WAIT_LOCK(cs, lock);
+            condDecoder.wait(lock, [this]() EXCLUSIVE_LOCKS_REQUIRED(cs) { return fInterrupt || nClaimed < queue.size(); });
+            if (fInterrupt) return;
+            while (nClaimed < queue.size() && vEntries.size() < nBatchSize) {
+                vEntries.push_back(queue[nClaimed++]);
+            }
+        }
+
+        // One check per run of consecutive blocks filling the scrypt lanes;
+        // this thread works through them too while it waits.
+        vChecks.clear();
+        for (size_t i = 0; i < vEntries.size(); i += nLanes) {
+            vChecks.emplace_back(CBlockImportCheck(&vEntries[i], std::min(nLanes, vEntries.size() - i), consensusParams));
+        }
+        CCheckQueueControl<CTaskCheck> control(pqueue);
+        control.Add(vChecks);
+        control.Wait();
+
+        {
+            LOCK(cs);
+            for (const auto& entry : vEntries) {
+                entry->fDone = true;
+            }
+        }
+        condNext.notify_all();
+    }
+}
+
+bool CBlockImportReader::Next(CImportedBlock& block)
+{
+    std::shared_ptr<Entry> entry;
+    {
+        WAIT_LOCK(cs, lock);
+        condNext.wait(lock, [this]() EXCLUSIVE_LOCKS_REQUIRED(cs) { return (!queue.empty() && queue.front()->fDone) || (queue.empty() && fEndOfFile); });
+        if (queue.empty()) return false;
+        entry = std::move(queue.front());
+        queue.pop_front();
+        --nClaimed;
+        nQueuedBytes -= entry->nSize;
+    }
+    condReader.notify_all();
+
+    block.nPos = entry->nPos;
+    block.pblock = std::move(entry->pblock);
+    block.strError = std::move(entry->strError);
+    return true;
+}
@@ -0,0 +1,122 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKIMPORT_H
+#define BITCOIN_BLOCKIMPORT_H
+
+#include <primitives/block.h>
+#include <protocol.h>
+#include <sync.h>
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Consensus { struct Params; }
+template <typename T> class CCheckQueue;
+class CTaskCheck;
+
+//! Serialized blocks read ahead of the block being imported (at least one is always queued)
+static const size_t MAX_IMPORT_QUEUE_BYTES = 64 << 20;
+
+/** A block found in a block file, ready to be accepted. */
+struct CImportedBlock
+{
+    //! Position of the block data (past the message start and size) in the file
+    uint64_t nPos;
+    //! Null if the block could not be deserialized
+    std::shared_ptr<CBlock> pblock;
+    std::string strError;
+};
+
+/**
+ * Pipeline decoding the blocks in a block file (blk?????.dat or bootstrap
+ * format) for import. A reader thread scans the file for message starts and
+ * queues the serialized blocks; a decode thread hands them in batches to the
+ * block import check threads (see CBlockImportCheck), which deserialize them,
+ * compute the header hashes (several scrypt lanes at a time) and run the
+ * context-free CheckBlock, so that a valid block reaches AcceptBlock with all
+ * of that memoized. Next() hands the blocks out in file order.
+ *
+ * A block that fails to deserialize is returned without its data (and the
+ * scan resumes after its declared size); one that fails CheckBlock is
+ * returned as is, for AcceptBlock to reject.
+ */
+class CBlockImportReader
+{
+private:
+    friend class CBlockImportCheck;
+
+    struct Entry {
+        uint64_t nPos;
+        size_t nSize;
+        std::vector<unsigned char> vRaw;
+        std::shared_ptr<CBlock> pblock;
+        std::string strError;
+        bool fDone;
+    };
+
+    const Consensus::Params& consensusParams;
+    const CMessageHeader::MessageStartChars& messageStart;
+    CCheckQueue<CTaskCheck>* const pqueue;
+    //! Blocks decoded per batch, enough to keep every check thread busy
+    const size_t nBatchSize;
+
+    Mutex cs;
+    std::condition_variable condReader;
+    std::condition_variable condDecoder;
+    std::condition_variable condNext;
+    //! Blocks in file order; the first nClaimed have been taken by the decode thread
+    std::deque<std::shared_ptr<Entry>> queue GUARDED_BY(cs);
+    size_t nClaimed GUARDED_BY(cs);
+    size_t nQueuedBytes GUARDED_BY(cs);
+    bool fEndOfFile GUARDED_BY(cs);
+    bool fInterrupt GUARDED_BY(cs);
+
+    std::thread threadReader;
+    std::thread threadDecoder;
+
+    void ThreadReader(FILE* fileIn);
+    void ThreadDecoder();
+
+public:
+    /**
+     * Takes over fileIn, closing it when done. The blocks are decoded over
+     * queue; nThreads is the number of threads serving it, counting the
+     * decode thread itself (see ThreadBlockCheck()).
+     */
+    CBlockImportReader(FILE* fileIn, const CMessageHeader::MessageStartChars& messageStartIn, const Consensus::Params& consensusParamsIn, CCheckQueue<CTaskCheck>* queue, int nThreads);
+    ~CBlockImportReader();
+
+    CBlockImportReader(const CBlockImportReader&) = delete;
+    CBlockImportReader& operator=(const CBlockImportReader&) = delete;
+
+    //! Wait for the next block in the file. Returns false at the end of the file.
+    bool Next(CImportedBlock& block);
+};
+
+/**
+ * Closure decoding a run of consecutive blocks for CBlockImportReader. Blocks
+ * that are stored already are not checked, as the import skips them.
+ * Note that this stores references to the entries
+ */
+class CBlockImportCheck
+{
+private:
+    const std::shared_ptr<CBlockImportReader::Entry>* pentry;
+    size_t nCount;
+    const Consensus::Params* pconsensusParams;
+
+public:
+    CBlockImportCheck(const std::shared_ptr<CBlockImportReader::Entry>* entryIn, size_t nCountIn, const Consensus::Params& consensusParamsIn) :
+        pentry(entryIn), nCount(nCountIn), pconsensusParams(&consensusParamsIn) {}
+
+    bool operator()();
+};
+
+#endif // BITCOIN_BLOCKIMPORT_H
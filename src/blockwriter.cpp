@@ -0,0 +1,242 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockwriter.h>
+
+#include <util/system.h>
+
+CBlockFileWriter::CBlockFileWriter(const OpenFileFn& openFileIn) :
+    openFile(openFileIn), nQueuedBytes(0), nQueued(0), nCompleted(0), fFailed(false), fRunning(false), fStop(false)
+{
+}
+
+CBlockFileWriter::~CBlockFileWriter()
+{
+    Stop();
+    LOCK(cs_files);
+    for (const auto& entry : mapOpenFiles) {
+        fclose(entry.second);
+    }
+}
+
+void CBlockFileWriter::Start()
+{
+    LOCK(cs);
+    if (fRunning) return;
+    fRunning = true;
+    fStop = false;
+    threadWriter = std::thread([this] { TraceThread("blockwriter", [this] { ThreadWriter(); }); });
+}
+
+void CBlockFileWriter::Stop()
+{
+    {
+        LOCK(cs);
+        if (!fRunning) return;
+        // Operations submitted from now on are performed by the caller, after the queue.
+        fRunning = false;
+        fStop = true;
+    }
+    condWriter.notify_all();
+    threadWriter.join();
+}
+
+void CBlockFileWriter::ThreadWriter()
+{
+    std::deque<Op> ops;
+    while (true) {
+        {
+            WAIT_LOCK(cs, lock);
+            condWriter.wait(lock, [this]() EXCLUSIVE_LOCKS_REQUIRED(cs) { return fStop || !queue.empty(); });
+            if (queue.empty()) return;
+            ops.swap(queue);
+        }
+
+        bool fSuccess;
+        {
+            LOCK(cs_files);
+            fSuccess = Process(ops, true);
+        }
+
+        {
+            LOCK(cs);
+            for (const Op& op : ops) {
+                if (op.type == Op::WRITE) {
+                    mapPending.erase(PosKey(op.fileType, op.pos.nFile, op.pos.nPos));
+                    nQueuedBytes -= op.data.size();
+                }
+            }
+            nCompleted += ops.size();
+            if (!fSuccess) fFailed = true;
+        }
+        condDone.notify_all();
+        ops.clear();
+    }
+}
+
+FILE* CBlockFileWriter::GetFile(BlockFileType fileType, int nFile)
+{
+    const FileKey key(fileType, nFile);
+    auto it = mapOpenFiles.find(key);
+    if (it != mapOpenFiles.end()) return it->second;
+    FILE* file = openFile(CDiskBlockPos(nFile, 0), fileType);
+    if (file) mapOpenFiles.emplace(key, file);
+    return file;
+}
+
+bool CBlockFileWriter::CloseFile(BlockFileType fileType, int nFile, bool fCommit)
+{
+    const FileKey key(fileType, nFile);
+    FILE* file;
+    auto it = mapOpenFiles.find(key);
+    if (it != mapOpenFiles.end()) {
+        file = it->second;
+        mapOpenFiles.erase(it);
+    } else {
+        if (!fCommit) return true;
+        // Written (and closed) earlier; committing any descriptor of the file will do.
+        file = openFile(CDiskBlockPos(nFile, 0), fileType);
+        if (!file) return false;
+    }
+    bool fSuccess = !fCommit || FileCommit(file);
+    fSuccess &= fclose(file) == 0;
+    if (fCommit) setDirtyFiles.erase(key);
+    return fSuccess;
+}
+
+bool CBlockFileWriter::Process(const std::deque<Op>& ops, bool fKeepOpen)
+{
+    bool fSuccess = true;
+    bool fSync = false;
+    for (const Op& op : ops) {
+        switch (op.type) {
+        case Op::WRITE: {
+            FILE* file = GetFile(op.fileType, op.pos.nFile);
+            if (!file || fseek(file, op.pos.nPos, SEEK_SET) || fwrite(op.data.data(), 1, op.data.size(), file) != op.data.size()) {
+                LogPrintf("%s: Failed to write %u bytes at %s\n", __func__, op.data.size(), op.pos.ToString());
+                fSuccess = false;
+            }
+            setDirtyFiles.emplace(op.fileType, op.pos.nFile);
+            break;
+        }
+        case Op::FINALIZE: {
+            for (const auto& size : {std::make_pair(BlockFileType::BLOCK, op.nBlockSize), std::make_pair(BlockFileType::UNDO, op.nUndoSize)}) {
+                FILE* file = GetFile(size.first, op.pos.nFile);
+                if (file) {
+                    // Writes still buffered would extend the file again.
+                    fSuccess &= fflush(file) == 0;
+                    fSuccess &= TruncateFile(file, size.second);
+                    fSuccess &= CloseFile(size.first, op.pos.nFile, true);
+                }
+            }
+            break;
+        }
+        case Op::SYNC:
+            fSync = true;
+            break;
+        }
+    }
+
+    if (fSync) {
+        // A single commit for every file written since the last one
+        const std::set<FileKey> setCommit = setDirtyFiles;
+        for (const FileKey& key : setCommit) {
+            fSuccess &= CloseFile(key.first, key.second, true);
+        }
+    }
+    // Make the data visible to readers using their own descriptors (or mappings).
+    for (const auto& entry : mapOpenFiles) {
+        fSuccess &= fflush(entry.second) == 0;
+    }
+    if (!fKeepOpen || mapOpenFiles.size() > MAX_BLOCK_WRITER_OPEN_FILES) {
+        while (!mapOpenFiles.empty()) {
+            fSuccess &= CloseFile(mapOpenFiles.begin()->first.first, mapOpenFiles.begin()->first.second, false);
+        }
+    }
+    return fSuccess;
+}
+
+uint64_t CBlockFileWriter::Submit(Op&& op)
+{
+    uint64_t nSeq;
+    {
+        WAIT_LOCK(cs, lock);
+        if (fRunning && op.type == Op::WRITE) {
+            condDone.wait(lock, [this]() EXCLUSIVE_LOCKS_REQUIRED(cs) { return !fRunning || queue.empty() || nQueuedBytes < MAX_BLOCK_WRITE_QUEUE_BYTES; });
+        }
+        if (fRunning) {
+            if (op.type == Op::WRITE) {
+                mapPending[PosKey(op.fileType, op.pos.nFile, op.pos.nPos)] = op.pos.nPos + op.data.size();
+                nQueuedBytes += op.data.size();
+            }
+            queue.push_back(std::move(op));
+            condWriter.notify_one();
+            return ++nQueued;
+        }
+        // Not running (any more): wait for the writer thread to finish, and perform the operation here.
+        condDone.wait(lock, [this]() EXCLUSIVE_LOCKS_REQUIRED(cs) { return nCompleted == nQueued; });
+        nSeq = ++nQueued;
+    }
+
+    std::deque<Op> ops;
+    ops.push_back(std::move(op));
+    bool fSuccess;
+    {
+        LOCK(cs_files);
+        fSuccess = Process(ops, false);
+    }
+    {
+        LOCK(cs);
+        ++nCompleted;
+        if (!fSuccess) fFailed = true;
+    }
+    condDone.notify_all();
+    return nSeq;
+}
+
+bool CBlockFileWriter::Write(BlockFileType fileType, const CDiskBlockPos& pos, std::vector<unsigned char>&& data)
+{
+    Op op;
+    op.type = Op::WRITE;
+    op.fileType = fileType;
+    op.pos = pos;
+    op.data = std::move(data);
+    Submit(std::move(op));
+    LOCK(cs);
+    return !fFailed;
+}
+
+bool CBlockFileWriter::Finalize(int nFile, unsigned int nBlockSize, unsigned int nUndoSize)
+{
+    Op op;
+    op.type = Op::FINALIZE;
+    op.pos = CDiskBlockPos(nFile, 0);
+    op.nBlockSize = nBlockSize;
+    op.nUndoSize = nUndoSize;
+    Submit(std::move(op));
+    LOCK(cs);
+    return !fFailed;
+}
+
+bool CBlockFileWriter::Sync()
+{
+    Op op;
+    op.type = Op::SYNC;
+    const uint64_t nSeq = Submit(std::move(op));
+    WAIT_LOCK(cs, lock);
+    condDone.wait(lock, [this, nSeq]() EXCLUSIVE_LOCKS_REQUIRED(cs) { return nCompleted >= nSeq; });
+    return !fFailed;
+}
+
+void CBlockFileWriter::WaitForWrite(BlockFileType fileType, const CDiskBlockPos& pos)
+{
+    WAIT_LOCK(cs, lock);
+    condDone.wait(lock, [&]() EXCLUSIVE_LOCKS_REQUIRED(cs) {
+        // The last write starting at or before pos
+        auto it = mapPending.upper_bound(PosKey(fileType, pos.nFile, pos.nPos));
+        if (it == mapPending.begin()) return true;
+        --it;
+        return std::get<0>(it->first) != fileType || std::get<1>(it->first) != pos.nFile || it->second <= pos.nPos;
+    });
+}
@@ -0,0 +1,118 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_BLOCKWRITER_H
+#define BITCOIN_BLOCKWRITER_H
+
+#include <chain.h>
+#include <sync.h>
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <set>
+#include <stdio.h>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+//! Serialized block and undo data queued for writing before Write() waits (at least one write is always queued)
+static const size_t MAX_BLOCK_WRITE_QUEUE_BYTES = 32 << 20;
+//! Files the writer thread keeps open between syncs
+static const size_t MAX_BLOCK_WRITER_OPEN_FILES = 8;
+
+/** The two kinds of files a block file number refers to. */
+enum class BlockFileType {
+    BLOCK, //!< blk?????.dat
+    UNDO,  //!< rev?????.dat
+};
+
+/**
+ * Writes serialized block and undo data to their (already allocated)
+ * positions in the block files.
+ *
+ * Once Start() has been called, writes are queued and performed by a
+ * dedicated thread, so that connecting a block does not wait on the
+ * filesystem. The thread writes everything queued at once and calls fsync
+ * only when Sync() or Finalize() ask for it, committing all the files
+ * written since the last sync together. Until then (and after Stop())
+ * everything happens on the calling thread.
+ *
+ * Reads of a position that may still be queued must call WaitForWrite()
+ * first. A failed write is reported by the next Write() or Sync(); as the
+ * block index is only written after a Sync(), it never refers to data that
+ * did not make it to disk.
+ */
+class CBlockFileWriter
+{
+public:
+    //! Open a block or undo file for writing, creating it if needed
+    typedef std::function<FILE*(const CDiskBlockPos&, BlockFileType)> OpenFileFn;
+
+private:
+    struct Op {
+        enum { WRITE, FINALIZE, SYNC } type;
+        BlockFileType fileType;
+        CDiskBlockPos pos;
+        std::vector<unsigned char> data;
+        unsigned int nBlockSize;
+        unsigned int nUndoSize;
+    };
+    typedef std::pair<BlockFileType, int> FileKey;
+    typedef std::tuple<BlockFileType, int, unsigned int> PosKey;
+
+    const OpenFileFn openFile;
+
+    Mutex cs;
+    std::condition_variable condWriter;
+    std::condition_variable condDone;
+    std::deque<Op> queue GUARDED_BY(cs);
+    //! Start and end of every queued or in progress write
+    std::map<PosKey, unsigned int> mapPending GUARDED_BY(cs);
+    size_t nQueuedBytes GUARDED_BY(cs);
+    //! Operations queued and completed since construction
+    uint64_t nQueued GUARDED_BY(cs);
+    uint64_t nCompleted GUARDED_BY(cs);
+    bool fFailed GUARDED_BY(cs);
+    bool fRunning GUARDED_BY(cs);
+    bool fStop GUARDED_BY(cs);
+    std::thread threadWriter;
+
+    //! Held by whoever performs operations, the writer thread or (when not running) the caller
+    Mutex cs_files;
+    std::map<FileKey, FILE*> mapOpenFiles GUARDED_BY(cs_files);
+    //! Files written since they were last committed
+    std::set<FileKey> setDirtyFiles GUARDED_BY(cs_files);
+
+    void ThreadWriter();
+    //! Perform a batch of operations, returning false if any failed. Files are closed afterwards unless fKeepOpen.
+    bool Process(const std::deque<Op>& ops, bool fKeepOpen) EXCLUSIVE_LOCKS_REQUIRED(cs_files);
+    FILE* GetFile(BlockFileType fileType, int nFile) EXCLUSIVE_LOCKS_REQUIRED(cs_files);
+    bool CloseFile(BlockFileType fileType, int nFile, bool fCommit) EXCLUSIVE_LOCKS_REQUIRED(cs_files);
+    //! Queue (or, when not running, perform) an operation and return its sequence number
+    uint64_t Submit(Op&& op);
+
+public:
+    explicit CBlockFileWriter(const OpenFileFn& openFileIn);
+    ~CBlockFileWriter();
+
+    CBlockFileWriter(const CBlockFileWriter&) = delete;
+    CBlockFileWriter& operator=(const CBlockFileWriter&) = delete;
+
+    void Start();
+    //! Perform everything still queued and return to writing on the calling thread.
+    void Stop();
+
+    //! Write data at pos. Returns false if this or an earlier write failed.
+    bool Write(BlockFileType fileType, const CDiskBlockPos& pos, std::vector<unsigned char>&& data);
+    //! Truncate block file nFile and its undo file to their final sizes and commit them, after the writes queued so far.
+    bool Finalize(int nFile, unsigned int nBlockSize, unsigned int nUndoSize);
+    //! Wait until everything queued so far is written and committed. Returns false if anything failed.
+    bool Sync();
+    //! Wait until no queued write covers pos.
+    void WaitForWrite(BlockFileType fileType, const CDiskBlockPos& pos);
+};
+
+#endif // BITCOIN_BLOCKWRITER_H
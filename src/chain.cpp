@@ -6,6 +6,9 @@
 #include <chain.h>
 #include <validation.h>
 #include <logging.h>
+#include <sync.h>
+
+#include <unordered_map>
 
 /**
  * CChain implementation
@@ -120,6 +123,55 @@ void CBlockIndex::BuildSkip()
         pskip = pprev->GetAncestor(GetSkipHeight(nHeight));
 }
 
+void CBlockIndex::BuildPrevAlgo()
+{
+    if (!pprev)
+        return;
+    // The walks in GetLastBlockIndex(2) stop at the genesis block, so it
+    // stands in for every kind.
+    bool fGenesis = pprev->pprev == nullptr;
+    pprevPoW = (fGenesis || pprev->IsProofOfWork()) ? pprev : pprev->pprevPoW;
+    pprevPoS = (fGenesis || pprev->IsFPOS(false)) ? pprev : pprev->pprevPoS;
+    pprevFPoS = (fGenesis || pprev->IsFPOS(true)) ? pprev : pprev->pprevFPoS;
+}
+
+namespace {
+//! Hardest nBits of the stake trust window of every 1024-aligned block seen,
+//! keyed by that block's hash. A hash fixes its whole ancestry, so entries
+//! stay valid across reorgs and never need to be invalidated.
+CCriticalSection cs_base_stake_bits;
+std::unordered_map<uint256, uint32_t, BlockHasher> mapBaseStakeBits GUARDED_BY(cs_base_stake_bits);
+}
+
+uint32_t GetBaseStakeBits(const CBlockIndex* pindexAligned)
+{
+    assert((pindexAligned->nHeight & 1023) == 0);
+    {
+        LOCK(cs_base_stake_bits);
+        auto it = mapBaseStakeBits.find(pindexAligned->GetBlockHash());
+        if (it != mapBaseStakeBits.end()) {
+            return it->second;
+        }
+    }
+
+    // The window is the 1024 blocks ending 1024 blocks before pindexAligned.
+    // Near genesis it is cut short, or empty (no stake trust).
+    const CBlockIndex* pindex = pindexAligned->GetAncestor(pindexAligned->nHeight - 1024);
+    uint32_t nBestBits = 0;
+    for (int i = 0; i < 1024 && pindex; ++i)
+    {
+        if (pindex->nBits < nBestBits || nBestBits == 0) {
+            nBestBits = pindex->nBits;
+        }
+        pindex = pindex->pprev;
+    }
+
+    LOCK(cs_base_stake_bits);
+    mapBaseStakeBits.emplace(pindexAligned->GetBlockHash(), nBestBits);
+    LogPrintf("StakeTrust height=%d nBestBits=%08x\n", pindexAligned->nHeight, nBestBits);
+    return nBestBits;
+}
+
 // [PINK] https://github.com/Pink2Dev/Pink2/blob/2.2.3.0/src/main.cpp#L2416
 void GetModTrust(arith_uint256& bnStakeTrust, arith_uint256& bnTarget, CBlockIndex* pindexBase,
                  const uint32_t nBlockTime, bool isPos, bool isNew)
@@ -128,47 +180,20 @@ void GetModTrust(arith_uint256& bnStakeTrust, arith_uint256& bnTarget, CBlockInd
 
     // If this block is more than 10 minutes older than our current best block and is building on a block deeper
     // in our chain than our previous best block then we're going to treat it like it's difficulty was 10x easier.
-    if (isNew && pindexBest && pindexBase->nHeight < pindexBest->pprev->nHeight && nBlockTime < pindexBest->nTime - 600) {
+    if (isNew && pindexBest && pindexBest->pprev && pindexBase->nHeight < pindexBest->pprev->nHeight && nBlockTime < pindexBest->nTime - 600) {
         bnTarget = bnTarget * 10;
     }
 
-    if (isPos)
+    if (isPos && pindexBase)
     {
         /* nBaseStakeTrust uses the most difficult block in the last 1024 block window (which ends at least 1024 blocks in the past)
         *  as a base chaintrust value for POS blocks. This keeps POS block trust within a reasonable range of POW block trust,
         *  allowing POS blocks to provide significantly more protection against a POW based 51% attack while still allowing POW blocks
         *  to provide protection against a POS based 51% attack.
         */
-        // Generate new nBaseStakeTrust if we don't have one or it has been 1024 blocks since the last one.
-        if (nBaseStakeTrust == 0 || pindexBase->nHeight > nBaseStakeTrustHeight + 1024)
-        {
-            int nBaseMask = 1023;
-            while ((pindexBase->nHeight & nBaseMask) != 0) {
-                pindexBase = pindexBase->pprev;
-            }
-
-            nBaseStakeTrustHeight = pindexBase->nHeight;
-
-            for (int i = 0; i < 1024; ++i) {
-                pindexBase = pindexBase->pprev;
-            }
-
-            uint32_t nBestBits = 0;
-            for (int i = 0; i < 1024; ++i)
-            {
-                if (pindexBase->nBits < nBestBits || nBestBits == 0) {
-                    nBestBits = pindexBase->nBits;
-                }
-                pindexBase = pindexBase->pprev;
-            }
-
-            nBaseStakeTrust.SetCompact(nBestBits);
-            bnStakeTrust = nBaseStakeTrust;
-            LogPrintf("StakeTrust nBestBits=%s\n", bnStakeTrust.ToString());
-
-        } else {
-            bnStakeTrust = nBaseStakeTrust;
-        }
+        // The window is fixed by the 1024-aligned ancestor of pindexBase, on whatever branch it is.
+        const CBlockIndex* pindexAligned = pindexBase->GetAncestor(pindexBase->nHeight & ~1023);
+        bnStakeTrust.SetCompact(GetBaseStakeBits(pindexAligned));
     }
 }
 
@@ -271,6 +296,16 @@ const CBlockIndex* LastCommonAncestor(const CBlockIndex* pa, const CBlockIndex*
 // [PINK] TODO: Rewrite it as a static member of CBlockIndex class??
 const CBlockIndex* GetLastBlockIndex(const CBlockIndex* pindex, bool fProofOfStake)
 {
+    if (!pindex || !pindex->pprev || pindex->IsProofOfStake() == fProofOfStake)
+        return pindex;
+    if (fProofOfStake) {
+        if (pindex->pprevPoS && pindex->pprevFPoS)
+            return pindex->pprevPoS->nHeight > pindex->pprevFPoS->nHeight ? pindex->pprevPoS : pindex->pprevFPoS;
+    } else if (pindex->pprevPoW) {
+        return pindex->pprevPoW;
+    }
+
+    // Predecessor pointers not built (detached index entries): walk.
     while (pindex && pindex->pprev && (pindex->IsProofOfStake() != fProofOfStake))
         pindex = pindex->pprev;
     return pindex;
@@ -282,19 +317,36 @@ const CBlockIndex* GetLastBlockIndex2(const CBlockIndex* pindex, bool fFlashStak
 {
     const Consensus::Params &chainparams = Params().GetConsensus();
 
+    if (!pindex)
+        return nullptr;
+
     if (pindex->nHeight >= chainparams.V222Height) {
 
+        if (!pindex->pprev || pindex->IsFPOS(fFlashStake))
+            return pindex;
+        const CBlockIndex* pcached = fFlashStake ? pindex->pprevFPoS : pindex->pprevPoS;
+        if (pcached)
+            return pcached;
+
         while (pindex && pindex->pprev && !pindex->IsFPOS(fFlashStake))
             pindex = pindex->pprev;
 
     } else {
 
-        while (pindex && pindex->pprev && chainparams.IsFlashStake(pindex->nTime) != fFlashStake)
+        // Only walks back to the nearest flash window boundary. Blocks in the
+        // same hour slot share their classification, so only re-test on a
+        // slot change.
+        uint32_t nSlot = Consensus::Params::HourSlot(pindex->nTime);
+        bool fSlotFlash = chainparams.IsFlashStakeSlot(nSlot);
+        while (pindex && pindex->pprev && fSlotFlash != fFlashStake)
         {
             pindex = pindex->pprev;
+            if (Consensus::Params::HourSlot(pindex->nTime) != nSlot) {
+                nSlot = Consensus::Params::HourSlot(pindex->nTime);
+                fSlotFlash = chainparams.IsFlashStakeSlot(nSlot);
+            }
         }
-        while (pindex && pindex->pprev && (!pindex->IsProofOfStake()))
-            pindex = pindex->pprev;
+        pindex = GetLastBlockIndex(pindex, true);
     }
     return pindex;
 }
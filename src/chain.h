@@ -195,6 +195,12 @@ public:
     //! pointer to the index of some further predecessor of this block
     CBlockIndex* pskip;
 
+    //! (memory only) nearest predecessor of each block kind (PoW, non-flash PoS, flash PoS),
+    //! or the genesis block if there is none. See BuildPrevAlgo().
+    CBlockIndex* pprevPoW;
+    CBlockIndex* pprevPoS;
+    CBlockIndex* pprevFPoS;
+
     //! height of the entry in the chain. The genesis block has height 0
     int nHeight;
 
@@ -250,6 +256,9 @@ public:
         phashBlock = nullptr;
         pprev = nullptr;
         pskip = nullptr;
+        pprevPoW = nullptr;
+        pprevPoS = nullptr;
+        pprevFPoS = nullptr;
         nHeight = 0;
         nFile = 0;
         nDataPos = 0;
@@ -354,6 +363,7 @@ public:
     }
 
     // [PINK] https://github.com/Pink2Dev/Pink2/blob/2.2.3.0/src/main.h#L1292
+    // Must be set before any successor is linked, see BuildPrevAlgo().
     void SetProofOfStake()
     {
         nStatus |= BLOCK_PROOF_OF_STAKE;
@@ -453,6 +463,9 @@ public:
     //! Build the skiplist pointer for this entry.
     void BuildSkip();
 
+    //! Build the same-kind predecessor pointers for this entry from pprev's.
+    void BuildPrevAlgo();
+
     //! Efficiently find an ancestor of this block.
     CBlockIndex* GetAncestor(int height);
     const CBlockIndex* GetAncestor(int height) const;
@@ -467,6 +480,11 @@ const CBlockIndex* LastCommonAncestor(const CBlockIndex* pa, const CBlockIndex*
 
 // [PINK] https://github.com/Pink2Dev/Pink2/blob/2.2.3.0/src/main.h#L1233
 arith_uint256 GetBlockTrust(const CBlockIndex& block, bool isNew = false);
+/**
+ * Hardest nBits in the stake trust window of a 1024-aligned block: the 1024
+ * blocks ending 1024 blocks before it. Memoized by block hash.
+ */
+uint32_t GetBaseStakeBits(const CBlockIndex* pindexAligned);
 // [PINK] https://github.com/Pink2Dev/Pink2/blob/2.2.3.0/src/main.h#L129
 void GetModTrust(arith_uint256& bnStakeTrust, arith_uint256& bnTarget, CBlockIndex* pindexBase, const uint32_t nBlockTime, bool isPos, bool isNew);
 
@@ -97,6 +97,7 @@ public:
         consensus.nHour2 = 20;  // 12pm UTC-8
         consensus.nHour3 = 1;   // 5pm UTC-8
         consensus.nHour4 = 6;   // 10pm UTC-8
+        consensus.nFlashHourMask = Consensus::Params::FlashHourMask(consensus.nHour1, consensus.nHour2, consensus.nHour3, consensus.nHour4);
 
         // [PINK] https://github.com/Pink2Dev/Pink2/blob/2.2.3.0/src/main.cpp#L39 (40,41)
         consensus.powLimit  = uint256S("00000fffffffffffffffffffffffffffffffffffffffffffffffffffffffffff");
@@ -281,6 +282,7 @@ public:
         consensus.nHour2 = 20;  // 12pm UTC-8
         consensus.nHour3 = 1;   // 5pm UTC-8
         consensus.nHour4 = 6;   // 10pm UTC-8
+        consensus.nFlashHourMask = Consensus::Params::FlashHourMask(consensus.nHour1, consensus.nHour2, consensus.nHour3, consensus.nHour4);
 
         consensus.nPowTargetTimespan = 60 * 60; // 60 minutes
         // [PINK] ?? https://github.com/Pink2Dev/Pink2/blob/master/src/main.cpp#L47
@@ -418,6 +420,7 @@ public:
         consensus.nHour2 = 20;  // 12pm UTC-8
         consensus.nHour3 = 1;   // 5pm UTC-8
         consensus.nHour4 = 6;   // 10pm UTC-8
+        consensus.nFlashHourMask = Consensus::Params::FlashHourMask(consensus.nHour1, consensus.nHour2, consensus.nHour3, consensus.nHour4);
         consensus.powLimit = uint256S("7fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff");
         consensus.posLimit = uint256S("7fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff");
         consensus.fposLimit = uint256S("7fffffffffffffffffffffffffffffffffffffffffffffffffffffffffffffff");
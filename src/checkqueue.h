@@ -8,6 +8,8 @@
 #include <sync.h>
 
 #include <algorithm>
+#include <functional>
+#include <utility>
 #include <vector>
 
 #include <boost/thread/condition_variable.hpp>
@@ -211,4 +213,23 @@ public:
     }
 };
 
+/**
+ * Closure running any task, so that work of different kinds can share one
+ * queue and its threads. Each holds a std::function: meant for tasks as large
+ * as checking a whole block, not for a single script.
+ */
+class CTaskCheck
+{
+private:
+    std::function<bool()> task;
+
+public:
+    CTaskCheck() {}
+    explicit CTaskCheck(std::function<bool()> taskIn) : task(std::move(taskIn)) {}
+
+    bool operator()() { return task(); }
+
+    void swap(CTaskCheck& check) { task.swap(check.task); }
+};
+
 #endif // BITCOIN_CHECKQUEUE_H
@@ -20,9 +20,18 @@ bool CCoinsView::HaveCoin(const COutPoint &outpoint) const
     return GetCoin(outpoint, coin);
 }
 
+bool CCoinsView::HaveAnyCoin(const std::vector<COutPoint> &outpoints) const
+{
+    for (const COutPoint& outpoint : outpoints) {
+        if (HaveCoin(outpoint)) return true;
+    }
+    return false;
+}
+
 CCoinsViewBacked::CCoinsViewBacked(CCoinsView *viewIn) : base(viewIn) { }
 bool CCoinsViewBacked::GetCoin(const COutPoint &outpoint, Coin &coin) const { return base->GetCoin(outpoint, coin); }
 bool CCoinsViewBacked::HaveCoin(const COutPoint &outpoint) const { return base->HaveCoin(outpoint); }
+bool CCoinsViewBacked::HaveAnyCoin(const std::vector<COutPoint> &outpoints) const { return base->HaveAnyCoin(outpoints); }
 uint256 CCoinsViewBacked::GetBestBlock() const { return base->GetBestBlock(); }
 std::vector<uint256> CCoinsViewBacked::GetHeadBlocks() const { return base->GetHeadBlocks(); }
 void CCoinsViewBacked::SetBackend(CCoinsView &viewIn) { base = &viewIn; }
@@ -35,7 +44,7 @@ SaltedOutpointHasher::SaltedOutpointHasher() : k0(GetRand(std::numeric_limits<ui
 CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), cachedCoinsUsage(0) {}
 
 size_t CCoinsViewCache::DynamicMemoryUsage() const {
-    return memusage::DynamicUsage(cacheCoins) + cachedCoinsUsage;
+    return memusage::DynamicUsage(cacheCoins) + memusage::DynamicUsage(dirtyCoins) + cachedCoinsUsage;
 }
 
 CCoinsMap::iterator CCoinsViewCache::FetchCoin(const COutPoint &outpoint) const {
@@ -80,6 +89,7 @@ void CCoinsViewCache::AddCoin(const COutPoint &outpoint, Coin&& coin, bool possi
         }
         fresh = !(it->second.flags & CCoinsCacheEntry::DIRTY);
     }
+    if (!(it->second.flags & CCoinsCacheEntry::DIRTY)) dirtyCoins.push_back(outpoint);
     it->second.coin = std::move(coin);
     it->second.flags |= CCoinsCacheEntry::DIRTY | (fresh ? CCoinsCacheEntry::FRESH : 0);
     cachedCoinsUsage += it->second.coin.DynamicMemoryUsage();
@@ -108,6 +118,7 @@ bool CCoinsViewCache::SpendCoin(const COutPoint &outpoint, Coin* moveout) {
     if (it->second.flags & CCoinsCacheEntry::FRESH) {
         cacheCoins.erase(it);
     } else {
+        if (!(it->second.flags & CCoinsCacheEntry::DIRTY)) dirtyCoins.push_back(outpoint);
         it->second.flags |= CCoinsCacheEntry::DIRTY;
         it->second.coin.Clear();
     }
@@ -130,6 +141,21 @@ bool CCoinsViewCache::HaveCoin(const COutPoint &outpoint) const {
     return (it != cacheCoins.end() && !it->second.coin.IsSpent());
 }
 
+bool CCoinsViewCache::HaveAnyCoin(const std::vector<COutPoint> &outpoints) const {
+    // Resolve what this cache knows (including coins it knows to be spent),
+    // and pass only the rest down as a single batch.
+    std::vector<COutPoint> uncached;
+    for (const COutPoint& outpoint : outpoints) {
+        CCoinsMap::const_iterator it = cacheCoins.find(outpoint);
+        if (it == cacheCoins.end()) {
+            uncached.push_back(outpoint);
+        } else if (!it->second.coin.IsSpent()) {
+            return true;
+        }
+    }
+    return !uncached.empty() && base->HaveAnyCoin(uncached);
+}
+
 bool CCoinsViewCache::HaveCoinInCache(const COutPoint &outpoint) const {
     CCoinsMap::const_iterator it = cacheCoins.find(outpoint);
     return (it != cacheCoins.end() && !it->second.coin.IsSpent());
@@ -162,6 +188,7 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
                 entry.coin = std::move(it->second.coin);
                 cachedCoinsUsage += entry.coin.DynamicMemoryUsage();
                 entry.flags = CCoinsCacheEntry::DIRTY;
+                dirtyCoins.push_back(it->first);
                 // We can mark it FRESH in the parent if it was FRESH in the child
                 // Otherwise it might have just been flushed from the parent's cache
                 // and already exist in the grandparent
@@ -190,6 +217,7 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
                 cachedCoinsUsage -= itUs->second.coin.DynamicMemoryUsage();
                 itUs->second.coin = std::move(it->second.coin);
                 cachedCoinsUsage += itUs->second.coin.DynamicMemoryUsage();
+                if (!(itUs->second.flags & CCoinsCacheEntry::DIRTY)) dirtyCoins.push_back(it->first);
                 itUs->second.flags |= CCoinsCacheEntry::DIRTY;
                 // NOTE: It is possible the child has a FRESH flag here in
                 // the event the entry we found in the parent is pruned. But
@@ -206,10 +234,50 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
 bool CCoinsViewCache::Flush() {
     bool fOk = base->BatchWrite(cacheCoins, hashBlock);
     cacheCoins.clear();
+    dirtyCoins.clear();
     cachedCoinsUsage = 0;
     return fOk;
 }
 
+bool CCoinsViewCache::Sync() {
+    CCoinsMap mapDirty;
+    for (const COutPoint& outpoint : dirtyCoins) {
+        CCoinsMap::iterator it = cacheCoins.find(outpoint);
+        // Erased since it was listed, or listed twice and handled already.
+        if (it == cacheCoins.end() || !(it->second.flags & CCoinsCacheEntry::DIRTY)) continue;
+        if (it->second.coin.IsSpent()) {
+            // Once written, the base knows the coin is spent.
+            cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+            mapDirty.emplace(it->first, std::move(it->second));
+            cacheCoins.erase(it);
+        } else {
+            mapDirty.emplace(it->first, it->second);
+            it->second.flags = 0;
+        }
+    }
+    dirtyCoins.clear();
+    return base->BatchWrite(mapDirty, hashBlock);
+}
+
+void CCoinsViewCache::Trim(size_t nMaxUsage) {
+    for (CCoinsMap::iterator it = cacheCoins.begin(); it != cacheCoins.end() && DynamicMemoryUsage() > nMaxUsage;) {
+        if (it->second.flags == 0) {
+            cachedCoinsUsage -= it->second.coin.DynamicMemoryUsage();
+            it = cacheCoins.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void CCoinsViewCache::GetChanges(std::vector<std::pair<COutPoint, Coin>>& changes) const {
+    for (const auto& entry : cacheCoins) {
+        if (entry.second.flags & CCoinsCacheEntry::DIRTY) {
+            changes.emplace_back(entry.first, entry.second.coin);
+        }
+    }
+}
+
 void CCoinsViewCache::Uncache(const COutPoint& hash)
 {
     CCoinsMap::iterator it = cacheCoins.find(hash);
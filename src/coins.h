@@ -18,6 +18,7 @@
 #include <stdint.h>
 
 #include <unordered_map>
+#include <vector>
 
 /**
  * A UTXO entry.
@@ -33,21 +34,24 @@ public:
     //! unspent transaction output
     CTxOut out;
 
+    //! Metadata, packed into a single 64-bit word so that a Coin is a CTxOut
+    //! plus 8 bytes. 30 bits of height is what the serialization allows.
+
     //! whether containing transaction was a coinbase
-    unsigned int fCoinBase : 1;
+    uint64_t fCoinBase : 1;
 
     //! whether containing transaction was a coinstake
-    unsigned int fCoinStake : 2;
+    uint64_t fCoinStake : 1;
 
     //! at which height this containing transaction was included in the active block chain
-    uint32_t nHeight : 31;
+    uint64_t nHeight : 30;
 
     // transaction timestamp
-    uint32_t nTime;
+    uint64_t nTime : 32;
 
     //! construct a Coin from a CTxOut and height/coinbase/coinstake information.
-    Coin(CTxOut&& outIn, int nHeightIn, bool fCoinBaseIn, bool fCoinStakeIn, uint32_t nTimeIn) : out(std::move(outIn)), fCoinBase(fCoinBaseIn), nHeight(nHeightIn), fCoinStake(fCoinStakeIn ? 2 : 0), nTime(nTimeIn) {}
-    Coin(const CTxOut& outIn, int nHeightIn, bool fCoinBaseIn, bool fCoinStakeIn, uint32_t nTimeIn) : out(outIn), fCoinBase(fCoinBaseIn), nHeight(nHeightIn), fCoinStake(fCoinStakeIn ? 2 : 0), nTime(nTimeIn) {}
+    Coin(CTxOut&& outIn, int nHeightIn, bool fCoinBaseIn, bool fCoinStakeIn, uint32_t nTimeIn) : out(std::move(outIn)), fCoinBase(fCoinBaseIn), fCoinStake(fCoinStakeIn), nHeight(nHeightIn), nTime(nTimeIn) {}
+    Coin(const CTxOut& outIn, int nHeightIn, bool fCoinBaseIn, bool fCoinStakeIn, uint32_t nTimeIn) : out(outIn), fCoinBase(fCoinBaseIn), fCoinStake(fCoinStakeIn), nHeight(nHeightIn), nTime(nTimeIn) {}
 
     void Clear() {
         out.SetNull();
@@ -58,7 +62,7 @@ public:
     }
 
     //! empty constructor
-    Coin() : fCoinBase(false), nHeight(0), fCoinStake(false), nTime(0) { }
+    Coin() : fCoinBase(false), fCoinStake(false), nHeight(0), nTime(0) { }
 
     bool IsCoinBase() const {
         return fCoinBase;
@@ -71,20 +75,24 @@ public:
     template<typename Stream>
     void Serialize(Stream &s) const {
         assert(!IsSpent());
-        uint32_t code = nHeight * 4 + fCoinBase + fCoinStake;
+        uint32_t code = nHeight * 4 + fCoinBase + fCoinStake * 2;
+        uint32_t time = nTime;
         ::Serialize(s, VARINT(code));
-        ::Serialize(s, VARINT(nTime));
+        ::Serialize(s, VARINT(time));
         ::Serialize(s, CTxOutCompressor(REF(out)));
     }
 
     template<typename Stream>
     void Unserialize(Stream &s) {
         uint32_t code = 0;
+        uint32_t time = 0;
         ::Unserialize(s, VARINT(code));
         nHeight = code >> 2;
         fCoinBase = code & 1;
-        fCoinStake = code & 2;
-        ::Unserialize(s, VARINT(nTime));
+        fCoinStake = (code >> 1) & 1;
+        // Bitfields cannot be bound to a reference, so go through a local.
+        ::Unserialize(s, VARINT(time));
+        nTime = time;
         ::Unserialize(s, CTxOutCompressor(out));
     }
 
@@ -97,6 +105,8 @@ public:
     }
 };
 
+static_assert(sizeof(Coin) <= sizeof(CTxOut) + sizeof(uint64_t), "Coin metadata must fit in one 64-bit word");
+
 class SaltedOutpointHasher
 {
 private:
@@ -170,6 +180,10 @@ public:
     //! Just check whether a given outpoint is unspent.
     virtual bool HaveCoin(const COutPoint &outpoint) const;
 
+    //! Check whether any of the given outpoints is unspent. Views override
+    //! this to resolve the whole batch in one pass instead of one lookup each.
+    virtual bool HaveAnyCoin(const std::vector<COutPoint> &outpoints) const;
+
     //! Retrieve the block hash whose state this CCoinsView currently represents
     virtual uint256 GetBestBlock() const;
 
@@ -204,6 +218,7 @@ public:
     CCoinsViewBacked(CCoinsView *viewIn);
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
+    bool HaveAnyCoin(const std::vector<COutPoint> &outpoints) const override;
     uint256 GetBestBlock() const override;
     std::vector<uint256> GetHeadBlocks() const override;
     void SetBackend(CCoinsView &viewIn);
@@ -227,6 +242,14 @@ protected:
     /* Cached dynamic memory usage for the inner Coin objects. */
     mutable size_t cachedCoinsUsage;
 
+    /**
+     * Outpoints whose entries were marked DIRTY since the last Sync() or
+     * Flush(), so Sync() visits those rather than the whole cache. Entries
+     * erased since, or dirtied again after being erased, may leave stale or
+     * repeated outpoints here; Sync() skips those.
+     */
+    std::vector<COutPoint> dirtyCoins;
+
 public:
     CCoinsViewCache(CCoinsView *baseIn);
 
@@ -238,6 +261,7 @@ public:
     // Standard CCoinsView methods
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
+    bool HaveAnyCoin(const std::vector<COutPoint> &outpoints) const override;
     uint256 GetBestBlock() const override;
     void SetBestBlock(const uint256 &hashBlock);
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
@@ -284,6 +308,25 @@ public:
      */
     bool Flush();
 
+    /**
+     * Push the modifications applied to this cache to its base like Flush(),
+     * but keep the cache warm: written entries stay cached as unmodified,
+     * and only spent ones are dropped. Takes time in the number of entries
+     * modified since the last write, not in the size of the cache.
+     * If false is returned, the state of this cache (and its backing view) will be undefined.
+     */
+    bool Sync();
+
+    /**
+     * Drop unmodified entries until the cache uses at most nMaxUsage bytes
+     * (as reported by DynamicMemoryUsage()). Right after Sync() no entry is
+     * modified, so this takes time in the number of entries dropped.
+     */
+    void Trim(size_t nMaxUsage);
+
+    //! Append every modified entry (spent ones included) to changes, as Flush() would write them.
+    void GetChanges(std::vector<std::pair<COutPoint, Coin>>& changes) const;
+
     /**
      * Removes the UTXO with the given outpoint from the cache, if it is
      * not modified.
@@ -0,0 +1,183 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <coinsprefetch.h>
+
+#include <blockfilemap.h>
+#include <chainparams.h>
+#include <clientversion.h>
+#include <primitives/block.h>
+#include <reverse_iterator.h>
+#include <streams.h>
+#include <util/system.h>
+#include <validation.h>
+
+CCoinsViewPrefetch::CCoinsViewPrefetch(CCoinsView* viewIn, int nThreads) :
+    CCoinsViewBacked(viewIn), nGeneration(0), fInterrupt(false), pindexScheduled(nullptr), nHits(0), nMisses(0)
+{
+    for (int i = 0; i < nThreads; ++i) {
+        threads.emplace_back([this] { TraceThread("coinsprefetch", [this] { ThreadPrefetch(); }); });
+    }
+}
+
+CCoinsViewPrefetch::~CCoinsViewPrefetch()
+{
+    {
+        LOCK(cs_queue);
+        fInterrupt = true;
+    }
+    condQueue.notify_all();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+bool CCoinsViewPrefetch::GetCoin(const COutPoint& outpoint, Coin& coin) const
+{
+    {
+        LOCK(cs_staged);
+        auto it = mapStaged.find(outpoint);
+        if (it != mapStaged.end()) {
+            // The caller caches what it gets, so the entry is not needed again.
+            coin = std::move(it->second);
+            mapStaged.erase(it);
+            ++nHits;
+            return true;
+        }
+    }
+    ++nMisses;
+    return base->GetCoin(outpoint, coin);
+}
+
+bool CCoinsViewPrefetch::HaveCoin(const COutPoint& outpoint) const
+{
+    {
+        LOCK(cs_staged);
+        if (mapStaged.count(outpoint)) return true;
+    }
+    return base->HaveCoin(outpoint);
+}
+
+size_t CCoinsViewPrefetch::GetStagedCount() const
+{
+    LOCK(cs_staged);
+    return mapStaged.size();
+}
+
+void CCoinsViewPrefetch::DropStaged(const CCoinsMap& mapCoins)
+{
+    LOCK(cs_staged);
+    ++nGeneration;
+    if (mapStaged.empty()) return;
+    for (const auto& entry : mapCoins) {
+        if (entry.second.flags & CCoinsCacheEntry::DIRTY) {
+            mapStaged.erase(entry.first);
+        }
+    }
+}
+
+bool CCoinsViewPrefetch::BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock)
+{
+    // Drop the affected entries both before and after the write: a read
+    // that raced with it may have staged a stale copy in between, and any
+    // read still in flight sees nGeneration change and discards its result.
+    DropStaged(mapCoins);
+    bool ret = base->BatchWrite(mapCoins, hashBlock);
+    DropStaged(mapCoins);
+    return ret;
+}
+
+void CCoinsViewPrefetch::Schedule(const std::vector<CBlockIndex*>& vpindex)
+{
+    AssertLockHeld(cs_main);
+    if (threads.empty() || vpindex.empty()) return;
+
+    // Skip the blocks already queued if this extends the last schedule.
+    CBlockIndex* pindexLast = vpindex.front();
+    int nHeightFrom = 0;
+    if (pindexScheduled && pindexLast->GetAncestor(pindexScheduled->nHeight) == pindexScheduled) {
+        nHeightFrom = pindexScheduled->nHeight + 1;
+    }
+
+    {
+        LOCK(cs_queue);
+        for (CBlockIndex* pindex : reverse_iterate(vpindex)) {
+            if (pindex->nHeight < nHeightFrom) continue;
+            assert(pindex->nStatus & BLOCK_HAVE_DATA);
+            queue.push_back(pindex->GetBlockPos());
+        }
+    }
+    if (pindexLast->nHeight >= nHeightFrom) {
+        pindexScheduled = pindexLast;
+    }
+    condQueue.notify_all();
+}
+
+void CCoinsViewPrefetch::Prefetch(const std::vector<COutPoint>& outpoints)
+{
+    uint64_t nGenerationStart;
+    {
+        LOCK(cs_staged);
+        if (mapStaged.size() >= MAX_PREFETCH_STAGED) {
+            // Drop everything, including coins just staged for the next
+            // blocks. Coins are only ever taken out by a lookup that missed
+            // in pcoinsTip, so those it still caches, or those spent by a
+            // block that turned out invalid, would otherwise pin the staging
+            // area full, and pausing until it drains would stop prefetching
+            // for good.
+            mapStaged.clear();
+        }
+        nGenerationStart = nGeneration;
+    }
+
+    std::vector<std::pair<COutPoint, Coin>> vFound;
+    vFound.reserve(outpoints.size());
+    for (const COutPoint& outpoint : outpoints) {
+        Coin coin;
+        if (base->GetCoin(outpoint, coin)) {
+            vFound.emplace_back(outpoint, std::move(coin));
+        }
+    }
+
+    LOCK(cs_staged);
+    if (nGeneration != nGenerationStart) return;
+    for (auto& found : vFound) {
+        mapStaged.emplace(found.first, std::move(found.second));
+    }
+}
+
+void CCoinsViewPrefetch::ThreadPrefetch()
+{
+    const CChainParams& chainparams = Params();
+    while (true) {
+        CDiskBlockPos pos;
+        {
+            WAIT_LOCK(cs_queue, lock);
+            condQueue.wait(lock, [this]() EXCLUSIVE_LOCKS_REQUIRED(cs_queue) { return fInterrupt || !queue.empty(); });
+            if (fInterrupt) return;
+            pos = queue.front();
+            queue.pop_front();
+        }
+
+        // Read the raw block: this only needs its inputs, so there is no
+        // point in checking the header as ReadBlockFromDisk does.
+        CRawBlock raw;
+        if (!ReadRawBlockFromDisk(raw, pos, chainparams.MessageStart())) continue;
+        CBlock block;
+        try {
+            SpanReader(SER_DISK, CLIENT_VERSION, raw.data, 0) >> block;
+        } catch (const std::exception&) {
+            continue;
+        }
+
+        std::vector<COutPoint> outpoints;
+        for (const auto& tx : block.vtx) {
+            if (tx->IsCoinBase()) continue;
+            for (const CTxIn& txin : tx->vin) {
+                outpoints.push_back(txin.prevout);
+            }
+        }
+        Prefetch(outpoints);
+    }
+}
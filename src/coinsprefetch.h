@@ -0,0 +1,87 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSPREFETCH_H
+#define BITCOIN_COINSPREFETCH_H
+
+#include <chain.h>
+#include <coins.h>
+#include <sync.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+//! Number of threads reading inputs of upcoming blocks
+static const int COINS_PREFETCH_THREADS = 2;
+//! Staged coins at which the next prefetch drops the whole staging area first
+static const size_t MAX_PREFETCH_STAGED = 1 << 18;
+
+/**
+ * CCoinsView layer that serves coins read ahead of time by background
+ * threads. It sits between pcoinsTip and the database: once the blocks about
+ * to be connected are known (and on disk), Schedule() hands their positions
+ * to the worker threads, which read each block and look up its inputs in the
+ * base view, staging the coins found. When block connection then misses in
+ * pcoinsTip, the coin is taken from the staging area instead of waiting on a
+ * database read.
+ *
+ * Staged coins are copies of what the base view held when they were read, so
+ * every BatchWrite drops the entries it touches, and a read that overlapped a
+ * write is discarded rather than staged (see nGeneration).
+ */
+class CCoinsViewPrefetch final : public CCoinsViewBacked
+{
+private:
+    mutable Mutex cs_staged;
+    mutable std::unordered_map<COutPoint, Coin, SaltedOutpointHasher> mapStaged GUARDED_BY(cs_staged);
+    //! Bumped before and after every write to the base view
+    uint64_t nGeneration GUARDED_BY(cs_staged);
+
+    Mutex cs_queue;
+    std::condition_variable condQueue;
+    std::deque<CDiskBlockPos> queue GUARDED_BY(cs_queue);
+    bool fInterrupt GUARDED_BY(cs_queue);
+    std::vector<std::thread> threads;
+
+    //! Last block handed to Schedule(), to skip blocks already queued
+    const CBlockIndex* pindexScheduled;
+
+    mutable std::atomic<uint64_t> nHits;
+    mutable std::atomic<uint64_t> nMisses;
+
+    void ThreadPrefetch();
+    void DropStaged(const CCoinsMap& mapCoins);
+
+public:
+    CCoinsViewPrefetch(CCoinsView* viewIn, int nThreads);
+    ~CCoinsViewPrefetch();
+
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const override;
+    bool HaveCoin(const COutPoint& outpoint) const override;
+    bool BatchWrite(CCoinsMap& mapCoins, const uint256& hashBlock) override;
+
+    /**
+     * Queue the blocks in vpindex, which must have their data on disk and be
+     * ordered highest first (as ActivateBestChainStep collects them), for
+     * prefetching. Blocks already queued by a previous call on the same chain
+     * are skipped. Requires cs_main.
+     */
+    void Schedule(const std::vector<CBlockIndex*>& vpindex);
+
+    //! Look up outpoints in the base view and stage those found.
+    void Prefetch(const std::vector<COutPoint>& outpoints);
+
+    //! Lookups served from the staging area, and those that fell through.
+    uint64_t GetHits() const { return nHits; }
+    uint64_t GetMisses() const { return nMisses; }
+
+    //! Coins staged and not yet taken.
+    size_t GetStagedCount() const;
+};
+
+#endif // BITCOIN_COINSPREFETCH_H
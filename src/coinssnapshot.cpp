@@ -0,0 +1,124 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <coinssnapshot.h>
+
+#include <util/system.h>
+
+CCoinsSnapshot::CCoinsSnapshot(const CCoinsViewDB& dbIn, std::shared_ptr<const leveldb::Snapshot> dbSnapshotIn, std::vector<std::shared_ptr<const Layer>> layersIn, const uint256& hashBlockIn, int nHeightIn) :
+    db(dbIn), dbSnapshot(std::move(dbSnapshotIn)), layers(std::move(layersIn)), hashBlock(hashBlockIn), nHeight(nHeightIn)
+{
+}
+
+bool CCoinsSnapshot::GetCoin(const COutPoint& outpoint, Coin& coin) const
+{
+    for (auto layer = layers.rbegin(); layer != layers.rend(); ++layer) {
+        auto it = (*layer)->find(outpoint);
+        if (it != (*layer)->end()) {
+            if (it->second.IsSpent()) return false;
+            coin = it->second;
+            return true;
+        }
+    }
+    return db.GetCoinAt(outpoint, coin, dbSnapshot.get());
+}
+
+CCoinsSnapshotManager::CCoinsSnapshotManager() : db(nullptr), nRequiredWrite(0), nHeight(-1)
+{
+}
+
+void CCoinsSnapshotManager::Update()
+{
+    current.reset();
+    if (!db) return;
+
+    const uint64_t nCommitted = db->GetWritesCommitted();
+    if (nCommitted >= nRequiredWrite) {
+        auto it = groups.begin();
+        while (it != groups.end() && it->nWrite <= nCommitted) ++it;
+        if (!dbSnapshot || it != groups.begin()) {
+            // Taken after reading nCommitted, so it has at least those writes.
+            dbSnapshot = db->GetSnapshot();
+            groups.erase(groups.begin(), it);
+        }
+    }
+    if (!dbSnapshot) return;
+
+    std::vector<std::shared_ptr<const CCoinsSnapshot::Layer>> layers;
+    for (const Group& group : groups) {
+        layers.insert(layers.end(), group.layers.begin(), group.layers.end());
+    }
+    current = std::make_shared<CCoinsSnapshot>(*db, dbSnapshot, std::move(layers), hashBlock, nHeight);
+}
+
+void CCoinsSnapshotManager::Reset(const CCoinsViewDB& dbIn, const uint256& hashBlockIn, int nHeightIn)
+{
+    LOCK(cs);
+    db = &dbIn;
+    dbSnapshot.reset();
+    nRequiredWrite = dbIn.GetWritesStarted();
+    groups.clear();
+    hashBlock = hashBlockIn;
+    nHeight = nHeightIn;
+    Update();
+}
+
+void CCoinsSnapshotManager::Clear()
+{
+    LOCK(cs);
+    db = nullptr;
+    dbSnapshot.reset();
+    groups.clear();
+    current.reset();
+}
+
+void CCoinsSnapshotManager::Publish(const CCoinsViewCache& view, const uint256& hashBlockIn, int nHeightIn)
+{
+    LOCK(cs);
+    if (!db) return;
+
+    std::vector<std::pair<COutPoint, Coin>> changes;
+    view.GetChanges(changes);
+
+    // No write can start until we return, so these changes go out with the next one.
+    const uint64_t nWrite = db->GetWritesStarted() + 1;
+    if (groups.empty() || groups.back().nWrite != nWrite) {
+        groups.push_back(Group{nWrite, {}});
+    }
+    auto& layers = groups.back().layers;
+    layers.push_back(std::make_shared<const CCoinsSnapshot::Layer>(std::make_move_iterator(changes.begin()), std::make_move_iterator(changes.end())));
+    while (layers.size() > 1 && layers[layers.size() - 2]->size() <= layers.back()->size()) {
+        // Layers held by earlier snapshots must not change, so merge into a copy.
+        auto merged = std::make_shared<CCoinsSnapshot::Layer>(*layers[layers.size() - 2]);
+        for (const auto& entry : *layers.back()) {
+            (*merged)[entry.first] = entry.second;
+        }
+        layers.pop_back();
+        layers.back() = std::move(merged);
+    }
+
+    hashBlock = hashBlockIn;
+    nHeight = nHeightIn;
+
+    size_t nChanges = 0;
+    for (const Group& group : groups) {
+        for (const auto& layer : group.layers) {
+            nChanges += layer->size();
+        }
+    }
+    if (nChanges > MAX_COINS_SNAPSHOT_CHANGES) {
+        LogPrint(BCLog::COINDB, "%s: %u coin changes not yet written, no UTXO snapshot until the next write\n", __func__, nChanges);
+        groups.clear();
+        dbSnapshot.reset();
+        nRequiredWrite = nWrite;
+    }
+    Update();
+}
+
+std::shared_ptr<CCoinsSnapshot> CCoinsSnapshotManager::Get()
+{
+    LOCK(cs);
+    if (!current) Update();
+    return current;
+}
@@ -0,0 +1,108 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSSNAPSHOT_H
+#define BITCOIN_COINSSNAPSHOT_H
+
+#include <coins.h>
+#include <sync.h>
+#include <txdb.h>
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+//! Changes not yet in the database above which no snapshot is published until they are
+static const size_t MAX_COINS_SNAPSHOT_CHANGES = 1000000;
+
+/**
+ * A read-only, immutable view of the UTXO set as of one block: a snapshot of
+ * the coins database with the changes made since (which may still be in the
+ * coins cache or being written) layered on top. Lookups take no locks, so
+ * RPC and REST threads can use one without holding cs_main.
+ */
+class CCoinsSnapshot final : public CCoinsView
+{
+public:
+    //! Coins added or spent (IsSpent()) by a range of blocks
+    typedef std::unordered_map<COutPoint, Coin, SaltedOutpointHasher> Layer;
+
+private:
+    const CCoinsViewDB& db;
+    const std::shared_ptr<const leveldb::Snapshot> dbSnapshot;
+    //! Oldest first; each overrides the database and the layers before it
+    const std::vector<std::shared_ptr<const Layer>> layers;
+    const uint256 hashBlock;
+    const int nHeight;
+
+public:
+    CCoinsSnapshot(const CCoinsViewDB& dbIn, std::shared_ptr<const leveldb::Snapshot> dbSnapshotIn, std::vector<std::shared_ptr<const Layer>> layersIn, const uint256& hashBlockIn, int nHeightIn);
+
+    bool GetCoin(const COutPoint& outpoint, Coin& coin) const override;
+    uint256 GetBestBlock() const override { return hashBlock; }
+    //! Height of the block this is the UTXO set as of, -1 before genesis
+    int GetHeight() const { return nHeight; }
+};
+
+/**
+ * Keeps a CCoinsSnapshot of the chain tip up to date.
+ *
+ * Block connection and disconnection Publish() the changes they make to the
+ * coins cache. These are kept in memory, grouped by the database write that
+ * will carry them (the cache is flushed in whole, so every change published
+ * before a BatchWrite is part of it), until that write is committed; the next
+ * Publish() after it then drops them and takes a new database snapshot. Within
+ * a group, consecutive changes are merged like a binary counter, keeping the
+ * number of layers a lookup checks logarithmic.
+ *
+ * When the coins cache is flushed rarely the changes can outgrow
+ * MAX_COINS_SNAPSHOT_CHANGES, in which case they are dropped and Get() returns
+ * nothing until the database has caught up again.
+ */
+class CCoinsSnapshotManager
+{
+private:
+    struct Group {
+        //! Value of CCoinsViewDB::GetWritesCommitted() once these changes are in the database
+        uint64_t nWrite;
+        std::vector<std::shared_ptr<const CCoinsSnapshot::Layer>> layers;
+    };
+
+    mutable Mutex cs;
+    const CCoinsViewDB* db GUARDED_BY(cs);
+    std::shared_ptr<const leveldb::Snapshot> dbSnapshot GUARDED_BY(cs);
+    //! Writes the database must have committed before dbSnapshot can be used with groups
+    uint64_t nRequiredWrite GUARDED_BY(cs);
+    std::vector<Group> groups GUARDED_BY(cs);
+    uint256 hashBlock GUARDED_BY(cs);
+    int nHeight GUARDED_BY(cs);
+    std::shared_ptr<CCoinsSnapshot> current GUARDED_BY(cs);
+
+    //! Drop the groups the database has caught up with, and rebuild current.
+    void Update() EXCLUSIVE_LOCKS_REQUIRED(cs);
+
+public:
+    CCoinsSnapshotManager();
+
+    /**
+     * Start serving snapshots of dbIn, as of block hashBlockIn at nHeightIn.
+     * Every change to the UTXO set up to that block must have been handed to
+     * dbIn (though not necessarily committed yet). Requires cs_main.
+     */
+    void Reset(const CCoinsViewDB& dbIn, const uint256& hashBlockIn, int nHeightIn);
+    //! Stop serving snapshots, before the database goes away.
+    void Clear();
+
+    /**
+     * Make the changes in view (not yet flushed to its base, the coins cache)
+     * part of the snapshot, which is then as of hashBlockIn at nHeightIn.
+     * Requires cs_main, which BatchWrite calls on the database also hold.
+     */
+    void Publish(const CCoinsViewCache& view, const uint256& hashBlockIn, int nHeightIn);
+
+    //! The latest snapshot, or nullptr if there is none.
+    std::shared_ptr<CCoinsSnapshot> Get();
+};
+
+#endif // BITCOIN_COINSSNAPSHOT_H
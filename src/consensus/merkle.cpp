@@ -7,6 +7,9 @@
 #include <hash.h>
 #include <util/strencodings.h>
 
+#include <assert.h>
+#include <string.h>
+
 /*     WARNING! If you're reading this because you're learning about crypto
        and/or designing a new system that will use merkle trees, keep in mind
        that the following merkle tree algorithm has a serious flaw related to
@@ -63,6 +66,21 @@ uint256 ComputeMerkleRoot(std::vector<uint256> hashes, bool* mutated) {
     return hashes[0];
 }
 
+uint256 ComputeMerkleSubtreeRoot(std::vector<uint256> hashes, unsigned int height, bool* mutated) {
+    assert(!hashes.empty() && hashes.size() <= (size_t{1} << height));
+    unsigned int depth = 0;
+    while ((size_t{1} << depth) < hashes.size()) ++depth;
+    uint256 root = ComputeMerkleRoot(std::move(hashes), mutated);
+    // The last leaf is alone at the levels above a partial subtree's own.
+    unsigned char pair[64];
+    for (; depth < height; ++depth) {
+        memcpy(pair, root.begin(), 32);
+        memcpy(pair + 32, root.begin(), 32);
+        SHA256D64(root.begin(), pair, 1);
+    }
+    return root;
+}
+
 
 uint256 BlockMerkleRoot(const CBlock& block, bool* mutated)
 {
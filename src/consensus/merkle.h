@@ -14,6 +14,17 @@
 
 uint256 ComputeMerkleRoot(std::vector<uint256> hashes, bool* mutated = nullptr);
 
+/*
+ * Compute the root of a subtree of a larger Merkle tree, covering 2^height
+ * leaf positions, given its leaves: all 2^height of them, or fewer if it is the
+ * last subtree (whose last leaf is then duplicated upwards, as in the whole
+ * tree). For a tree of more than 2^height leaves, computing the roots of its
+ * consecutive subtrees separately and then ComputeMerkleRoot over them gives
+ * the root of the whole tree, and a mutation of the whole tree is found in one
+ * of these steps.
+ */
+uint256 ComputeMerkleSubtreeRoot(std::vector<uint256> hashes, unsigned int height, bool* mutated = nullptr);
+
 /*
  * Compute the Merkle root of the transactions in a block.
  * *mutated is set to true if a duplicated subtree was found.
@@ -105,22 +105,28 @@ struct Params {
     uint32_t nHour3;
     uint32_t nHour4;
 
-    // [PINK] https://github.com/Pink2Dev/Pink2/blob/2.2.3.0/src/main.cpp#L1303
-    bool IsFlashStake(uint32_t nTime) const
+    //! Bit h set for each flash stake hour h (UTC); see FlashHourMask().
+    uint32_t nFlashHourMask;
+
+    static constexpr uint32_t FlashHourMask(uint32_t nHourA, uint32_t nHourB, uint32_t nHourC, uint32_t nHourD)
     {
-        time_t rawtime;
-        struct tm *ptm;
+        return (1U << nHourA) | (1U << nHourB) | (1U << nHourC) | (1U << nHourD);
+    }
 
-        bool bIsFlash = false;
+    //! Hours since the epoch. All timestamps with the same slot share their
+    //! flash stake classification, so spans of blocks can be classified once.
+    static constexpr uint32_t HourSlot(uint32_t nTime) { return nTime / 3600; }
 
-        rawtime = nTime;
-        ptm = gmtime(&rawtime);
-        int nHour = ptm->tm_hour;
-        if (nHour == nHour1 || nHour == nHour2 || nHour == nHour3 || nHour == nHour4) {
-            bIsFlash = true;
-        }
+    bool IsFlashStakeSlot(uint32_t nSlot) const
+    {
+        // UNIX time has no leap seconds, so the UTC hour is the slot modulo 24.
+        return (nFlashHourMask >> (nSlot % 24)) & 1;
+    }
 
-        return bIsFlash;
+    // [PINK] https://github.com/Pink2Dev/Pink2/blob/2.2.3.0/src/main.cpp#L1303
+    bool IsFlashStake(uint32_t nTime) const
+    {
+        return IsFlashStakeSlot(HourSlot(nTime));
     }
 
     // [PINK] https://github.com/Pink2Dev/Pink2/blob/2.2.3.0/src/main.h#L47
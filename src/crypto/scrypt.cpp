@@ -27,11 +27,17 @@
  * online backup system.
  */
 
+#if defined(HAVE_CONFIG_H)
+#include <config/bitcoin-config.h>
+#endif
+
 #include "crypto/scrypt.h"
 //#include "util.h"
+#include <assert.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <memory>
 #include <openssl/sha.h>
 
 #if defined(USE_SSE2) && !defined(USE_SSE2_ALWAYS)
@@ -43,6 +49,20 @@
 #include <cpuid.h>
 #endif
 #endif
+
+#if defined(USE_ASM) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__))
+#include <cpuid.h>
+#endif
+
+namespace scrypt_avx2
+{
+void ROMix_8way(uint32_t* X_inout, char* scratchpad);
+}
+
+namespace scrypt_avx512
+{
+void ROMix_16way(uint32_t* X_inout, char* scratchpad);
+}
 #ifndef __FreeBSD__
 static inline uint32_t be32dec(const void *pp)
 {
@@ -330,3 +350,155 @@ void scrypt_1024_1_1_256(const char *input, char *output)
 	char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
     scrypt_1024_1_1_256_sp(input, output, scratchpad);
 }
+
+namespace {
+
+/** A multi-lane ROMix kernel: runs scrypt's memory-hard core on `lanes` interleaved inputs. */
+struct ScryptKernel {
+    size_t lanes;
+    void (*romix)(uint32_t* X_inout, char* scratchpad);
+};
+
+/** Detected kernels, widest first. Empty until ScryptAutoDetect() runs. */
+ScryptKernel scrypt_kernels[2];
+size_t scrypt_num_kernels = 0;
+
+void ScryptMultiKernel(const ScryptKernel& kernel, const char* const* inputs, char* const* outputs, size_t n)
+{
+    const size_t lanes = kernel.lanes;
+    uint32_t X[32 * SCRYPT_MAX_LANES];
+    uint8_t B[128];
+    std::unique_ptr<char[]> scratchpad(new char[lanes * 131072 + 63]);
+
+    // Short batches are padded by repeating the last input; its duplicate
+    // results are simply dropped.
+    for (size_t l = 0; l < lanes; ++l) {
+        const uint8_t* input = (const uint8_t*)inputs[l < n ? l : n - 1];
+        PBKDF2_SHA256(input, 80, input, 80, 1, B, 128);
+        for (int k = 0; k < 32; ++k) {
+            X[k * lanes + l] = le32dec(&B[4 * k]);
+        }
+    }
+
+    kernel.romix(X, scratchpad.get());
+
+    for (size_t l = 0; l < n; ++l) {
+        for (int k = 0; k < 32; ++k) {
+            le32enc(&B[4 * k], X[k * lanes + l]);
+        }
+        PBKDF2_SHA256((const uint8_t*)inputs[l], 80, B, 128, 1, (uint8_t*)outputs[l], 32);
+    }
+}
+
+bool ScryptSelfTest()
+{
+    // Enough inputs to exercise a full batch, a padded batch and the
+    // single-lane tail of every kernel.
+    static const size_t COUNT = SCRYPT_MAX_LANES + SCRYPT_MAX_LANES / 2 + 3;
+    char in[COUNT][80];
+    char out[COUNT][32];
+    const char* inputs[COUNT];
+    char* outputs[COUNT];
+    for (size_t i = 0; i < COUNT; ++i) {
+        for (size_t j = 0; j < 80; ++j) {
+            in[i][j] = (char)(i * 80 + j);
+        }
+        inputs[i] = in[i];
+        outputs[i] = out[i];
+    }
+    scrypt_1024_1_1_256_multi(inputs, outputs, COUNT);
+    for (size_t i = 0; i < COUNT; ++i) {
+        char expected[32];
+        scrypt_1024_1_1_256(in[i], expected);
+        if (memcmp(expected, out[i], 32) != 0) return false;
+    }
+    return true;
+}
+
+#if defined(USE_ASM) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__)) && \
+    (defined(ENABLE_AVX2) || defined(ENABLE_AVX512)) && !defined(BUILD_BITCOIN_INTERNAL)
+void inline ScryptCpuid(uint32_t leaf, uint32_t subleaf, uint32_t& a, uint32_t& b, uint32_t& c, uint32_t& d)
+{
+    __cpuid_count(leaf, subleaf, a, b, c, d);
+}
+
+/** Read the OS-enabled register state mask (XCR0). */
+uint32_t ScryptXCR0()
+{
+    uint32_t a, d;
+    __asm__("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+    return a;
+}
+#endif
+
+} // namespace
+
+void scrypt_1024_1_1_256_multi(const char* const* inputs, char* const* outputs, size_t n)
+{
+    while (n > 0) {
+        // Use the widest kernel that would be at least half full.
+        const ScryptKernel* kernel = nullptr;
+        for (size_t i = 0; i < scrypt_num_kernels; ++i) {
+            if (n * 2 >= scrypt_kernels[i].lanes) {
+                kernel = &scrypt_kernels[i];
+                break;
+            }
+        }
+        if (kernel == nullptr) {
+            char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
+            for (size_t i = 0; i < n; ++i) {
+                scrypt_1024_1_1_256_sp(inputs[i], outputs[i], scratchpad);
+            }
+            return;
+        }
+        const size_t batch = n < kernel->lanes ? n : kernel->lanes;
+        ScryptMultiKernel(*kernel, inputs, outputs, batch);
+        inputs += batch;
+        outputs += batch;
+        n -= batch;
+    }
+}
+
+size_t ScryptLanes()
+{
+    return scrypt_num_kernels > 0 ? scrypt_kernels[0].lanes : 1;
+}
+
+std::string ScryptAutoDetect()
+{
+    std::string ret = "standard";
+    scrypt_num_kernels = 0;
+#if defined(USE_ASM) && (defined(__x86_64__) || defined(__amd64__) || defined(__i386__)) && \
+    (defined(ENABLE_AVX2) || defined(ENABLE_AVX512)) && !defined(BUILD_BITCOIN_INTERNAL)
+    uint32_t eax, ebx, ecx, edx;
+    ScryptCpuid(1, 0, eax, ebx, ecx, edx);
+    // Without OSXSAVE and AVX there is no XCR0 to read, and no vector state enabled.
+    const uint32_t xcr0 = ((ecx >> 27) & 1) && ((ecx >> 28) & 1) ? ScryptXCR0() : 0;
+    uint32_t features7 = 0;
+    ScryptCpuid(0, 0, eax, ebx, ecx, edx);
+    if (eax >= 7) {
+        ScryptCpuid(7, 0, eax, ebx, ecx, edx);
+        features7 = ebx;
+    }
+
+    ret.clear();
+#if defined(ENABLE_AVX512)
+    if (((features7 >> 16) & 1) && (xcr0 & 0xE6) == 0xE6) {
+        scrypt_kernels[scrypt_num_kernels++] = {16, scrypt_avx512::ROMix_16way};
+        ret = "avx512(16way)";
+    }
+#endif
+#if defined(ENABLE_AVX2)
+    if (((features7 >> 5) & 1) && (xcr0 & 0x06) == 0x06) {
+        scrypt_kernels[scrypt_num_kernels++] = {8, scrypt_avx2::ROMix_8way};
+        ret += ret.empty() ? "avx2(8way)" : ",avx2(8way)";
+    }
+#endif
+    if (ret.empty()) ret = "standard";
+#endif
+
+    // Detection is deterministic, so one self-test per process suffices.
+    static const bool self_test_ok = ScryptSelfTest();
+    assert(self_test_ok);
+    return ret;
+}
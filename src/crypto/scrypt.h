@@ -2,12 +2,27 @@
 #define SCRYPT_H
 #include <stdlib.h>
 #include <stdint.h>
+#include <string>
 
 static const int SCRYPT_SCRATCHPAD_SIZE = 131072 + 63;
 
 void scrypt_1024_1_1_256(const char *input, char *output);
 void scrypt_1024_1_1_256_sp_generic(const char *input, char *output, char *scratchpad);
 
+/** Upper bound on the number of inputs hashed in parallel by one multi-lane kernel. */
+static const size_t SCRYPT_MAX_LANES = 16;
+
+/**
+ * Hash n 80-byte inputs, writing 32 bytes to each outputs[i]. Uses the widest
+ * multi-lane kernel selected by ScryptAutoDetect() and falls back to the
+ * single-lane implementation for short tails. Results are identical to
+ * calling scrypt_1024_1_1_256 on each input.
+ */
+void scrypt_1024_1_1_256_multi(const char* const* inputs, char* const* outputs, size_t n);
+
+/** Number of inputs the widest available multi-lane kernel hashes at once (1 if none). */
+size_t ScryptLanes();
+
 #if defined(USE_SSE2)
 #include <string>
 #if defined(_M_X64) || defined(__x86_64__) || defined(_M_AMD64) || (defined(MAC_OSX) && defined(__i386__))
@@ -24,6 +39,9 @@ extern void (*scrypt_1024_1_1_256_sp_detected)(const char *input, char *output,
 #define scrypt_1024_1_1_256_sp(input, output, scratchpad) scrypt_1024_1_1_256_sp_generic((input), (output), (scratchpad))
 #endif
 
+/** Autodetect the best available multi-lane scrypt implementation. Returns the name of the implementation. */
+std::string ScryptAutoDetect();
+
 void
 PBKDF2_SHA256(const uint8_t *passwd, size_t passwdlen, const uint8_t *salt,
     size_t saltlen, uint64_t c, uint8_t *buf, size_t dkLen);
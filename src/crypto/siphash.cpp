@@ -171,3 +171,55 @@ uint64_t SipHashUint256Extra(uint64_t k0, uint64_t k1, const uint256& val, uint3
     SIPROUND;
     return v0 ^ v1 ^ v2 ^ v3;
 }
+
+#define SIPROUND_LANES do { \
+    for (size_t l = 0; l < SIPHASH_UINT256_LANES; l++) { \
+        v0[l] += v1[l]; v1[l] = ROTL(v1[l], 13); v1[l] ^= v0[l]; \
+        v0[l] = ROTL(v0[l], 32); \
+        v2[l] += v3[l]; v3[l] = ROTL(v3[l], 16); v3[l] ^= v2[l]; \
+        v0[l] += v3[l]; v3[l] = ROTL(v3[l], 21); v3[l] ^= v0[l]; \
+        v2[l] += v1[l]; v1[l] = ROTL(v1[l], 17); v1[l] ^= v2[l]; \
+        v2[l] = ROTL(v2[l], 32); \
+    } \
+} while (0)
+
+void SipHashUint256Multi(uint64_t k0, uint64_t k1, const uint256* const* vals, uint64_t* out, size_t n)
+{
+    size_t i = 0;
+    for (; i + SIPHASH_UINT256_LANES <= n; i += SIPHASH_UINT256_LANES) {
+        uint64_t v0[SIPHASH_UINT256_LANES], v1[SIPHASH_UINT256_LANES], v2[SIPHASH_UINT256_LANES], v3[SIPHASH_UINT256_LANES];
+        uint64_t d[4][SIPHASH_UINT256_LANES];
+        for (size_t l = 0; l < SIPHASH_UINT256_LANES; l++) {
+            for (int j = 0; j < 4; j++) {
+                d[j][l] = vals[i + l]->GetUint64(j);
+            }
+            v0[l] = 0x736f6d6570736575ULL ^ k0;
+            v1[l] = 0x646f72616e646f6dULL ^ k1;
+            v2[l] = 0x6c7967656e657261ULL ^ k0;
+            v3[l] = 0x7465646279746573ULL ^ k1;
+        }
+        for (int j = 0; j < 4; j++) {
+            for (size_t l = 0; l < SIPHASH_UINT256_LANES; l++) v3[l] ^= d[j][l];
+            SIPROUND_LANES;
+            SIPROUND_LANES;
+            for (size_t l = 0; l < SIPHASH_UINT256_LANES; l++) v0[l] ^= d[j][l];
+        }
+        for (size_t l = 0; l < SIPHASH_UINT256_LANES; l++) v3[l] ^= ((uint64_t)4) << 59;
+        SIPROUND_LANES;
+        SIPROUND_LANES;
+        for (size_t l = 0; l < SIPHASH_UINT256_LANES; l++) {
+            v0[l] ^= ((uint64_t)4) << 59;
+            v2[l] ^= 0xFF;
+        }
+        SIPROUND_LANES;
+        SIPROUND_LANES;
+        SIPROUND_LANES;
+        SIPROUND_LANES;
+        for (size_t l = 0; l < SIPHASH_UINT256_LANES; l++) {
+            out[i + l] = v0[l] ^ v1[l] ^ v2[l] ^ v3[l];
+        }
+    }
+    for (; i < n; i++) {
+        out[i] = SipHashUint256(k0, k1, *vals[i]);
+    }
+}
@@ -44,4 +44,15 @@ public:
 uint64_t SipHashUint256(uint64_t k0, uint64_t k1, const uint256& val);
 uint64_t SipHashUint256Extra(uint64_t k0, uint64_t k1, const uint256& val, uint32_t extra);
 
+/** Number of values SipHashUint256Multi hashes side by side */
+static const size_t SIPHASH_UINT256_LANES = 4;
+
+/** SipHashUint256 of n values at once: out[i] = SipHashUint256(k0, k1, *vals[i]).
+ *
+ *  Groups of SIPHASH_UINT256_LANES values go through the rounds together, with
+ *  every step a loop over the lanes that the compiler can turn into vector
+ *  instructions.
+ */
+void SipHashUint256Multi(uint64_t k0, uint64_t k1, const uint256* const* vals, uint64_t* out, size_t n);
+
 #endif // BITCOIN_CRYPTO_SIPHASH_H
@@ -6,6 +6,7 @@
 
 #include <memory>
 #include <random.h>
+#include <sync.h>
 
 #include <leveldb/cache.h>
 #include <leveldb/env.h>
@@ -13,6 +14,13 @@
 #include <memenv.h>
 #include <stdint.h>
 #include <algorithm>
+#include <set>
+
+namespace {
+    Mutex g_dbwrappers_mutex;
+    //! Every open CDBWrapper, for ForEachDBWrapper()
+    std::set<const CDBWrapper*> g_dbwrappers GUARDED_BY(g_dbwrappers_mutex);
+}
 
 class CBitcoinLevelDBLogger : public leveldb::Logger {
 public:
@@ -97,12 +105,97 @@ static void SetMaxOpenFiles(leveldb::Options *options) {
              options->max_open_files, default_open_files);
 }
 
-static leveldb::Options GetOptions(size_t nCacheSize)
+/**
+ * The chainstate is looked up by random key for every block and written in
+ * large flushes. The block index is read once at startup, by an iterator
+ * that bypasses the block cache, and then written in small batches. The
+ * transaction index is written in large batches while syncing and looked up
+ * by random txid.
+ */
+static DBProfile DefaultDBProfile(const std::string& name)
+{
+    if (name == "index") return DBProfile{10, 45, 16 * 1024, 10};
+    if (name == "txindex") return DBProfile{25, 37, 4 * 1024, 10};
+    return DBProfile{50, 25, 4 * 1024, 10};
+}
+
+/** Apply a -dbprofile=<db>:<setting>=<value> option to profile, if it is for database name. */
+static bool ApplyDBProfileArg(const std::string& arg, const std::string& name, DBProfile& profile, std::string& error)
+{
+    const size_t colon = arg.find(':');
+    const size_t equals = arg.find('=', colon == std::string::npos ? 0 : colon);
+    if (colon == std::string::npos || equals == std::string::npos) {
+        error = strprintf("Invalid -dbprofile '%s', expected <db>:<setting>=<value>", arg);
+        return false;
+    }
+    const std::string db = arg.substr(0, colon);
+    if (db != "chainstate" && db != "index" && db != "txindex") {
+        error = strprintf("Unknown database '%s' in -dbprofile (chainstate, index or txindex)", db);
+        return false;
+    }
+    if (db != name) return true;
+
+    const std::string setting = arg.substr(colon + 1, equals - colon - 1);
+    int64_t value;
+    if (!ParseInt64(arg.substr(equals + 1), &value)) {
+        error = strprintf("Invalid value in -dbprofile '%s'", arg);
+        return false;
+    }
+    if (setting == "blockcache" && value >= 1 && value <= 100) {
+        profile.block_cache_percent = value;
+    } else if (setting == "writebuffer" && value >= 1 && value <= 50) {
+        profile.write_buffer_percent = value;
+    } else if (setting == "blocksize" && value >= 1024 && value <= (4 << 20)) {
+        profile.block_size = value;
+    } else if (setting == "bloombits" && value >= 0 && value <= 32) {
+        profile.bloom_bits = value;
+    } else {
+        error = strprintf("Invalid setting or value out of range in -dbprofile '%s'", arg);
+        return false;
+    }
+    return true;
+}
+
+static bool BuildDBProfile(const std::string& name, DBProfile& profile, std::string& error)
+{
+    profile = DefaultDBProfile(name);
+    for (const std::string& arg : gArgs.GetArgs("-dbprofile")) {
+        if (!ApplyDBProfileArg(arg, name, profile, error)) return false;
+    }
+    if (profile.block_cache_percent + 2 * profile.write_buffer_percent > 100) {
+        error = strprintf("-dbprofile settings for %s exceed its cache size (blockcache + 2 * writebuffer > 100)", name);
+        return false;
+    }
+    return true;
+}
+
+DBProfile GetDBProfile(const std::string& name)
+{
+    DBProfile profile;
+    std::string error;
+    if (!BuildDBProfile(name, profile, error)) {
+        throw std::runtime_error(error);
+    }
+    return profile;
+}
+
+bool CheckDBProfileArgs(std::string& error)
+{
+    DBProfile profile;
+    for (const std::string& name : {"chainstate", "index", "txindex"}) {
+        if (!BuildDBProfile(name, profile, error)) return false;
+    }
+    return true;
+}
+
+static leveldb::Options GetOptions(size_t nCacheSize, const DBProfile& profile)
 {
     leveldb::Options options;
-    options.block_cache = leveldb::NewLRUCache(nCacheSize / 2);
-    options.write_buffer_size = nCacheSize / 4; // up to two write buffers may be held in memory simultaneously
-    options.filter_policy = leveldb::NewBloomFilterPolicy(10);
+    options.block_cache = leveldb::NewLRUCache(nCacheSize * profile.block_cache_percent / 100);
+    options.write_buffer_size = nCacheSize * profile.write_buffer_percent / 100; // up to two write buffers may be held in memory simultaneously
+    options.block_size = profile.block_size;
+    options.filter_policy = profile.bloom_bits > 0 ? leveldb::NewBloomFilterPolicy(profile.bloom_bits) : nullptr;
+    // LevelDB is built without Snappy, so compression could not take effect.
     options.compression = leveldb::kNoCompression;
     options.info_log = new CBitcoinLevelDBLogger();
     if (leveldb::kMajorVersion > 1 || (leveldb::kMajorVersion == 1 && leveldb::kMinorVersion >= 16)) {
@@ -115,14 +208,16 @@ static leveldb::Options GetOptions(size_t nCacheSize)
 }
 
 CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bool fWipe, bool obfuscate)
-    : m_name(fs::basename(path))
+    : m_name(fs::basename(path)), m_profile(GetDBProfile(m_name))
 {
     penv = nullptr;
     readoptions.verify_checksums = true;
     iteroptions.verify_checksums = true;
     iteroptions.fill_cache = false;
     syncoptions.sync = true;
-    options = GetOptions(nCacheSize);
+    options = GetOptions(nCacheSize, m_profile);
+    LogPrint(BCLog::LEVELDB, "LevelDB profile for %s: block cache %d%%, write buffer %d%%, block size %u, bloom bits %d\n",
+             m_name, m_profile.block_cache_percent, m_profile.write_buffer_percent, m_profile.block_size, m_profile.bloom_bits);
     options.create_if_missing = true;
     if (fMemory) {
         penv = leveldb::NewMemEnv(leveldb::Env::Default());
@@ -164,10 +259,17 @@ CDBWrapper::CDBWrapper(const fs::path& path, size_t nCacheSize, bool fMemory, bo
     }
 
     LogPrintf("Using obfuscation key for %s: %s\n", path.string(), HexStr(obfuscate_key));
+
+    LOCK(g_dbwrappers_mutex);
+    g_dbwrappers.insert(this);
 }
 
 CDBWrapper::~CDBWrapper()
 {
+    {
+        LOCK(g_dbwrappers_mutex);
+        g_dbwrappers.erase(this);
+    }
     delete pdb;
     pdb = nullptr;
     delete options.filter_policy;
@@ -189,6 +291,8 @@ bool CDBWrapper::WriteBatch(CDBBatch& batch, bool fSync)
     }
     leveldb::Status status = pdb->Write(fSync ? syncoptions : writeoptions, &batch.batch);
     dbwrapper_private::HandleError(status);
+    ++m_batches;
+    m_write_bytes += batch.SizeEstimate();
     if (log_memory) {
         double mem_after = DynamicMemoryUsage() / 1024.0 / 1024;
         LogPrint(BCLog::LEVELDB, "WriteBatch memory usage: db=%s, before=%.1fMiB, after=%.1fMiB\n",
@@ -206,6 +310,52 @@ size_t CDBWrapper::DynamicMemoryUsage() const {
     return stoul(memory);
 }
 
+DBCounters CDBWrapper::GetCounters() const
+{
+    DBCounters counters;
+    counters.reads = m_reads;
+    counters.read_misses = m_read_misses;
+    counters.read_bytes = m_read_bytes;
+    counters.batches = m_batches;
+    counters.write_bytes = m_write_bytes;
+    counters.iterators = m_iterators;
+    return counters;
+}
+
+std::shared_ptr<const leveldb::Snapshot> CDBWrapper::GetSnapshot() const
+{
+    leveldb::DB* db = pdb;
+    return std::shared_ptr<const leveldb::Snapshot>(pdb->GetSnapshot(), [db](const leveldb::Snapshot* snapshot) { db->ReleaseSnapshot(snapshot); });
+}
+
+bool CDBWrapper::GetProperty(const std::string& property, std::string& value) const
+{
+    return pdb->GetProperty(property, &value);
+}
+
+size_t CDBWrapper::EstimateTotalSize() const
+{
+    // All keys sort before a run of 0xff bytes longer than any of them.
+    const std::string limit(DBWRAPPER_PREALLOC_KEY_SIZE, '\xff');
+    leveldb::Range range(leveldb::Slice(), limit);
+    uint64_t size = 0;
+    pdb->GetApproximateSizes(&range, 1, &size);
+    return size;
+}
+
+size_t CDBWrapper::BlockCacheUsage() const
+{
+    return options.block_cache->TotalCharge();
+}
+
+void ForEachDBWrapper(const std::function<void(const CDBWrapper&)>& f)
+{
+    LOCK(g_dbwrappers_mutex);
+    for (const CDBWrapper* db : g_dbwrappers) {
+        f(*db);
+    }
+}
+
 // Prefixed with null character to avoid collisions with other keys
 //
 // We must use a string constructor which specifies length so that we copy
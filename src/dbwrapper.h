@@ -13,12 +13,54 @@
 #include <util/strencodings.h>
 #include <version.h>
 
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
 #include <leveldb/db.h>
 #include <leveldb/write_batch.h>
 
 static const size_t DBWRAPPER_PREALLOC_KEY_SIZE = 64;
 static const size_t DBWRAPPER_PREALLOC_VALUE_SIZE = 1024;
 
+/** LevelDB settings suited to how a database is used, see GetDBProfile(). */
+struct DBProfile
+{
+    //! Percentage of the database's cache size used for the block cache
+    int block_cache_percent;
+    //! Percentage of the cache size used for each write buffer (up to two are held in memory)
+    int write_buffer_percent;
+    //! Approximate size of the blocks that data is read and cached in
+    size_t block_size;
+    //! Bloom filter bits per key, 0 for no filter
+    int bloom_bits;
+};
+
+/**
+ * Return the profile of the database in directory name ("chainstate",
+ * "index" or "txindex"; any other gets the chainstate profile), with the
+ * -dbprofile overrides for it applied. Throws std::runtime_error if an
+ * override is invalid.
+ */
+DBProfile GetDBProfile(const std::string& name);
+
+/** Check the -dbprofile options. Returns false, with error set, if one is invalid. */
+bool CheckDBProfileArgs(std::string& error);
+
+/** Operations performed on a CDBWrapper since it was opened. */
+struct DBCounters
+{
+    uint64_t reads;       //!< Lookups (Read and Exists)
+    uint64_t read_misses; //!< Lookups of keys that were not found
+    uint64_t read_bytes;  //!< Bytes of the values read
+    uint64_t batches;     //!< Batches written, including single writes and erases
+    uint64_t write_bytes; //!< Estimated size of the batches written
+    uint64_t iterators;   //!< Iterators created
+};
+
 class dbwrapper_error : public std::runtime_error
 {
 public:
@@ -201,6 +243,16 @@ private:
     //! the name of this database
     std::string m_name;
 
+    //! the profile the options were derived from
+    DBProfile m_profile;
+
+    mutable std::atomic<uint64_t> m_reads{0};
+    mutable std::atomic<uint64_t> m_read_misses{0};
+    mutable std::atomic<uint64_t> m_read_bytes{0};
+    std::atomic<uint64_t> m_batches{0};
+    std::atomic<uint64_t> m_write_bytes{0};
+    std::atomic<uint64_t> m_iterators{0};
+
     //! a key used for optional XOR-obfuscation of the database
     std::vector<unsigned char> obfuscate_key;
 
@@ -215,6 +267,7 @@ private:
 public:
     /**
      * @param[in] path        Location in the filesystem where leveldb data will be stored.
+     *                        Its last component selects the profile, see GetDBProfile().
      * @param[in] nCacheSize  Configures various leveldb cache settings.
      * @param[in] fMemory     If true, use leveldb's memory environment.
      * @param[in] fWipe       If true, remove all existing data.
@@ -227,22 +280,32 @@ public:
     CDBWrapper(const CDBWrapper&) = delete;
     CDBWrapper& operator=(const CDBWrapper&) = delete;
 
+    /**
+     * @param[in] snapshot    If not null, read the value as of this snapshot
+     *                        (see GetSnapshot()) rather than the current one.
+     */
     template <typename K, typename V>
-    bool Read(const K& key, V& value) const
+    bool Read(const K& key, V& value, const leveldb::Snapshot* snapshot = nullptr) const
     {
         CDataStream ssKey(SER_DISK, CLIENT_VERSION);
         ssKey.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
         ssKey << key;
         leveldb::Slice slKey(ssKey.data(), ssKey.size());
 
+        leveldb::ReadOptions options = readoptions;
+        options.snapshot = snapshot;
         std::string strValue;
-        leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
+        leveldb::Status status = pdb->Get(options, slKey, &strValue);
+        ++m_reads;
         if (!status.ok()) {
-            if (status.IsNotFound())
+            if (status.IsNotFound()) {
+                ++m_read_misses;
                 return false;
+            }
             LogPrintf("LevelDB read failure: %s\n", status.ToString());
             dbwrapper_private::HandleError(status);
         }
+        m_read_bytes += strValue.size();
         try {
             CDataStream ssValue(strValue.data(), strValue.data() + strValue.size(), SER_DISK, CLIENT_VERSION);
             ssValue.Xor(obfuscate_key);
@@ -271,15 +334,62 @@ public:
 
         std::string strValue;
         leveldb::Status status = pdb->Get(readoptions, slKey, &strValue);
+        ++m_reads;
         if (!status.ok()) {
-            if (status.IsNotFound())
+            if (status.IsNotFound()) {
+                ++m_read_misses;
                 return false;
+            }
             LogPrintf("LevelDB read failure: %s\n", status.ToString());
             dbwrapper_private::HandleError(status);
         }
+        m_read_bytes += strValue.size();
         return true;
     }
 
+    /**
+     * Whether any of keys exists. The keys are looked up in key order in one
+     * forward pass of a single iterator, which is only repositioned when it
+     * has not already landed at or past the next key, and which stops at the
+     * first hit.
+     */
+    template <typename K>
+    bool ExistsAny(const std::vector<K>& keys) const
+    {
+        std::vector<std::string> sorted;
+        sorted.reserve(keys.size());
+        for (const K& key : keys) {
+            CDataStream ssKey(SER_DISK, CLIENT_VERSION);
+            ssKey.reserve(DBWRAPPER_PREALLOC_KEY_SIZE);
+            ssKey << key;
+            sorted.emplace_back(ssKey.begin(), ssKey.end());
+        }
+        std::sort(sorted.begin(), sorted.end());
+
+        std::unique_ptr<leveldb::Iterator> piter(pdb->NewIterator(readoptions));
+        bool fPositioned = false;
+        for (size_t i = 0; i < sorted.size(); i++) {
+            const leveldb::Slice slKey(sorted[i]);
+            ++m_reads;
+            // After a seek the iterator is at the first entry at or after the
+            // previous key, so none lies between that key and this one unless
+            // the iterator is still before it.
+            if (!fPositioned || piter->key().compare(slKey) < 0) {
+                piter->Seek(slKey);
+                fPositioned = true;
+            }
+            if (!piter->Valid()) {
+                // Nothing at or after this key, so none of the rest exist either.
+                dbwrapper_private::HandleError(piter->status());
+                ++m_read_misses;
+                return false;
+            }
+            if (piter->key() == slKey) return true;
+            ++m_read_misses;
+        }
+        return false;
+    }
+
     template <typename K>
     bool Erase(const K& key, bool fSync = false)
     {
@@ -307,9 +417,34 @@ public:
 
     CDBIterator *NewIterator()
     {
+        ++m_iterators;
         return new CDBIterator(*this, pdb->NewIterator(iteroptions));
     }
 
+    /**
+     * Return a consistent view of the database as it is now, for Read(). It
+     * is released with the last reference, which must not outlive this.
+     */
+    std::shared_ptr<const leveldb::Snapshot> GetSnapshot() const;
+
+    const std::string& GetName() const { return m_name; }
+
+    const DBProfile& GetProfile() const { return m_profile; }
+
+    DBCounters GetCounters() const;
+
+    /**
+     * Read a LevelDB property, such as "leveldb.stats" (see leveldb/db.h).
+     * Returns false if there is no such property.
+     */
+    bool GetProperty(const std::string& property, std::string& value) const;
+
+    // Get an estimate of the size of the whole database on disk (in bytes).
+    size_t EstimateTotalSize() const;
+
+    // Get the memory used by the block cache (in bytes).
+    size_t BlockCacheUsage() const;
+
     /**
      * Return true if the database managed by this class contains no entries.
      */
@@ -349,4 +484,7 @@ public:
 
 };
 
+/** Call f for every open CDBWrapper, which cannot be closed in the meantime. */
+void ForEachDBWrapper(const std::function<void(const CDBWrapper&)>& f);
+
 #endif // BITCOIN_DBWRAPPER_H
@@ -5,6 +5,8 @@
 #ifndef BITCOIN_HTTPSERVER_H
 #define BITCOIN_HTTPSERVER_H
 
+#include <span.h>
+
 #include <string>
 #include <stdint.h>
 #include <functional>
@@ -114,6 +116,8 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     void WriteReply(int nStatus, const std::string& strReply = "");
+    //! Write HTTP reply with the body taken directly from reply (see above).
+    void WriteReply(int nStatus, Span<const unsigned char> reply);
 };
 
 /** Event handler closure.
@@ -38,6 +38,7 @@ int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParam
     int64_t nNewTime = std::max(pblock->GetBlockTime(), GetAdjustedTime());
 
     pblock->nTime = nNewTime;
+    pblock->InvalidateHash();
 
     // [PINK] TODO: Remove it?
     // Updating time can change work required on testnet:
@@ -166,7 +167,7 @@ std::unique_ptr<CBlockTemplate> BlockAssembler::CreateNewBlock(const CScript& sc
     pblock->hashPrevBlock  = pindexPrev->GetBlockHash();
     UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
     // [PINK] Replace GetNextWorkRequired with GetNextTargetRequired
-    pblock->nBits          = GetNextTargetRequired(pindexPrev, pblock, chainparams.GetConsensus(), pblock->IsProofOfStake());
+    pblock->nBits          = GetNextTargetRequired(pindexPrev, pblock, chainparams.GetConsensus(), pblock->IsProofOfStake(), targetcache);
     pblock->nNonce         = 0;
     pblocktemplate->vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(*pblock->vtx[0]);
 
@@ -448,4 +449,43 @@ void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned
 
     pblock->vtx[0] = MakeTransactionRef(std::move(txCoinbase));
     pblock->hashMerkleRoot = BlockMerkleRoot(*pblock);
+    pblock->InvalidateHash();
+}
+
+bool ScanNonces(CBlockHeader* pblock, uint32_t nNonceEnd, uint64_t& nMaxTries, const Consensus::Params& consensusParams)
+{
+    // nNonce is the last field of the 80 header bytes that get hashed.
+    char candidates[SCRYPT_MAX_LANES][CBlockHeader::HEADER_SIZE];
+    uint256 hashes[SCRYPT_MAX_LANES];
+    const char* inputs[SCRYPT_MAX_LANES];
+    char* outputs[SCRYPT_MAX_LANES];
+    for (size_t i = 0; i < SCRYPT_MAX_LANES; ++i) {
+        memcpy(candidates[i], pblock->begin(), CBlockHeader::HEADER_SIZE);
+        inputs[i] = candidates[i];
+        outputs[i] = (char*)hashes[i].begin();
+    }
+
+    const uint64_t lanes = ScryptLanes();
+    uint32_t nNonce = pblock->nNonce;
+    bool found = false;
+    while (!found && nMaxTries > 0 && nNonce < nNonceEnd) {
+        const size_t count = std::min({lanes, (uint64_t)(nNonceEnd - nNonce), nMaxTries});
+        for (size_t i = 0; i < count; ++i) {
+            const uint32_t nCandidate = nNonce + i;
+            memcpy(candidates[i] + CBlockHeader::HEADER_SIZE - sizeof(uint32_t), &nCandidate, sizeof(uint32_t));
+        }
+        scrypt_1024_1_1_256_multi(inputs, outputs, count);
+        for (size_t i = 0; i < count; ++i) {
+            if (CheckProofOfWork(hashes[i], pblock->nBits, consensusParams)) {
+                found = true;
+                break;
+            }
+            ++nNonce;
+            --nMaxTries;
+        }
+    }
+
+    pblock->nNonce = nNonce;
+    pblock->InvalidateHash();
+    return found;
 }
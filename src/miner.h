@@ -202,4 +202,13 @@ private:
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
 
+/**
+ * Search nonces from pblock->nNonce up to (excluding) nNonceEnd for one that
+ * satisfies the proof of work, hashing several candidates at once with the
+ * multi-lane scrypt kernels. nMaxTries is decremented for every nonce that
+ * fails. Returns true with pblock->nNonce set to the first valid nonce, or
+ * false with pblock->nNonce at the first nonce not yet tried.
+ */
+bool ScanNonces(CBlockHeader* pblock, uint32_t nNonceEnd, uint64_t& nMaxTries, const Consensus::Params& consensusParams);
+
 #endif // BITCOIN_MINER_H
@@ -31,6 +31,10 @@
 #include <poll.h>
 #endif
 
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
 #ifdef USE_UPNP
 #include <miniupnpc/miniupnpc.h>
 #include <miniupnpc/miniwget.h>
@@ -70,8 +74,23 @@ enum BindFlags {
 // The sleep time needs to be small to avoid new sockets stalling
 static const uint64_t SELECT_TIMEOUT_MILLISECONDS = 50;
 
+#ifdef USE_EPOLL
+// Events a socket thread takes from epoll at once
+static const int MAX_SOCKET_EVENTS = 256;
+// How often a socket thread checks all its peers for inactivity and closed sockets
+static const int64_t SOCKET_CHECK_INTERVAL_MILLISECONDS = 500;
+#endif
+
+// Messages with at least this much data left are received straight into their buffer
+static const unsigned int MIN_DIRECT_RECV_BYTES = 0x10000;
+
+// Buffers (two per queued message) handed to the kernel in a single send call
+static const int MAX_SEND_BUFFERS = 64;
+
 const std::string NET_MESSAGE_COMMAND_OTHER = "*other*";
 
+static CNetMessageBufferPool g_recv_buffer_pool;
+
 static const uint64_t RANDOMIZER_ID_NETGROUP = 0x6c0edd8036ef4036ULL; // SHA256("netgroup")[0:8]
 static const uint64_t RANDOMIZER_ID_LOCALHOSTNONCE = 0xd93e69e2bbfa5735ULL; // SHA256("localhostnonce")[0:8]
 //
@@ -451,6 +470,15 @@ void CNode::CloseSocketDisconnect()
     if (hSocket != INVALID_SOCKET)
     {
         LogPrint(BCLog::NET, "disconnecting peer=%d\n", id);
+#ifdef USE_EPOLL
+        // Closing the socket only removes it from epoll once no other copy
+        // of it is open, such as one inherited by a child process, and until
+        // then epoll could report events for this node after it is freed.
+        if (nSocketEpollFd >= 0) {
+            epoll_ctl(nSocketEpollFd, EPOLL_CTL_DEL, hSocket, nullptr);
+            nSocketEpollFd = -1;
+        }
+#endif
         CloseSocket(hSocket);
     }
 }
@@ -603,6 +631,13 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete
     return true;
 }
 
+char* CNode::GetRecvBuffer(unsigned int& nBytes)
+{
+    if (vRecvMsg.empty())
+        return nullptr;
+    return vRecvMsg.back().GetDataBuffer(MIN_DIRECT_RECV_BYTES, nBytes);
+}
+
 void CNode::SetSendVersion(int nVersionIn)
 {
     // Send version may only be changed in the version message, and
@@ -630,22 +665,66 @@ int CNode::GetSendVersion() const
 }
 
 
+CSerializeData CNetMessageBufferPool::Get(size_t nSize)
+{
+    assert(nSize <= MAX_BUFFER_SIZE);
+    unsigned int nBits = MIN_CLASS_BITS;
+    while ((size_t{1} << nBits) < nSize)
+        nBits++;
+
+    CSerializeData buffer;
+    {
+        LOCK(cs);
+        std::vector<CSerializeData>& vClass = vFree[nBits - MIN_CLASS_BITS];
+        if (!vClass.empty()) {
+            buffer = std::move(vClass.back());
+            vClass.pop_back();
+            return buffer;
+        }
+    }
+    buffer.reserve(size_t{1} << nBits);
+    return buffer;
+}
+
+void CNetMessageBufferPool::Put(CSerializeData&& buffer)
+{
+    const size_t nCapacity = buffer.capacity();
+    if (nCapacity < (size_t{1} << MIN_CLASS_BITS) || nCapacity > MAX_BUFFER_SIZE)
+        return;
+    unsigned int nBits = MIN_CLASS_BITS;
+    while ((size_t{2} << nBits) <= nCapacity)
+        nBits++;
+
+    buffer.clear();
+    LOCK(cs);
+    std::vector<CSerializeData>& vClass = vFree[nBits - MIN_CLASS_BITS];
+    if (((vClass.size() + 1) << nBits) <= MAX_CLASS_BYTES)
+        vClass.push_back(std::move(buffer));
+}
+
+CNetMessage::~CNetMessage()
+{
+    CSerializeData buffer;
+    vRecv.swap(buffer);
+    g_recv_buffer_pool.Put(std::move(buffer));
+}
+
 int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
 {
     // copy data to temporary parsing buffer
-    unsigned int nRemaining = 24 - nHdrPos;
+    unsigned int nRemaining = CMessageHeader::HEADER_SIZE - nHdrPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
     memcpy(&hdrbuf[nHdrPos], pch, nCopy);
     nHdrPos += nCopy;
 
     // if header incomplete, exit
-    if (nHdrPos < 24)
+    if (nHdrPos < CMessageHeader::HEADER_SIZE)
         return nCopy;
 
     // deserialize to CMessageHeader
     try {
-        hdrbuf >> hdr;
+        SpanReader(SER_NETWORK, INIT_PROTO_VERSION, Span<const unsigned char>(hdrbuf, sizeof(hdrbuf)), 0) >> hdr;
     }
     catch (const std::exception&) {
         return -1;
@@ -661,18 +740,38 @@ int CNetMessage::readHeader(const char *pch, unsigned int nBytes)
     return nCopy;
 }
 
+void CNetMessage::ReserveData(unsigned int nSize)
+{
+    if (vRecv.size() >= nSize)
+        return;
+    if (vRecv.empty() && hdr.nMessageSize <= CNetMessageBufferPool::MAX_BUFFER_SIZE) {
+        CSerializeData buffer = g_recv_buffer_pool.Get(hdr.nMessageSize);
+        vRecv.swap(buffer);
+    }
+    // Allocate up to 256 KiB ahead, but never more than the total message size.
+    vRecv.resize(std::min(hdr.nMessageSize, nSize + 256 * 1024));
+}
+
+char* CNetMessage::GetDataBuffer(unsigned int nMinBytes, unsigned int& nBytes)
+{
+    if (!in_data || hdr.nMessageSize - nDataPos < std::max(nMinBytes, 1U))
+        return nullptr;
+    ReserveData(nDataPos + 1);
+    nBytes = vRecv.size() - nDataPos;
+    return vRecv.data() + nDataPos;
+}
+
 int CNetMessage::readData(const char *pch, unsigned int nBytes)
 {
     unsigned int nRemaining = hdr.nMessageSize - nDataPos;
     unsigned int nCopy = std::min(nRemaining, nBytes);
 
-    if (vRecv.size() < nDataPos + nCopy) {
-        // Allocate up to 256 KiB ahead, but never more than the total message size.
-        vRecv.resize(std::min(hdr.nMessageSize, nDataPos + nCopy + 256 * 1024));
-    }
+    ReserveData(nDataPos + nCopy);
 
     hasher.Write((const unsigned char*)pch, nCopy);
-    memcpy(&vRecv[nDataPos], pch, nCopy);
+    // Data received through GetDataBuffer() is in place already
+    if (pch != vRecv.data() + nDataPos)
+        memcpy(vRecv.data() + nDataPos, pch, nCopy);
     nDataPos += nCopy;
 
     return nCopy;
@@ -686,33 +785,91 @@ const uint256& CNetMessage::GetMessageHash() const
     return data_hash;
 }
 
+namespace {
+/** Part of a queued message still to be sent */
+struct SendBuffer {
+    const unsigned char* pch;
+    size_t nBytes;
+};
+
+/** Send as much of the buffers, in order, as the socket takes. Returns what send() would. */
+int SendBuffers(SOCKET hSocket, const SendBuffer* buffers, int nBuffers)
+{
+#ifdef WIN32
+    WSABUF bufs[MAX_SEND_BUFFERS];
+    for (int i = 0; i < nBuffers; i++) {
+        bufs[i].buf = (char*)buffers[i].pch;
+        bufs[i].len = buffers[i].nBytes;
+    }
+    DWORD nSent = 0;
+    if (WSASend(hSocket, bufs, nBuffers, &nSent, 0, nullptr, nullptr) == SOCKET_ERROR)
+        return SOCKET_ERROR;
+    return nSent;
+#else
+    struct iovec vec[MAX_SEND_BUFFERS];
+    for (int i = 0; i < nBuffers; i++) {
+        vec[i].iov_base = (void*)buffers[i].pch;
+        vec[i].iov_len = buffers[i].nBytes;
+    }
+    struct msghdr msg = {};
+    msg.msg_iov = vec;
+    msg.msg_iovlen = nBuffers;
+    return sendmsg(hSocket, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+#endif
+}
+} // namespace
+
 size_t CConnman::SocketSendData(CNode *pnode) const EXCLUSIVE_LOCKS_REQUIRED(pnode->cs_vSend)
 {
     auto it = pnode->vSendMsg.begin();
     size_t nSentSize = 0;
 
     while (it != pnode->vSendMsg.end()) {
-        const auto &data = *it;
-        assert(data.size() > pnode->nSendOffset);
+        // Gather the unsent part of as many queued messages as one call takes
+        SendBuffer buffers[MAX_SEND_BUFFERS];
+        int nBuffers = 0;
+        size_t nBatchSize = 0;
+        size_t nOffset = pnode->nSendOffset;
+        for (auto itBatch = it; itBatch != pnode->vSendMsg.end() && nBuffers + 2 <= MAX_SEND_BUFFERS; ++itBatch) {
+            const Span<const unsigned char> payload = itBatch->GetPayload();
+            assert(itBatch->size() > nOffset);
+            if (nOffset < CMessageHeader::HEADER_SIZE) {
+                buffers[nBuffers++] = {itBatch->hdr + nOffset, CMessageHeader::HEADER_SIZE - nOffset};
+                nOffset = CMessageHeader::HEADER_SIZE;
+            }
+            if (payload.size() > 0) {
+                buffers[nBuffers++] = {payload.data() + nOffset - CMessageHeader::HEADER_SIZE, payload.size() + CMessageHeader::HEADER_SIZE - nOffset};
+            }
+            nBatchSize += itBatch->size() - (itBatch == it ? pnode->nSendOffset : 0);
+            nOffset = 0;
+        }
+
         int nBytes = 0;
         {
             LOCK(pnode->cs_hSocket);
             if (pnode->hSocket == INVALID_SOCKET)
                 break;
-            nBytes = send(pnode->hSocket, reinterpret_cast<const char*>(data.data()) + pnode->nSendOffset, data.size() - pnode->nSendOffset, MSG_NOSIGNAL | MSG_DONTWAIT);
+            nBytes = SendBuffers(pnode->hSocket, buffers, nBuffers);
         }
         if (nBytes > 0) {
             pnode->nLastSend = GetSystemTimeInSeconds();
             pnode->nSendBytes += nBytes;
-            pnode->nSendOffset += nBytes;
             nSentSize += nBytes;
-            if (pnode->nSendOffset == data.size()) {
+            size_t nLeft = nBytes;
+            while (nLeft > 0) {
+                const size_t nMsgLeft = it->size() - pnode->nSendOffset;
+                if (nLeft < nMsgLeft) {
+                    pnode->nSendOffset += nLeft;
+                    break;
+                }
+                nLeft -= nMsgLeft;
                 pnode->nSendOffset = 0;
-                pnode->nSendSize -= data.size();
-                pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
+                pnode->nSendSize -= it->size();
                 it++;
-            } else {
-                // could not send full message; stop sending more
+            }
+            pnode->fPauseSend = pnode->nSendSize > nSendBufferMaxSize;
+            if ((size_t)nBytes < nBatchSize) {
+                // could not send everything; stop sending more
                 break;
             }
         } else {
@@ -932,6 +1089,7 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
     // According to the internet TCP_NODELAY is not carried into accepted sockets
     // on all platforms.  Set it again here just to be sure.
     SetSocketNoDelay(hSocket);
+    SetSocketCloseOnExec(hSocket);
 
     int bannedlevel = m_banman ? m_banman->IsBannedLevel(addr) : 0;
 
@@ -966,6 +1124,10 @@ void CConnman::AcceptConnection(const ListenSocket& hListenSocket) {
 
     LogPrint(BCLog::NET, "connection from %s accepted\n", addr.ToString());
 
+#ifdef USE_EPOLL
+    if (m_use_epoll)
+        AddSocketNode(pnode);
+#endif
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
@@ -1245,6 +1407,69 @@ void CConnman::SocketEvents(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_s
 }
 #endif
 
+bool CConnman::SocketRecvData(CNode* pnode)
+{
+    // typical socket buffer is 8K-64K
+    char pchBuf[0x10000];
+    // but the rest of a large message is received straight into its buffer
+    unsigned int nBufSize = sizeof(pchBuf);
+    char* pchRecv = pnode->GetRecvBuffer(nBufSize);
+    if (!pchRecv) {
+        pchRecv = pchBuf;
+        nBufSize = sizeof(pchBuf);
+    }
+    int nBytes = 0;
+    {
+        LOCK(pnode->cs_hSocket);
+        if (pnode->hSocket == INVALID_SOCKET)
+            return false;
+        nBytes = recv(pnode->hSocket, pchRecv, nBufSize, MSG_DONTWAIT);
+    }
+    if (nBytes > 0)
+    {
+        bool notify = false;
+        if (!pnode->ReceiveMsgBytes(pchRecv, nBytes, notify))
+            pnode->CloseSocketDisconnect();
+        RecordBytesRecv(nBytes);
+        if (notify) {
+            size_t nSizeAdded = 0;
+            auto it(pnode->vRecvMsg.begin());
+            for (; it != pnode->vRecvMsg.end(); ++it) {
+                if (!it->complete())
+                    break;
+                nSizeAdded += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
+            }
+            {
+                LOCK(pnode->cs_vProcessMsg);
+                pnode->vProcessMsg.splice(pnode->vProcessMsg.end(), pnode->vRecvMsg, pnode->vRecvMsg.begin(), it);
+                pnode->nProcessQueueSize += nSizeAdded;
+                pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
+            }
+            WakeMessageHandler();
+        }
+    }
+    else if (nBytes == 0)
+    {
+        // socket closed gracefully
+        if (!pnode->fDisconnect) {
+            LogPrint(BCLog::NET, "socket closed\n");
+        }
+        pnode->CloseSocketDisconnect();
+    }
+    else if (nBytes < 0)
+    {
+        // error
+        int nErr = WSAGetLastError();
+        if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
+        {
+            if (!pnode->fDisconnect)
+                LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
+            pnode->CloseSocketDisconnect();
+        }
+    }
+    return nBytes == (int)nBufSize;
+}
+
 void CConnman::SocketHandler()
 {
     std::set<SOCKET> recv_set, send_set, error_set;
@@ -1294,57 +1519,7 @@ void CConnman::SocketHandler()
         }
         if (recvSet || errorSet)
         {
-            // typical socket buffer is 8K-64K
-            char pchBuf[0x10000];
-            int nBytes = 0;
-            {
-                LOCK(pnode->cs_hSocket);
-                if (pnode->hSocket == INVALID_SOCKET)
-                    continue;
-                nBytes = recv(pnode->hSocket, pchBuf, sizeof(pchBuf), MSG_DONTWAIT);
-            }
-            if (nBytes > 0)
-            {
-                bool notify = false;
-                if (!pnode->ReceiveMsgBytes(pchBuf, nBytes, notify))
-                    pnode->CloseSocketDisconnect();
-                RecordBytesRecv(nBytes);
-                if (notify) {
-                    size_t nSizeAdded = 0;
-                    auto it(pnode->vRecvMsg.begin());
-                    for (; it != pnode->vRecvMsg.end(); ++it) {
-                        if (!it->complete())
-                            break;
-                        nSizeAdded += it->vRecv.size() + CMessageHeader::HEADER_SIZE;
-                    }
-                    {
-                        LOCK(pnode->cs_vProcessMsg);
-                        pnode->vProcessMsg.splice(pnode->vProcessMsg.end(), pnode->vRecvMsg, pnode->vRecvMsg.begin(), it);
-                        pnode->nProcessQueueSize += nSizeAdded;
-                        pnode->fPauseRecv = pnode->nProcessQueueSize > nReceiveFloodSize;
-                    }
-                    WakeMessageHandler();
-                }
-            }
-            else if (nBytes == 0)
-            {
-                // socket closed gracefully
-                if (!pnode->fDisconnect) {
-                    LogPrint(BCLog::NET, "socket closed\n");
-                }
-                pnode->CloseSocketDisconnect();
-            }
-            else if (nBytes < 0)
-            {
-                // error
-                int nErr = WSAGetLastError();
-                if (nErr != WSAEWOULDBLOCK && nErr != WSAEMSGSIZE && nErr != WSAEINTR && nErr != WSAEINPROGRESS)
-                {
-                    if (!pnode->fDisconnect)
-                        LogPrintf("socket recv error %s\n", NetworkErrorString(nErr));
-                    pnode->CloseSocketDisconnect();
-                }
-            }
+            SocketRecvData(pnode);
         }
 
         //
@@ -1378,13 +1553,169 @@ void CConnman::ThreadSocketHandler()
     }
 }
 
+#ifdef USE_EPOLL
+void CConnman::AddSocketNode(CNode* pnode)
+{
+    SocketThread& thread = *vSocketThreads[pnode->GetId() % vSocketThreads.size()];
+    pnode->AddRef();
+    LOCK(thread.cs);
+    thread.vNodesNew.push_back(pnode);
+}
+
+void CConnman::UpdateSocketEvents(SocketThread& thread, CNode* pnode)
+{
+    // As with select(), don't receive while the send buffer is full: this
+    // leaves the peer to TCP flow control if it is not itself receiving. Nor
+    // while the messages received wait to be processed. Sending is always
+    // waited for; being edge-triggered, it is only reported once the socket
+    // buffer has room again after a send that did not complete.
+    const bool fPaused = pnode->fPauseRecv || pnode->fPauseSend;
+    const uint32_t events = EPOLLOUT | EPOLLRDHUP | EPOLLET | (fPaused ? 0 : EPOLLIN);
+    if (events == pnode->nSocketEvents)
+        return;
+
+    {
+        LOCK(pnode->cs_hSocket);
+        if (pnode->hSocket == INVALID_SOCKET)
+            return;
+        // Modifying the events reports the socket again if it is ready, so no
+        // data that arrived while paused is missed.
+        struct epoll_event event;
+        event.events = events;
+        event.data.ptr = pnode;
+        if (epoll_ctl(thread.epollfd, pnode->nSocketEvents ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, pnode->hSocket, &event) != 0) {
+            LogPrintf("socket epoll_ctl error %s\n", NetworkErrorString(WSAGetLastError()));
+            pnode->fDisconnect = true;
+            return;
+        }
+        pnode->nSocketEpollFd = thread.epollfd;
+    }
+    pnode->nSocketEvents = events;
+    if (fPaused) {
+        thread.setNodesPaused.insert(pnode);
+    } else {
+        thread.setNodesPaused.erase(pnode);
+    }
+}
+
+void CConnman::ServiceSocketEvents(SocketThread& thread, CNode* pnode, uint32_t events)
+{
+    if (events & EPOLLOUT)
+    {
+        LOCK(pnode->cs_vSend);
+        size_t nBytes = SocketSendData(pnode);
+        if (nBytes) {
+            RecordBytesSent(nBytes);
+        }
+    }
+
+    // Edges are not reported again, so read until the socket has nothing
+    // left, or until receiving pauses (resuming then reports the rest).
+    // Errors and hangups are read regardless, as with select().
+    if (events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+        while (SocketRecvData(pnode)) {}
+    } else if (events & EPOLLIN) {
+        while (!pnode->fPauseRecv && !pnode->fPauseSend && SocketRecvData(pnode)) {}
+    }
+
+    UpdateSocketEvents(thread, pnode);
+}
+
+void CConnman::ThreadSocketEvents(SocketThread& thread, bool fFirst)
+{
+    std::vector<struct epoll_event> vEvents(MAX_SOCKET_EVENTS);
+    int64_t nLastCheck = GetTimeMillis();
+    while (!interruptNet)
+    {
+        if (fFirst) {
+            DisconnectNodes();
+            NotifyNumConnectionsChanged();
+        }
+
+        std::vector<CNode*> vNodesNew;
+        {
+            LOCK(thread.cs);
+            vNodesNew.swap(thread.vNodesNew);
+        }
+        for (CNode* pnode : vNodesNew) {
+            thread.vNodes.push_back(pnode);
+            UpdateSocketEvents(thread, pnode);
+        }
+
+        // Resume receiving from the nodes whose buffers have drained since.
+        std::vector<CNode*> vNodesPaused(thread.setNodesPaused.begin(), thread.setNodesPaused.end());
+        for (CNode* pnode : vNodesPaused) {
+            UpdateSocketEvents(thread, pnode);
+        }
+
+        int nEvents = epoll_wait(thread.epollfd, vEvents.data(), vEvents.size(), SELECT_TIMEOUT_MILLISECONDS);
+
+        if (interruptNet)
+            return;
+
+        if (nEvents < 0) {
+            int nErr = WSAGetLastError();
+            if (nErr != WSAEINTR) {
+                LogPrintf("socket epoll_wait error %s\n", NetworkErrorString(nErr));
+                interruptNet.sleep_for(std::chrono::milliseconds(SELECT_TIMEOUT_MILLISECONDS));
+            }
+            continue;
+        }
+
+        for (int i = 0; i < nEvents; i++) {
+            const ListenSocket* plisten = nullptr;
+            if (fFirst) {
+                for (const ListenSocket& hListenSocket : vhListenSocket) {
+                    if (&hListenSocket == vEvents[i].data.ptr) plisten = &hListenSocket;
+                }
+            }
+            if (plisten) {
+                AcceptConnection(*plisten);
+            } else {
+                ServiceSocketEvents(thread, static_cast<CNode*>(vEvents[i].data.ptr), vEvents[i].events);
+            }
+        }
+
+        // A node's socket leaves epoll before it is closed (see
+        // CNode::CloseSocketDisconnect), so once closed the node gets no more
+        // events after those handled above, and its reference can go.
+        int64_t nNow = GetTimeMillis();
+        if (nNow - nLastCheck >= SOCKET_CHECK_INTERVAL_MILLISECONDS) {
+            nLastCheck = nNow;
+            std::vector<CNode*> vNodesClosed;
+            for (auto it = thread.vNodes.begin(); it != thread.vNodes.end();) {
+                CNode* pnode = *it;
+                bool fClosed;
+                {
+                    LOCK(pnode->cs_hSocket);
+                    fClosed = pnode->hSocket == INVALID_SOCKET;
+                }
+                if (fClosed) {
+                    thread.setNodesPaused.erase(pnode);
+                    vNodesClosed.push_back(pnode);
+                    it = thread.vNodes.erase(it);
+                } else {
+                    InactivityCheck(pnode);
+                    ++it;
+                }
+            }
+            if (!vNodesClosed.empty()) {
+                LOCK(cs_vNodes);
+                for (CNode* pnode : vNodesClosed)
+                    pnode->Release();
+            }
+        }
+    }
+}
+#endif
+
 void CConnman::WakeMessageHandler()
 {
     {
         std::lock_guard<std::mutex> lock(mutexMsgProc);
-        fMsgProcWake = true;
+        nMsgProcWakes++;
     }
-    condMsgProc.notify_one();
+    condMsgProc.notify_all();
 }
 
 
@@ -1939,22 +2270,31 @@ void CConnman::OpenNetworkConnection(const CAddress& addrConnect, bool fCountFai
         pnode->m_manual_connection = true;
 
     m_msgproc->InitializeNode(pnode);
+#ifdef USE_EPOLL
+    if (m_use_epoll)
+        AddSocketNode(pnode);
+#endif
     {
         LOCK(cs_vNodes);
         vNodes.push_back(pnode);
     }
 }
 
-void CConnman::ThreadMessageHandler()
+void CConnman::ThreadMessageHandler(int nThread)
 {
+    uint64_t nWakesSeen = 0;
     while (!flagInterruptMsgProc)
     {
+        // Each thread serves its share of the peers, so a peer's messages are
+        // still processed one at a time and in order.
         std::vector<CNode*> vNodesCopy;
         {
             LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            for (CNode* pnode : vNodesCopy) {
+            for (CNode* pnode : vNodes) {
+                if (pnode->GetId() % nMessageHandlerThreads != nThread)
+                    continue;
                 pnode->AddRef();
+                vNodesCopy.push_back(pnode);
             }
         }
 
@@ -1986,14 +2326,18 @@ void CConnman::ThreadMessageHandler()
                 pnode->Release();
         }
 
-        WAIT_LOCK(mutexMsgProc, lock);
-        if (!fMoreWork) {
-            condMsgProc.wait_until(lock, std::chrono::steady_clock::now() + std::chrono::milliseconds(100), [this] { return fMsgProcWake; });
-        }
-        fMsgProcWake = false;
+        WaitForMessageHandlerWake(nWakesSeen, std::chrono::milliseconds(fMoreWork ? 0 : 100));
     }
 }
 
+bool CConnman::WaitForMessageHandlerWake(uint64_t& nWakesSeen, std::chrono::milliseconds timeout)
+{
+    WAIT_LOCK(mutexMsgProc, lock);
+    const bool fWoken = condMsgProc.wait_until(lock, std::chrono::steady_clock::now() + timeout, [this, nWakesSeen] { return nMsgProcWakes != nWakesSeen; });
+    nWakesSeen = nMsgProcWakes;
+    return fWoken;
+}
+
 
 
 
@@ -2244,11 +2588,40 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
 
     {
         LOCK(mutexMsgProc);
-        fMsgProcWake = false;
+        nMsgProcWakes = 0;
     }
 
     // Send and receive from sockets, accept connections
-    threadSocketHandler = std::thread(&TraceThread<std::function<void()> >, "net", std::function<void()>(std::bind(&CConnman::ThreadSocketHandler, this)));
+#ifdef USE_EPOLL
+    if (m_use_epoll) {
+        for (int i = 0; i < nSocketThreads; i++) {
+            std::unique_ptr<SocketThread> thread = MakeUnique<SocketThread>();
+            thread->epollfd = epoll_create1(EPOLL_CLOEXEC);
+            if (thread->epollfd < 0) {
+                LogPrintf("Error: epoll_create1 failed: %s\n", NetworkErrorString(WSAGetLastError()));
+                return false;
+            }
+            thread->strName = i == 0 ? "net" : strprintf("net.%d", i);
+            vSocketThreads.push_back(std::move(thread));
+        }
+        // Level-triggered: one connection is accepted at a time
+        for (ListenSocket& hListenSocket : vhListenSocket) {
+            struct epoll_event event;
+            event.events = EPOLLIN;
+            event.data.ptr = &hListenSocket;
+            if (epoll_ctl(vSocketThreads[0]->epollfd, EPOLL_CTL_ADD, hListenSocket.socket, &event) != 0) {
+                LogPrintf("Error: epoll_ctl failed for listening socket: %s\n", NetworkErrorString(WSAGetLastError()));
+                return false;
+            }
+        }
+        for (size_t i = 0; i < vSocketThreads.size(); i++) {
+            SocketThread& thread = *vSocketThreads[i];
+            thread.thread = std::thread(&TraceThread<std::function<void()> >, thread.strName.c_str(), std::function<void()>(std::bind(&CConnman::ThreadSocketEvents, this, std::ref(thread), i == 0)));
+        }
+    }
+#endif
+    if (!m_use_epoll)
+        threadSocketHandler = std::thread(&TraceThread<std::function<void()> >, "net", std::function<void()>(std::bind(&CConnman::ThreadSocketHandler, this)));
 
     if (!gArgs.GetBoolArg("-dnsseed", true))
         LogPrintf("DNS seeding disabled\n");
@@ -2270,7 +2643,12 @@ bool CConnman::Start(CScheduler& scheduler, const Options& connOptions)
         threadOpenConnections = std::thread(&TraceThread<std::function<void()> >, "opencon", std::function<void()>(std::bind(&CConnman::ThreadOpenConnections, this, connOptions.m_specified_outgoing)));
 
     // Process messages
-    threadMessageHandler = std::thread(&TraceThread<std::function<void()> >, "msghand", std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this)));
+    for (int i = 0; i < nMessageHandlerThreads; i++) {
+        threadMessageHandlers.emplace_back([this, i] {
+            const std::string name = i == 0 ? "msghand" : strprintf("msghand.%d", i);
+            TraceThread(name.c_str(), std::function<void()>(std::bind(&CConnman::ThreadMessageHandler, this, i)));
+        });
+    }
 
     // Dump network addresses
     scheduler.scheduleEvery(std::bind(&CConnman::DumpAddresses, this), DUMP_PEERS_INTERVAL * 1000);
@@ -2319,8 +2697,11 @@ void CConnman::Interrupt()
 
 void CConnman::Stop()
 {
-    if (threadMessageHandler.joinable())
-        threadMessageHandler.join();
+    for (std::thread& thread : threadMessageHandlers) {
+        if (thread.joinable())
+            thread.join();
+    }
+    threadMessageHandlers.clear();
     if (threadOpenConnections.joinable())
         threadOpenConnections.join();
     if (threadOpenAddedConnections.joinable())
@@ -2329,6 +2710,12 @@ void CConnman::Stop()
         threadDNSAddressSeed.join();
     if (threadSocketHandler.joinable())
         threadSocketHandler.join();
+#ifdef USE_EPOLL
+    for (const auto& thread : vSocketThreads) {
+        if (thread->thread.joinable())
+            thread->thread.join();
+    }
+#endif
 
     if (fAddressesInitialized)
     {
@@ -2343,6 +2730,15 @@ void CConnman::Stop()
         if (hListenSocket.socket != INVALID_SOCKET)
             if (!CloseSocket(hListenSocket.socket))
                 LogPrintf("CloseSocket(hListenSocket) failed with error %s\n", NetworkErrorString(WSAGetLastError()));
+#ifdef USE_EPOLL
+    // After the sockets, which leave their epoll instances as they close.
+    // Nodes are all deleted below regardless of their references.
+    for (const auto& thread : vSocketThreads) {
+        if (thread->epollfd >= 0)
+            close(thread->epollfd);
+    }
+    vSocketThreads.clear();
+#endif
 
     // clean up some globals (to help leak detection)
     for (CNode *pnode : vNodes) {
@@ -2656,19 +3052,35 @@ bool CConnman::NodeFullyConnected(const CNode* pnode)
     return pnode && pnode->fSuccessfullyConnected && !pnode->fDisconnect;
 }
 
+CSharedNetMsgPayload::CSharedNetMsgPayload(std::vector<unsigned char>&& dataIn) :
+    data(std::move(dataIn)), bytes(MakeSpan(data)), hash(Hash(bytes.begin(), bytes.end()))
+{
+}
+
+CSharedNetMsgPayload::CSharedNetMsgPayload(Span<const unsigned char> bytesIn, std::shared_ptr<const void> ownerIn) :
+    owner(std::move(ownerIn)), bytes(bytesIn), hash(Hash(bytes.begin(), bytes.end()))
+{
+}
+
 void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
 {
-    size_t nMessageSize = msg.data.size();
+    CSendQueueMsg queued;
+    queued.data = std::move(msg.data);
+    queued.shared_data = std::move(msg.shared_data);
+    const Span<const unsigned char> payload = queued.GetPayload();
+    size_t nMessageSize = payload.size();
     size_t nTotalSize = nMessageSize + CMessageHeader::HEADER_SIZE;
     LogPrint(BCLog::NET, "sending %s (%d bytes) peer=%d\n",  SanitizeString(msg.command.c_str()), nMessageSize, pnode->GetId());
 
-    std::vector<unsigned char> serializedHeader;
-    serializedHeader.reserve(CMessageHeader::HEADER_SIZE);
-    uint256 hash = Hash(msg.data.data(), msg.data.data() + nMessageSize);
+    uint256 hash = queued.shared_data ? queued.shared_data->hash : Hash(payload.begin(), payload.end());
     CMessageHeader hdr(Params().MessageStart(), msg.command.c_str(), nMessageSize);
     memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
 
-    CVectorWriter{SER_NETWORK, INIT_PROTO_VERSION, serializedHeader, 0, hdr};
+    // Serialize the header in place (see CMessageHeader::SerializationOp)
+    memcpy(queued.hdr, hdr.pchMessageStart, CMessageHeader::MESSAGE_START_SIZE);
+    memcpy(queued.hdr + CMessageHeader::MESSAGE_START_SIZE, hdr.pchCommand, CMessageHeader::COMMAND_SIZE);
+    WriteLE32(queued.hdr + CMessageHeader::MESSAGE_SIZE_OFFSET, hdr.nMessageSize);
+    memcpy(queued.hdr + CMessageHeader::CHECKSUM_OFFSET, hdr.pchChecksum, CMessageHeader::CHECKSUM_SIZE);
 
     size_t nBytesSent = 0;
     {
@@ -2681,9 +3093,7 @@ void CConnman::PushMessage(CNode* pnode, CSerializedNetMsg&& msg)
 
         if (pnode->nSendSize > nSendBufferMaxSize)
             pnode->fPauseSend = true;
-        pnode->vSendMsg.push_back(std::move(serializedHeader));
-        if (nMessageSize)
-            pnode->vSendMsg.push_back(std::move(msg.data));
+        pnode->vSendMsg.push_back(std::move(queued));
 
         // If write queue empty, attempt "optimistic write"
         if (optimisticSend == true)
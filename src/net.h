@@ -18,6 +18,7 @@
 #include <policy/feerate.h>
 #include <protocol.h>
 #include <random.h>
+#include <span.h>
 #include <streams.h>
 #include <sync.h>
 #include <uint256.h>
@@ -81,6 +82,16 @@ static const int64_t DEFAULT_PEER_CONNECT_TIMEOUT = 60;
 static const bool DEFAULT_FORCEDNSSEED = false;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
 static const size_t DEFAULT_MAXSENDBUFFER    = 1 * 1000;
+/** -epoll default */
+static const bool DEFAULT_USE_EPOLL = true;
+/** -socketthreads default */
+static const int DEFAULT_SOCKET_THREADS = 1;
+/** Maximum number of threads serving peer sockets */
+static const int MAX_SOCKET_THREADS = 16;
+/** -msghandlerthreads default */
+static const int DEFAULT_MSGHANDLER_THREADS = 1;
+/** Maximum number of threads processing peer messages */
+static const int MAX_MSGHANDLER_THREADS = 16;
 
 typedef int64_t NodeId;
 
@@ -95,6 +106,27 @@ struct AddedNodeInfo
 class CNodeStats;
 class CClientUIInterface;
 
+/**
+ * A message payload serialized (and checksummed) once, to be sent to any
+ * number of peers. Their send queues all refer to the same buffer.
+ */
+struct CSharedNetMsgPayload
+{
+    explicit CSharedNetMsgPayload(std::vector<unsigned char>&& dataIn);
+    //! A payload in memory that owner keeps alive, such as a mapped block file, sent without copying it
+    CSharedNetMsgPayload(Span<const unsigned char> bytesIn, std::shared_ptr<const void> ownerIn);
+    // No copying or moving, as bytes may point into data: share it through a shared_ptr.
+    CSharedNetMsgPayload(const CSharedNetMsgPayload&) = delete;
+    CSharedNetMsgPayload(CSharedNetMsgPayload&&) = delete;
+    CSharedNetMsgPayload& operator=(const CSharedNetMsgPayload&) = delete;
+    CSharedNetMsgPayload& operator=(CSharedNetMsgPayload&&) = delete;
+
+    const std::vector<unsigned char> data; // empty if the payload belongs to owner
+    const std::shared_ptr<const void> owner;
+    const Span<const unsigned char> bytes; // the payload, in data or owned by owner
+    const uint256 hash; // Hash() of bytes
+};
+
 struct CSerializedNetMsg
 {
     CSerializedNetMsg() = default;
@@ -105,9 +137,21 @@ struct CSerializedNetMsg
     CSerializedNetMsg& operator=(const CSerializedNetMsg&) = delete;
 
     std::vector<unsigned char> data;
+    std::shared_ptr<const CSharedNetMsgPayload> shared_data; // sent instead of data if set
     std::string command;
 };
 
+/** A message in a peer's send queue: its header, and its payload owned or shared. */
+struct CSendQueueMsg
+{
+    unsigned char hdr[CMessageHeader::HEADER_SIZE];
+    std::vector<unsigned char> data;
+    std::shared_ptr<const CSharedNetMsgPayload> shared_data;
+
+    Span<const unsigned char> GetPayload() const { return shared_data ? shared_data->bytes : MakeSpan(data); }
+    size_t size() const { return CMessageHeader::HEADER_SIZE + GetPayload().size(); }
+};
+
 
 class NetEventsInterface;
 class CConnman
@@ -137,6 +181,9 @@ public:
         uint64_t nMaxOutboundTimeframe = 0;
         uint64_t nMaxOutboundLimit = 0;
         int64_t m_peer_connect_timeout = DEFAULT_PEER_CONNECT_TIMEOUT;
+        bool m_use_epoll = DEFAULT_USE_EPOLL;
+        int nSocketThreads = DEFAULT_SOCKET_THREADS;
+        int nMessageHandlerThreads = DEFAULT_MSGHANDLER_THREADS;
         std::vector<std::string> vSeedNodes;
         std::vector<CSubNet> vWhitelistedRange;
         std::vector<CService> vBinds, vWhiteBinds;
@@ -159,6 +206,11 @@ public:
         nSendBufferMaxSize = connOptions.nSendBufferMaxSize;
         nReceiveFloodSize = connOptions.nReceiveFloodSize;
         m_peer_connect_timeout = connOptions.m_peer_connect_timeout;
+#ifdef USE_EPOLL
+        m_use_epoll = connOptions.m_use_epoll;
+#endif
+        nSocketThreads = std::max(1, std::min(connOptions.nSocketThreads, MAX_SOCKET_THREADS));
+        nMessageHandlerThreads = std::max(1, std::min(connOptions.nMessageHandlerThreads, MAX_MSGHANDLER_THREADS));
         {
             LOCK(cs_totalBytesSent);
             nMaxOutboundTimeframe = connOptions.nMaxOutboundTimeframe;
@@ -327,7 +379,13 @@ private:
     void AddOneShot(const std::string& strDest);
     void ProcessOneShot();
     void ThreadOpenConnections(std::vector<std::string> connect);
-    void ThreadMessageHandler();
+    void ThreadMessageHandler(int nThread);
+    /**
+     * Wait up to timeout for a wakeup after the nWakesSeen counted so far,
+     * then count those. Each thread keeps its own count, so none can take a
+     * wakeup from another. Returns whether there was one.
+     */
+    bool WaitForMessageHandlerWake(uint64_t& nWakesSeen, std::chrono::milliseconds timeout);
     void AcceptConnection(const ListenSocket& hListenSocket);
     void DisconnectNodes();
     void NotifyNumConnectionsChanged();
@@ -336,6 +394,37 @@ private:
     void SocketEvents(std::set<SOCKET> &recv_set, std::set<SOCKET> &send_set, std::set<SOCKET> &error_set);
     void SocketHandler();
     void ThreadSocketHandler();
+#ifdef USE_EPOLL
+    /**
+     * A thread sending and receiving for a share of the peers (by NodeId),
+     * and the first one also accepting connections. Sockets stay registered
+     * with its epoll instance, edge-triggered, for as long as they are open.
+     */
+    struct SocketThread
+    {
+        int epollfd{-1};
+        std::string strName;
+        std::thread thread;
+
+        Mutex cs;
+        //! Nodes to register, each with a reference held
+        std::vector<CNode*> vNodesNew GUARDED_BY(cs);
+
+        //! Used only by the thread: the registered nodes, each with a reference held
+        std::vector<CNode*> vNodes;
+        //! Used only by the thread: the registered nodes not waiting to receive (see UpdateSocketEvents())
+        std::set<CNode*> setNodesPaused;
+    };
+
+    //! Hand a new node to its socket thread, before it is added to vNodes.
+    void AddSocketNode(CNode* pnode);
+    //! Register for receiving only while the node is paused neither way, when that changed.
+    void UpdateSocketEvents(SocketThread& thread, CNode* pnode);
+    void ServiceSocketEvents(SocketThread& thread, CNode* pnode, uint32_t events);
+    void ThreadSocketEvents(SocketThread& thread, bool fFirst);
+#endif
+    //! Receive what waits on the socket, up to one buffer. Returns whether it filled the buffer, so more may wait.
+    bool SocketRecvData(CNode* pnode);
     void ThreadDNSAddressSeed();
 
     uint64_t CalculateKeyedNetGroup(const CAddress& ad) const;
@@ -408,6 +497,10 @@ private:
     int nMaxOutbound;
     int nMaxAddnode;
     int nMaxFeeler;
+    //! Serve the sockets from the epoll socket threads rather than ThreadSocketHandler()
+    bool m_use_epoll{false};
+    int nSocketThreads;
+    int nMessageHandlerThreads;
     bool m_use_addrman_outgoing;
     std::atomic<int> nBestHeight;
     CClientUIInterface* clientInterface;
@@ -417,8 +510,8 @@ private:
     /** SipHasher seeds for deterministic randomness */
     const uint64_t nSeed0, nSeed1;
 
-    /** flag for waking the message processor. */
-    bool fMsgProcWake;
+    /** number of times the message processors were woken */
+    uint64_t nMsgProcWakes{0};
 
     std::condition_variable condMsgProc;
     Mutex mutexMsgProc;
@@ -428,9 +521,12 @@ private:
 
     std::thread threadDNSAddressSeed;
     std::thread threadSocketHandler;
+#ifdef USE_EPOLL
+    std::vector<std::unique_ptr<SocketThread>> vSocketThreads;
+#endif
     std::thread threadOpenAddedConnections;
     std::thread threadOpenConnections;
-    std::thread threadMessageHandler;
+    std::vector<std::thread> threadMessageHandlers;
 
     /** flag for deciding to connect to an extra outbound peer,
      *  in excess of nMaxOutbound
@@ -571,14 +667,43 @@ public:
 
 
 
+/**
+ * Keeps the buffers of received messages for reuse, so that the many small
+ * ones (inv, tx, ...) do not each allocate and free their own. Buffers are
+ * kept by size class, powers of two from 256 bytes to MAX_BUFFER_SIZE, with
+ * up to MAX_CLASS_BYTES in each class.
+ */
+class CNetMessageBufferPool
+{
+private:
+    static const unsigned int MIN_CLASS_BITS = 8;
+    static const unsigned int MAX_CLASS_BITS = 18;
+    static const size_t MAX_CLASS_BYTES = 1 << 20;
+
+    Mutex cs;
+    std::vector<CSerializeData> vFree[MAX_CLASS_BITS - MIN_CLASS_BITS + 1] GUARDED_BY(cs);
+
+public:
+    static const size_t MAX_BUFFER_SIZE = size_t{1} << MAX_CLASS_BITS;
+
+    //! An empty buffer with room for nSize (at most MAX_BUFFER_SIZE) bytes
+    CSerializeData Get(size_t nSize);
+    //! Keep a buffer for reuse, unless it fits no class or its class is full
+    void Put(CSerializeData&& buffer);
+};
+
 class CNetMessage {
 private:
     mutable CHash256 hasher;
     mutable uint256 data_hash;
+
+    //! Make room for the first nSize bytes of data
+    void ReserveData(unsigned int nSize);
+
 public:
     bool in_data;                   // parsing header (false) or data (true)
 
-    CDataStream hdrbuf;             // partially received header
+    unsigned char hdrbuf[CMessageHeader::HEADER_SIZE]; // partially received header
     CMessageHeader hdr;             // complete header
     unsigned int nHdrPos;
 
@@ -587,13 +712,16 @@ public:
 
     int64_t nTime;                  // time (in microseconds) of message receipt.
 
-    CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdrbuf(nTypeIn, nVersionIn), hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
-        hdrbuf.resize(24);
+    CNetMessage(const CMessageHeader::MessageStartChars& pchMessageStartIn, int nTypeIn, int nVersionIn) : hdr(pchMessageStartIn), vRecv(nTypeIn, nVersionIn) {
         in_data = false;
         nHdrPos = 0;
         nDataPos = 0;
         nTime = 0;
     }
+    CNetMessage(CNetMessage&&) = default;
+    CNetMessage& operator=(CNetMessage&&) = default;
+    //! Returns the data buffer to the pool it came from, if any.
+    ~CNetMessage();
 
     bool complete() const
     {
@@ -606,10 +734,16 @@ public:
 
     void SetVersion(int nVersionIn)
     {
-        hdrbuf.SetVersion(nVersionIn);
         vRecv.SetVersion(nVersionIn);
     }
 
+    /**
+     * Where to receive the next nBytes of data in place, if this message is
+     * receiving data and at least nMinBytes of it remain (nBytes may be fewer
+     * than that). Pass the same pointer to readData() once they are received.
+     */
+    char* GetDataBuffer(unsigned int nMinBytes, unsigned int& nBytes);
+
     int readHeader(const char *pch, unsigned int nBytes);
     int readData(const char *pch, unsigned int nBytes);
 };
@@ -626,7 +760,7 @@ public:
     size_t nSendSize{0}; // total size of all vSendMsg entries
     size_t nSendOffset{0}; // offset inside the first vSendMsg already sent
     uint64_t nSendBytes GUARDED_BY(cs_vSend){0};
-    std::deque<std::vector<unsigned char>> vSendMsg GUARDED_BY(cs_vSend);
+    std::deque<CSendQueueMsg> vSendMsg GUARDED_BY(cs_vSend);
     CCriticalSection cs_vSend;
     CCriticalSection cs_hSocket;
     CCriticalSection cs_vRecv;
@@ -682,6 +816,10 @@ public:
     const uint64_t nKeyedNetGroup;
     std::atomic_bool fPauseRecv{false};
     std::atomic_bool fPauseSend{false};
+    // Used only by the socket thread: the epoll events the socket is registered for
+    uint32_t nSocketEvents{0};
+    // The epoll instance the socket is registered with, or -1
+    int nSocketEpollFd GUARDED_BY(cs_hSocket){-1};
 
 protected:
     mapMsgCmdSize mapSendBytesPerMsgCmd;
@@ -692,8 +830,10 @@ public:
     std::atomic<int> nStartingHeight{-1};
 
     // flood relay
-    std::vector<CAddress> vAddrToSend;
-    CRollingBloomFilter addrKnown;
+    // Addresses are pushed by the message handler threads of other peers too
+    CCriticalSection cs_vAddrToSend;
+    std::vector<CAddress> vAddrToSend GUARDED_BY(cs_vAddrToSend);
+    CRollingBloomFilter addrKnown GUARDED_BY(cs_vAddrToSend);
     bool fGetAddr{false};
     std::set<uint256> setKnown;
     int64_t nNextAddrSend GUARDED_BY(cs_sendProcessing){0};
@@ -780,6 +920,8 @@ public:
     }
 
     bool ReceiveMsgBytes(const char *pch, unsigned int nBytes, bool& complete);
+    //! Where to receive the rest of a large message straight into (see CNetMessage::GetDataBuffer()), if one is being received.
+    char* GetRecvBuffer(unsigned int& nBytes);
 
     void SetRecvVersion(int nVersionIn)
     {
@@ -811,6 +953,7 @@ public:
 
     void AddAddressKnown(const CAddress& _addr)
     {
+        LOCK(cs_vAddrToSend);
         addrKnown.insert(_addr.GetKey());
     }
 
@@ -819,6 +962,7 @@ public:
         // Known checking here is only to save space from duplicates.
         // SendMessages will filter it again for knowns that were added
         // after addresses were pushed.
+        LOCK(cs_vAddrToSend);
         if (_addr.IsValid() && !addrKnown.contains(_addr.GetKey())) {
             if (vAddrToSend.size() >= MAX_ADDR_TO_SEND) {
                 vAddrToSend[insecure_rand.randrange(vAddrToSend.size())] = _addr;
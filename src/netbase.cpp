@@ -462,6 +462,8 @@ SOCKET CreateSocket(const CService &addrConnect)
         return INVALID_SOCKET;
     }
 
+    SetSocketCloseOnExec(hSocket);
+
 #ifdef SO_NOSIGPIPE
     int set = 1;
     // Different way of disabling SIGPIPE on BSD
@@ -748,6 +750,16 @@ bool SetSocketNoDelay(const SOCKET& hSocket)
     return rc == 0;
 }
 
+bool SetSocketCloseOnExec(const SOCKET& hSocket)
+{
+#ifdef WIN32
+    return SetHandleInformation((HANDLE)hSocket, HANDLE_FLAG_INHERIT, 0) != 0;
+#else
+    int fFlags = fcntl(hSocket, F_GETFD, 0);
+    return fFlags != -1 && fcntl(hSocket, F_SETFD, fFlags | FD_CLOEXEC) != -1;
+#endif
+}
+
 void InterruptSocks5(bool interrupt)
 {
     interruptSocks5Recv = interrupt;
@@ -29,6 +29,23 @@ public:
         return Make(0, std::move(sCommand), std::forward<Args>(args)...);
     }
 
+    //! Serialize a payload once, to send to any number of peers with MakeShared()
+    template <typename... Args>
+    std::shared_ptr<const CSharedNetMsgPayload> Serialize(int nFlags, Args&&... args) const
+    {
+        std::vector<unsigned char> data;
+        CVectorWriter{ SER_NETWORK, nFlags | nVersion, data, 0, std::forward<Args>(args)... };
+        return std::make_shared<const CSharedNetMsgPayload>(std::move(data));
+    }
+
+    static CSerializedNetMsg MakeShared(std::string sCommand, std::shared_ptr<const CSharedNetMsgPayload> payload)
+    {
+        CSerializedNetMsg msg;
+        msg.command = std::move(sCommand);
+        msg.shared_data = std::move(payload);
+        return msg;
+    }
+
 private:
     const int nVersion;
 };
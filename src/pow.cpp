@@ -23,6 +23,27 @@ uint32_t GetNextTargetRequired(const CBlockIndex* pindexLast, const CBlockHeader
     return GetNextTargetRequiredV2(pindexLast, pblock, params, fProofOfStake);
 }
 
+uint32_t GetNextTargetRequired(const CBlockIndex* pindexLast, const CBlockHeader* pblock, const Consensus::Params& params, bool fProofOfStake, TargetCache& cache)
+{
+    NextTargets::Kind kind = NextTargets::POW;
+    if (fProofOfStake)
+        kind = params.IsFlashStake(pblock->nTime) ? NextTargets::FPOS : NextTargets::POS;
+
+    if (cache.targets.size() >= TargetCache::MAX_PARENTS && !cache.targets.count(pindexLast))
+        cache.Clear();
+    NextTargets& targets = cache.targets[pindexLast];
+    if (!targets.fHave[kind]) {
+        targets.nBits[kind] = GetNextTargetRequired(pindexLast, pblock, params, fProofOfStake);
+        targets.fHave[kind] = true;
+    }
+    return targets.nBits[kind];
+}
+
+void TargetCache::Clear()
+{
+    targets.clear();
+}
+
 uint32_t GetNextTargetRequiredV1(const CBlockIndex* pindexLast, const CBlockHeader* pblock, const Consensus::Params& params, bool fProofOfStake)
 {
     assert(pindexLast != nullptr);
@@ -8,6 +8,7 @@
 
 #include <consensus/params.h>
 
+#include <map>
 #include <stdint.h>
 
 class CBlockHeader;
@@ -19,6 +20,33 @@ uint32_t GetNextTargetRequired(const CBlockIndex* pindexLast, const CBlockHeader
 uint32_t GetNextTargetRequiredV1(const CBlockIndex* pindexLast, const CBlockHeader* pblock, const Consensus::Params& params, bool fProofOfStake);
 uint32_t GetNextTargetRequiredV2(const CBlockIndex* pindexLast, const CBlockHeader* pblock, const Consensus::Params& params, bool fProofOfStake);
 
+/** Expected nBits of one parent's children, for every kind of child block. */
+struct NextTargets
+{
+    enum Kind { POW, POS, FPOS, NUM_KINDS };
+    uint32_t nBits[NUM_KINDS];
+    bool fHave[NUM_KINDS] = {};
+};
+
+/**
+ * Per-parent memo of GetNextTargetRequired. A child's target only depends
+ * on its parent, on whether it is PoW or PoS and, for PoS, on whether its
+ * timestamp falls in a flash stake window, so competing child headers
+ * share one computation.
+ */
+struct TargetCache
+{
+    //! Entries are cheap to recompute, so the map is emptied when it grows past this.
+    static const size_t MAX_PARENTS = 4096;
+
+    std::map<const CBlockIndex*, NextTargets> targets;
+
+    void Clear();
+};
+
+/** GetNextTargetRequired, memoized in cache. */
+uint32_t GetNextTargetRequired(const CBlockIndex* pindexLast, const CBlockHeader* pblock, const Consensus::Params& params, bool fProofOfStake, TargetCache& cache);
+
 // [PINK] Replace it and remove
 unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHeader *pblock, const Consensus::Params&);
 unsigned int CalculateNextWorkRequired(const CBlockIndex* pindexLast, int64_t nFirstBlockTime, const Consensus::Params&);
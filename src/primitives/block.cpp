@@ -11,6 +11,42 @@
 #include <crypto/common.h>
 #include <crypto/scrypt.h>
 
+#include <string.h>
+
+static std::atomic<bool> g_block_hash_cache{true};
+static std::atomic<uint64_t> g_block_hash_count{0};
+
+void SetBlockHashCache(bool enabled)
+{
+    g_block_hash_cache = enabled;
+}
+
+uint64_t GetBlockHashCount()
+{
+    return g_block_hash_count.load();
+}
+
+CBlockHeader& CBlockHeader::operator=(const CBlockHeader& other)
+{
+    if (this == &other) {
+        return *this;
+    }
+    nVersion = other.nVersion;
+    hashPrevBlock = other.hashPrevBlock;
+    hashMerkleRoot = other.hashMerkleRoot;
+    nTime = other.nTime;
+    nBits = other.nBits;
+    nNonce = other.nNonce;
+    if (other.m_hash_state.load(std::memory_order_acquire) == HASH_CACHED) {
+        memcpy(m_hash_header, other.m_hash_header, HEADER_SIZE);
+        m_hash = other.m_hash;
+        m_hash_state.store(HASH_CACHED, std::memory_order_release);
+    } else {
+        InvalidateHash();
+    }
+    return *this;
+}
+
 uint256 CBlockHeader::GetHash() const
 {
     // [PINK] https://github.com/Pink2Dev/Pink2/blob/2.2.3.0/src/main.h#L911
@@ -18,9 +54,65 @@ uint256 CBlockHeader::GetHash() const
 }
 
 uint256 CBlockHeader::GetPoWHash() const
+{
+    if (m_hash_state.load(std::memory_order_acquire) == HASH_CACHED && memcmp(m_hash_header, begin(), HEADER_SIZE) == 0) {
+        return m_hash;
+    }
+
+    uint256 thash = ComputePoWHash();
+    PublishHash(thash);
+    return thash;
+}
+
+void CBlockHeader::PublishHash(const uint256& hash) const
+{
+    if (!g_block_hash_cache) {
+        return;
+    }
+
+    // Only one thread publishes the result; concurrent callers just return
+    // their own copy. A stale entry (header changed since) is overwritten.
+    uint8_t state = m_hash_state.load(std::memory_order_relaxed);
+    if (state != HASH_WRITING && m_hash_state.compare_exchange_strong(state, HASH_WRITING)) {
+        memcpy(m_hash_header, begin(), HEADER_SIZE);
+        m_hash = hash;
+        m_hash_state.store(HASH_CACHED, std::memory_order_release);
+    }
+}
+
+void CBlockHeader::MemoizeHashes(const CBlockHeader* const* headers, size_t n)
+{
+    const char* inputs[SCRYPT_MAX_LANES];
+    char* outputs[SCRYPT_MAX_LANES];
+    const CBlockHeader* pending[SCRYPT_MAX_LANES];
+    uint256 hashes[SCRYPT_MAX_LANES];
+
+    size_t i = 0;
+    while (i < n) {
+        size_t count = 0;
+        for (; i < n && count < SCRYPT_MAX_LANES; ++i) {
+            const CBlockHeader* header = headers[i];
+            if (header->m_hash_state.load(std::memory_order_acquire) == HASH_CACHED && memcmp(header->m_hash_header, header->begin(), HEADER_SIZE) == 0) {
+                continue;
+            }
+            pending[count] = header;
+            inputs[count] = header->begin();
+            outputs[count] = (char*)hashes[count].begin();
+            ++count;
+        }
+        scrypt_1024_1_1_256_multi(inputs, outputs, count);
+        g_block_hash_count += count;
+        for (size_t j = 0; j < count; ++j) {
+            pending[j]->PublishHash(hashes[j]);
+        }
+    }
+}
+
+uint256 CBlockHeader::ComputePoWHash() const
 {
     uint256 thash;
     scrypt_1024_1_1_256(begin(), (char*)thash.begin());
+    ++g_block_hash_count;
     return thash;
 }
 
@@ -10,6 +10,8 @@
 #include <serialize.h>
 #include <uint256.h>
 
+#include <atomic>
+
 /** Nodes collect new transactions into a block, hash them into a hash tree,
  * and scan through nonce values to make the block's hash satisfy proof-of-work
  * requirements.  When they solve the proof-of-work, they broadcast the block
@@ -28,11 +30,21 @@ public:
     uint32_t nBits;
     uint32_t nNonce;
 
+    /** Size of the serialized header, i.e. the scrypt input starting at begin(). */
+    static const size_t HEADER_SIZE = 80;
+
     CBlockHeader()
     {
         SetNull();
     }
 
+    CBlockHeader(const CBlockHeader& other)
+    {
+        *this = other;
+    }
+
+    CBlockHeader& operator=(const CBlockHeader& other);
+
     ADD_SERIALIZE_METHODS;
 
     template <typename Stream, typename Operation>
@@ -53,6 +65,7 @@ public:
         nTime = 0;
         nBits = 0;
         nNonce = 0;
+        InvalidateHash();
     }
 
     bool IsNull() const
@@ -60,10 +73,29 @@ public:
         return (nBits == 0);
     }
 
+    /**
+     * Block hash. The scrypt result is memoized together with the header
+     * bytes it was computed from, so repeated calls only rehash once a
+     * header field has changed. Code that grinds header fields (nonce,
+     * time, merkle root) should call InvalidateHash() after each change.
+     */
     uint256 GetHash() const;
 
     uint256 GetPoWHash() const;
 
+    /**
+     * Compute and memoize the hashes of several headers at once, using the
+     * multi-lane scrypt kernels where available. Headers whose hash is
+     * already memoized are skipped.
+     */
+    static void MemoizeHashes(const CBlockHeader* const* headers, size_t n);
+
+    /** Drop the memoized hash. */
+    void InvalidateHash()
+    {
+        m_hash_state.store(HASH_EMPTY, std::memory_order_relaxed);
+    }
+
     int64_t GetBlockTime() const
     {
         return (int64_t)nTime;
@@ -75,8 +107,25 @@ public:
     {
         return ((char*)&(nVersion));
     }
+
+private:
+    enum : uint8_t { HASH_EMPTY, HASH_WRITING, HASH_CACHED };
+
+    // memory only
+    mutable std::atomic<uint8_t> m_hash_state{HASH_EMPTY};
+    mutable unsigned char m_hash_header[HEADER_SIZE];
+    mutable uint256 m_hash;
+
+    uint256 ComputePoWHash() const;
+    void PublishHash(const uint256& hash) const;
 };
 
+/** Enable or disable memoization of block header hashes (enabled by default). */
+void SetBlockHashCache(bool enabled);
+
+/** Number of scrypt block header hashes computed since startup. */
+uint64_t GetBlockHashCount();
+
 
 class CBlock : public CBlockHeader
 {
@@ -123,14 +172,8 @@ public:
 
     CBlockHeader GetBlockHeader() const
     {
-        CBlockHeader block;
-        block.nVersion       = nVersion;
-        block.hashPrevBlock  = hashPrevBlock;
-        block.hashMerkleRoot = hashMerkleRoot;
-        block.nTime          = nTime;
-        block.nBits          = nBits;
-        block.nNonce         = nNonce;
-        return block;
+        // Slicing copy, which carries the memoized hash along
+        return *this;
     }
 
     // [PINK] https://github.com/Pink2Dev/Pink2/blob/2.2.3.0/src/main.h#L938
@@ -11,6 +11,8 @@
 #include <util/time.h>
 #include <util/strencodings.h>
 
+#include <thread>
+
 std::string COutPoint::ToString() const
 {
     return strprintf("COutPoint(%s, %u)", hash.ToString().substr(0,10), n);
@@ -77,10 +79,31 @@ uint256 CTransaction::ComputeWitnessHash() const
     return SerializeHash(*this, SER_GETHASH, 0);
 }
 
+void CTransaction::ComputeHashes() const
+{
+    // Only one thread computes the hashes. As callers keep references to
+    // them, concurrent callers wait until they are published.
+    uint8_t state = HASH_EMPTY;
+    if (m_hash_state.compare_exchange_strong(state, HASH_WRITING)) {
+        hash = ComputeHash();
+        m_witness_hash = ComputeWitnessHash();
+        m_hash_state.store(HASH_CACHED, std::memory_order_release);
+        return;
+    }
+    while (m_hash_state.load(std::memory_order_acquire) != HASH_CACHED) {
+        std::this_thread::yield();
+    }
+}
+
 /* For backward compatibility, the hash is initialized to 0. TODO: remove the need for this default constructor entirely. */
-CTransaction::CTransaction() : vin(), vout(), nVersion(CTransaction::CURRENT_VERSION), nTime(GetAdjustedTime()), nLockTime(0), hash{}, m_witness_hash{} {}
-CTransaction::CTransaction(const CMutableTransaction& tx) : vin(tx.vin), vout(tx.vout), nVersion(tx.nVersion), nTime(tx.nTime), nLockTime(tx.nLockTime), hash{ComputeHash()}, m_witness_hash{ComputeWitnessHash()} {}
-CTransaction::CTransaction(CMutableTransaction&& tx) : vin(std::move(tx.vin)), vout(std::move(tx.vout)), nVersion(tx.nVersion), nTime(tx.nTime), nLockTime(tx.nLockTime), hash{ComputeHash()}, m_witness_hash{ComputeWitnessHash()} {}
+CTransaction::CTransaction() : vin(), vout(), nVersion(CTransaction::CURRENT_VERSION), nTime(GetAdjustedTime()), nLockTime(0), hash{}, m_witness_hash{}, m_hash_state{HASH_CACHED} {}
+CTransaction::CTransaction(const CMutableTransaction& tx) : vin(tx.vin), vout(tx.vout), nVersion(tx.nVersion), nTime(tx.nTime), nLockTime(tx.nLockTime), hash{ComputeHash()}, m_witness_hash{ComputeWitnessHash()}, m_hash_state{HASH_CACHED} {}
+CTransaction::CTransaction(CMutableTransaction&& tx) : CTransaction(std::move(tx), false) {}
+CTransaction::CTransaction(CMutableTransaction&& tx, bool fDeferHash) : vin(std::move(tx.vin)), vout(std::move(tx.vout)), nVersion(tx.nVersion), nTime(tx.nTime), nLockTime(tx.nLockTime), hash{}, m_witness_hash{}, m_hash_state{HASH_EMPTY}
+{
+    if (!fDeferHash) ComputeHashes();
+}
+CTransaction::CTransaction(const CTransaction& tx) : vin(tx.vin), vout(tx.vout), nVersion(tx.nVersion), nTime(tx.nTime), nLockTime(tx.nLockTime), hash{tx.GetHash()}, m_witness_hash{tx.GetWitnessHash()}, m_hash_state{HASH_CACHED} {}
 
 CAmount CTransaction::GetValueOut() const
 {
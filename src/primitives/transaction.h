@@ -7,12 +7,15 @@
 #define BITCOIN_PRIMITIVES_TRANSACTION_H
 
 #include <stdint.h>
+#include <atomic>
 #include <amount.h>
 #include <script/script.h>
 #include <serialize.h>
 #include <uint256.h>
 
 static const int SERIALIZE_TRANSACTION_NO_WITNESS = 0x40000000;
+/** Deserialize transactions without computing their hashes, see CTransaction::MemoizeHashes(). */
+static const int SERIALIZE_TRANSACTION_DEFER_HASH = 0x20000000;
 
 /** An outpoint - a combination of a transaction hash and an index n into its vout */
 class COutPoint
@@ -307,12 +310,18 @@ public:
     const uint32_t nLockTime;
 
 private:
-    /** Memory only. */
-    const uint256 hash;
-    const uint256 m_witness_hash;
+    enum : uint8_t { HASH_EMPTY, HASH_WRITING, HASH_CACHED };
+
+    /** Memory only. Written once, on construction or by MemoizeHashes(). */
+    mutable uint256 hash;
+    mutable uint256 m_witness_hash;
+    mutable std::atomic<uint8_t> m_hash_state;
 
     uint256 ComputeHash() const;
     uint256 ComputeWitnessHash() const;
+    void ComputeHashes() const;
+
+    CTransaction(CMutableTransaction &&tx, bool fDeferHash);
 
 public:
     /** Construct a CTransaction that qualifies as IsNull() */
@@ -321,6 +330,7 @@ public:
     /** Convert a CMutableTransaction into a CTransaction. */
     explicit CTransaction(const CMutableTransaction &tx);
     CTransaction(CMutableTransaction &&tx);
+    CTransaction(const CTransaction &tx);
 
     template <typename Stream>
     inline void Serialize(Stream& s) const {
@@ -330,14 +340,28 @@ public:
     /** This deserializing constructor is provided instead of an Unserialize method.
      *  Unserialize is not possible, since it would require overwriting const fields. */
     template <typename Stream>
-    CTransaction(deserialize_type, Stream& s) : CTransaction(CMutableTransaction(deserialize, s)) {}
+    CTransaction(deserialize_type, Stream& s) : CTransaction(CMutableTransaction(deserialize, s), s.GetVersion() & SERIALIZE_TRANSACTION_DEFER_HASH) {}
 
     bool IsNull() const {
         return vin.empty() && vout.empty();
     }
 
-    const uint256& GetHash() const { return hash; }
-    const uint256& GetWitnessHash() const { return m_witness_hash; };
+    const uint256& GetHash() const { MemoizeHashes(); return hash; }
+    const uint256& GetWitnessHash() const { MemoizeHashes(); return m_witness_hash; };
+
+    /**
+     * Compute the txid and wtxid of a transaction deserialized with
+     * SERIALIZE_TRANSACTION_DEFER_HASH, unless that already happened. This
+     * lets whoever validates a block hash its transactions in bulk (see
+     * CheckBlock()); other callers compute them on first use. Thread-safe.
+     */
+    void MemoizeHashes() const
+    {
+        if (m_hash_state.load(std::memory_order_acquire) != HASH_CACHED) ComputeHashes();
+    }
+
+    //! Whether the hashes are computed, see MemoizeHashes().
+    bool HasHashes() const { return m_hash_state.load(std::memory_order_acquire) == HASH_CACHED; }
 
     // Return sum of txouts.
     CAmount GetValueOut() const;
@@ -366,12 +390,12 @@ public:
 
     friend bool operator==(const CTransaction& a, const CTransaction& b)
     {
-        return a.hash == b.hash;
+        return a.GetHash() == b.GetHash();
     }
 
     friend bool operator!=(const CTransaction& a, const CTransaction& b)
     {
-        return a.hash != b.hash;
+        return a.GetHash() != b.GetHash();
     }
 
     std::string ToString() const;
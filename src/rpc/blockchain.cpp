@@ -11,8 +11,10 @@
 #include <chainparams.h>
 #include <checkpoints.h>
 #include <coins.h>
+#include <coinssnapshot.h>
 #include <consensus/validation.h>
 #include <core_io.h>
+#include <dbwrapper.h>
 #include <hash.h>
 #include <index/txindex.h>
 #include <key_io.h>
@@ -1117,8 +1119,6 @@ UniValue gettxout(const JSONRPCRequest& request)
                 },
             }.ToString());
 
-    LOCK(cs_main);
-
     UniValue ret(UniValue::VOBJ);
 
     uint256 hash(ParseHashV(request.params[0], "txid"));
@@ -1129,24 +1129,38 @@ UniValue gettxout(const JSONRPCRequest& request)
         fMempool = request.params[2].get_bool();
 
     Coin coin;
-    if (fMempool) {
-        LOCK(mempool.cs);
-        CCoinsViewMemPool view(pcoinsTip.get(), mempool);
-        if (!view.GetCoin(out, coin) || mempool.isSpent(out)) {
+    auto lookup = [&](CCoinsView& base) {
+        if (fMempool) {
+            LOCK(mempool.cs);
+            CCoinsViewMemPool view(&base, mempool);
+            return view.GetCoin(out, coin) && !mempool.isSpent(out);
+        }
+        return base.GetCoin(out, coin);
+    };
+
+    uint256 hashBestBlock;
+    int nBestHeight;
+    if (std::shared_ptr<CCoinsSnapshot> snapshot = g_coins_snapshot.Get()) {
+        if (!lookup(*snapshot)) {
             return NullUniValue;
         }
+        hashBestBlock = snapshot->GetBestBlock();
+        nBestHeight = snapshot->GetHeight();
     } else {
-        if (!pcoinsTip->GetCoin(out, coin)) {
+        LOCK(cs_main);
+        if (!lookup(*pcoinsTip)) {
             return NullUniValue;
         }
+        const CBlockIndex* pindex = LookupBlockIndex(pcoinsTip->GetBestBlock());
+        hashBestBlock = pindex->GetBlockHash();
+        nBestHeight = pindex->nHeight;
     }
 
-    const CBlockIndex* pindex = LookupBlockIndex(pcoinsTip->GetBestBlock());
-    ret.pushKV("bestblock", pindex->GetBlockHash().GetHex());
+    ret.pushKV("bestblock", hashBestBlock.GetHex());
     if (coin.nHeight == MEMPOOL_HEIGHT) {
         ret.pushKV("confirmations", 0);
     } else {
-        ret.pushKV("confirmations", (int64_t)(pindex->nHeight - coin.nHeight + 1));
+        ret.pushKV("confirmations", (int64_t)(nBestHeight - coin.nHeight + 1));
     }
     ret.pushKV("value", ValueFromAmount(coin.out.nValue));
     UniValue o(UniValue::VOBJ);
@@ -1157,6 +1171,79 @@ UniValue gettxout(const JSONRPCRequest& request)
     return ret;
 }
 
+static UniValue getdbstats(const JSONRPCRequest& request)
+{
+    if (request.fHelp || !request.params.empty())
+        throw std::runtime_error(
+            RPCHelpMan{"getdbstats",
+                "\nReturns statistics about the LevelDB databases (chainstate, block index and indexes).\n",
+                {},
+                RPCResult{
+            "{\n"
+            "  \"name\": {                     (json object) the database, by the name of its directory\n"
+            "    \"profile\": {                (json object) the settings in use, see -dbprofile\n"
+            "      \"block_cache_percent\": n,  (numeric) share of the cache used for the block cache\n"
+            "      \"write_buffer_percent\": n, (numeric) share of the cache used for each write buffer\n"
+            "      \"block_size\": n,           (numeric) size of the blocks data is read and cached in\n"
+            "      \"bloom_bits\": n            (numeric) bloom filter bits per key\n"
+            "    },\n"
+            "    \"approximate_size\": n,      (numeric) estimated size on disk in bytes\n"
+            "    \"memory_usage\": n,          (numeric) estimated memory used by memtables and block cache in bytes\n"
+            "    \"block_cache_usage\": n,     (numeric) memory used by the block cache in bytes\n"
+            "    \"files_per_level\": [ n, ... ], (array) number of table files at each level\n"
+            "    \"reads\": n,                 (numeric) lookups since the database was opened\n"
+            "    \"read_misses\": n,           (numeric) lookups of keys that were not found\n"
+            "    \"read_bytes\": n,            (numeric) bytes of values read\n"
+            "    \"batches\": n,               (numeric) write batches\n"
+            "    \"write_bytes\": n,           (numeric) estimated bytes written in batches\n"
+            "    \"iterators\": n,             (numeric) iterators created\n"
+            "    \"stats\": \"str\"              (string) LevelDB's compaction statistics (leveldb.stats)\n"
+            "  },\n"
+            "  ...\n"
+            "}\n"
+                },
+                RPCExamples{
+                    HelpExampleCli("getdbstats", "")
+            + HelpExampleRpc("getdbstats", "")
+                },
+            }.ToString());
+
+    UniValue ret(UniValue::VOBJ);
+    ForEachDBWrapper([&ret](const CDBWrapper& db) {
+        UniValue obj(UniValue::VOBJ);
+        const DBProfile& profile = db.GetProfile();
+        UniValue profile_obj(UniValue::VOBJ);
+        profile_obj.pushKV("block_cache_percent", profile.block_cache_percent);
+        profile_obj.pushKV("write_buffer_percent", profile.write_buffer_percent);
+        profile_obj.pushKV("block_size", (uint64_t)profile.block_size);
+        profile_obj.pushKV("bloom_bits", profile.bloom_bits);
+        obj.pushKV("profile", profile_obj);
+
+        obj.pushKV("approximate_size", (uint64_t)db.EstimateTotalSize());
+        obj.pushKV("memory_usage", (uint64_t)db.DynamicMemoryUsage());
+        obj.pushKV("block_cache_usage", (uint64_t)db.BlockCacheUsage());
+        UniValue levels(UniValue::VARR);
+        std::string value;
+        for (int level = 0; db.GetProperty(strprintf("leveldb.num-files-at-level%d", level), value); ++level) {
+            levels.push_back(atoi64(value));
+        }
+        obj.pushKV("files_per_level", levels);
+
+        const DBCounters counters = db.GetCounters();
+        obj.pushKV("reads", counters.reads);
+        obj.pushKV("read_misses", counters.read_misses);
+        obj.pushKV("read_bytes", counters.read_bytes);
+        obj.pushKV("batches", counters.batches);
+        obj.pushKV("write_bytes", counters.write_bytes);
+        obj.pushKV("iterators", counters.iterators);
+
+        db.GetProperty("leveldb.stats", value);
+        obj.pushKV("stats", value);
+        ret.pushKV(db.GetName(), obj);
+    });
+    return ret;
+}
+
 static UniValue verifychain(const JSONRPCRequest& request)
 {
     int nCheckLevel = gArgs.GetArg("-checklevel", DEFAULT_CHECKLEVEL);
@@ -2310,6 +2397,7 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getblockhash",           &getblockhash,           {"height"} },
     { "blockchain",         "getblockheader",         &getblockheader,         {"blockhash","verbose"} },
     { "blockchain",         "getchaintips",           &getchaintips,           {} },
+    { "blockchain",         "getdbstats",             &getdbstats,             {} },
     { "blockchain",         "getdifficulty",          &getdifficulty,          {} },
     { "blockchain",         "getmempoolancestors",    &getmempoolancestors,    {"txid","verbose"} },
     { "blockchain",         "getmempooldescendants",  &getmempooldescendants,  {"txid","verbose"} },
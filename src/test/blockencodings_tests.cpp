@@ -321,6 +321,105 @@ BOOST_AUTO_TEST_CASE(EmptyBlockRoundTripTest)
     }
 }
 
+BOOST_AUTO_TEST_CASE(LargeBlockRoundTripTest)
+{
+    CTxMemPool pool;
+    TestMemPoolEntryHelper entry;
+    CBlock block;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig.resize(10);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 42;
+    block.vtx.resize(2000);
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        if (i > 0) tx.vin[0].prevout.hash = InsecureRand256();
+        block.vtx[i] = MakeTransactionRef(tx);
+    }
+    block.nVersion = 42;
+    block.hashPrevBlock = InsecureRand256();
+    block.nBits = 0x207fffff;
+    bool mutated;
+    block.hashMerkleRoot = BlockMerkleRoot(block, &mutated);
+    assert(!mutated);
+    while (!CheckProofOfWork(block.GetPoWHash(), block.nBits, Params().GetConsensus())) ++block.nNonce;
+
+    // Every fifth transaction is missing from the mempool (half of those are
+    // in extra_txn instead), which also holds plenty of unrelated ones.
+    std::vector<std::pair<uint256, CTransactionRef>> extra;
+    {
+        LOCK2(cs_main, pool.cs);
+        for (size_t i = 1; i < block.vtx.size(); i++) {
+            if (i % 5 != 0) {
+                pool.addUnchecked(entry.FromTx(block.vtx[i]));
+            } else if (i % 10 == 5) {
+                extra.emplace_back(block.vtx[i]->GetWitnessHash(), block.vtx[i]);
+            }
+        }
+        for (int i = 0; i < 3000; i++) {
+            tx.vin[0].prevout.hash = InsecureRand256();
+            pool.addUnchecked(entry.FromTx(tx));
+        }
+    }
+
+    CBlockHeaderAndShortTxIDs shortIDs(block, true);
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << shortIDs;
+    CBlockHeaderAndShortTxIDs shortIDs2;
+    stream >> shortIDs2;
+
+    PartiallyDownloadedBlock partialBlock(&pool);
+    BOOST_CHECK(partialBlock.InitData(shortIDs2, extra, block.GetHash()) == READ_STATUS_OK);
+    std::vector<CTransactionRef> vtx_missing;
+    for (size_t i = 0; i < block.vtx.size(); i++) {
+        BOOST_CHECK_EQUAL(partialBlock.IsTxAvailable(i), i % 10 != 0 || i == 0);
+        if (!partialBlock.IsTxAvailable(i)) vtx_missing.push_back(block.vtx[i]);
+    }
+
+    CBlock block2;
+    BOOST_CHECK(partialBlock.FillBlock(block2, vtx_missing) == READ_STATUS_OK);
+    BOOST_CHECK_EQUAL(block.GetHash().ToString(), block2.GetHash().ToString());
+    BOOST_CHECK_EQUAL(block.hashMerkleRoot.ToString(), BlockMerkleRoot(block2, &mutated).ToString());
+    BOOST_CHECK(!mutated);
+}
+
+BOOST_AUTO_TEST_CASE(ShortIDCollisionTest)
+{
+    CTxMemPool pool;
+    CBlock block(BuildBlockTestCase());
+
+    // A repeated short ID fails reconstruction, so the block is requested in full.
+    {
+        TestHeaderAndShortIDs shortIDs(block);
+        shortIDs.shorttxids[1] = shortIDs.shorttxids[0];
+
+        CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+        stream << shortIDs;
+        CBlockHeaderAndShortTxIDs shortIDs2;
+        stream >> shortIDs2;
+
+        PartiallyDownloadedBlock partialBlock(&pool);
+        BOOST_CHECK(partialBlock.InitData(shortIDs2, extra_txn) == READ_STATUS_FAILED);
+    }
+
+    // So do short IDs chosen to pile up in the same part of the lookup table.
+    {
+        TestHeaderAndShortIDs shortIDs(block);
+        shortIDs.shorttxids.resize(100);
+        for (size_t i = 0; i < shortIDs.shorttxids.size(); i++) {
+            shortIDs.shorttxids[i] = uint64_t(i + 1) << 32;
+        }
+
+        CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+        stream << shortIDs;
+        CBlockHeaderAndShortTxIDs shortIDs2;
+        stream >> shortIDs2;
+
+        PartiallyDownloadedBlock partialBlock(&pool);
+        BOOST_CHECK(partialBlock.InitData(shortIDs2, extra_txn) == READ_STATUS_FAILED);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(TransactionsRequestSerializationTest) {
     BlockTransactionsRequest req1;
     req1.blockhash = InsecureRand256();
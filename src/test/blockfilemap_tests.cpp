@@ -0,0 +1,57 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockfilemap.h>
+#include <test/test_bitcoin.h>
+#include <util/system.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockfilemap_tests, BasicTestingSetup)
+
+static fs::path WriteTestFile(const std::string& name, const std::vector<unsigned char>& data)
+{
+    fs::path path = GetDataDir() / name;
+    FILE* file = fsbridge::fopen(path, "wb");
+    BOOST_REQUIRE(file);
+    BOOST_REQUIRE_EQUAL(fwrite(data.data(), 1, data.size(), file), data.size());
+    fclose(file);
+    return path;
+}
+
+BOOST_AUTO_TEST_CASE(map_and_evict)
+{
+    const std::vector<unsigned char> data0 = {1, 2, 3, 4, 5};
+    const std::vector<unsigned char> data1 = {6, 7, 8};
+    const fs::path path0 = WriteTestFile("map0.dat", data0);
+    const fs::path path1 = WriteTestFile("map1.dat", data1);
+
+    CBlockFileMap map(1);
+    std::shared_ptr<const CMappedFile> file0 = map.Get(0, path0);
+#ifdef WIN32
+    BOOST_CHECK(!file0);
+#else
+    BOOST_REQUIRE(file0);
+    BOOST_CHECK_EQUAL(file0->size(), data0.size());
+    BOOST_CHECK(std::equal(data0.begin(), data0.end(), file0->GetData().begin()));
+    BOOST_CHECK(map.Get(0, path0) == file0);
+
+    // Mapping a second file evicts the first, which stays valid while in use.
+    std::shared_ptr<const CMappedFile> file1 = map.Get(1, path1);
+    BOOST_REQUIRE(file1);
+    BOOST_CHECK(std::equal(data1.begin(), data1.end(), file1->GetData().begin()));
+    BOOST_CHECK(std::equal(data0.begin(), data0.end(), file0->GetData().begin()));
+    std::shared_ptr<const CMappedFile> file0_again = map.Get(0, path0);
+    BOOST_CHECK(file0_again && file0_again != file0);
+
+    map.Drop(0);
+    BOOST_CHECK(map.Get(0, path0) != file0_again);
+#endif
+
+    // Missing files and disabled maps yield no mapping.
+    BOOST_CHECK(!map.Get(2, GetDataDir() / "missing.dat"));
+    BOOST_CHECK(!CBlockFileMap(0).Get(0, path0));
+}
+
+BOOST_AUTO_TEST_SUITE_END()
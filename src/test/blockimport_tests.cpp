@@ -0,0 +1,108 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <arith_uint256.h>
+#include <blockimport.h>
+#include <chainparams.h>
+#include <checkqueue.h>
+#include <clientversion.h>
+#include <consensus/merkle.h>
+#include <pow.h>
+#include <streams.h>
+#include <test/test_bitcoin.h>
+#include <util/system.h>
+#include <validation.h>
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+struct RegtestingSetup : public BasicTestingSetup {
+    RegtestingSetup() : BasicTestingSetup(CBaseChainParams::REGTEST) {}
+};
+
+BOOST_FIXTURE_TEST_SUITE(blockimport_tests, RegtestingSetup)
+
+// A block that passes CheckBlock
+static CBlock MakeBlock(int nHeight)
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    CBlock block;
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << nHeight << OP_0;
+    coinbase.vout.emplace_back(50 * COIN, CScript() << OP_TRUE);
+    block.vtx.push_back(MakeTransactionRef(std::move(coinbase)));
+    block.nVersion = 1;
+    block.hashPrevBlock = InsecureRand256();
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    block.nTime = 1546300800 + nHeight;
+    block.nBits = UintToArith256(consensusParams.powLimit).GetCompact();
+    while (!CheckProofOfWork(block.GetPoWHash(), block.nBits, consensusParams)) {
+        ++block.nNonce;
+        block.InvalidateHash();
+    }
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(import_reader_order)
+{
+    const CChainParams& params = Params();
+    const fs::path path = GetDataDir() / "import.dat";
+    std::vector<CBlock> blocks;
+    std::vector<uint64_t> positions;
+    {
+        CAutoFile fileout(fsbridge::fopen(path, "wb"), SER_DISK, CLIENT_VERSION);
+        BOOST_REQUIRE(!fileout.IsNull());
+        for (int i = 0; i < 40; ++i) {
+            blocks.push_back(MakeBlock(i));
+            if (i % 3 == 0) {
+                // Garbage (and zero padding) between blocks is skipped.
+                fileout << std::vector<unsigned char>(InsecureRandRange(100), 0) << params.MessageStart()[0];
+            }
+            fileout << params.MessageStart() << (unsigned int)GetSerializeSize(blocks.back(), CLIENT_VERSION);
+            positions.push_back(ftell(fileout.Get()));
+            fileout << blocks.back();
+        }
+        // A block whose data is not a block...
+        fileout << params.MessageStart() << (unsigned int)100 << std::vector<unsigned char>(100, 0xff);
+        // ...and one cut short at the end of the file.
+        fileout << params.MessageStart() << (unsigned int)1000 << std::vector<unsigned char>(10, 0);
+    }
+
+    // A block stored already is not checked, as the import skips it.
+    CBlockIndex stored;
+    stored.nStatus = BLOCK_HAVE_DATA;
+    {
+        LOCK(cs_main);
+        mapBlockIndex.emplace(blocks[5].GetHash(), &stored);
+    }
+
+    CCheckQueue<CTaskCheck> queue(1);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < 3; ++i) {
+        threadGroup.create_thread([&queue] { queue.Thread(); });
+    }
+    {
+        CBlockImportReader reader(fsbridge::fopen(path, "rb"), params.MessageStart(), params.GetConsensus(), &queue, 4);
+        CImportedBlock imported;
+        for (size_t i = 0; i < blocks.size(); ++i) {
+            BOOST_REQUIRE(reader.Next(imported));
+            BOOST_REQUIRE(imported.pblock);
+            BOOST_CHECK_EQUAL(imported.nPos, positions[i]);
+            BOOST_CHECK(imported.pblock->GetHash() == blocks[i].GetHash());
+            BOOST_CHECK_EQUAL(imported.pblock->fChecked, i != 5);
+        }
+        BOOST_REQUIRE(reader.Next(imported));
+        BOOST_CHECK(!imported.pblock);
+        BOOST_CHECK(!imported.strError.empty());
+        BOOST_CHECK(!reader.Next(imported));
+    }
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+
+    LOCK(cs_main);
+    mapBlockIndex.erase(blocks[5].GetHash());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
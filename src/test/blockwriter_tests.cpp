@@ -0,0 +1,97 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <blockwriter.h>
+#include <test/test_bitcoin.h>
+#include <util/system.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(blockwriter_tests, BasicTestingSetup)
+
+static fs::path WriterTestPath(const CDiskBlockPos& pos, BlockFileType type)
+{
+    return GetDataDir() / strprintf("%s%05u.dat", type == BlockFileType::BLOCK ? "blk" : "rev", pos.nFile);
+}
+
+static FILE* OpenWriterTestFile(const CDiskBlockPos& pos, BlockFileType type)
+{
+    FILE* file = fsbridge::fopen(WriterTestPath(pos, type), "rb+");
+    if (!file) file = fsbridge::fopen(WriterTestPath(pos, type), "wb+");
+    return file;
+}
+
+static std::vector<unsigned char> ReadWriterTestFile(int nFile, BlockFileType type)
+{
+    std::vector<unsigned char> data;
+    FILE* file = fsbridge::fopen(WriterTestPath(CDiskBlockPos(nFile, 0), type), "rb");
+    if (!file) return data;
+    unsigned char buf[256];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), file)) > 0) {
+        data.insert(data.end(), buf, buf + n);
+    }
+    fclose(file);
+    return data;
+}
+
+static void CheckWriter(bool fThreaded)
+{
+    CBlockFileWriter writer(OpenWriterTestFile);
+    if (fThreaded) writer.Start();
+
+    // Writes land at their positions in whichever order they come. The
+    // thread may take them in separate batches, so wait for each one read.
+    BOOST_CHECK(writer.Write(BlockFileType::BLOCK, CDiskBlockPos(0, 4), {5, 6, 7, 8}));
+    BOOST_CHECK(writer.Write(BlockFileType::BLOCK, CDiskBlockPos(0, 0), {1, 2, 3, 4}));
+    BOOST_CHECK(writer.Write(BlockFileType::UNDO, CDiskBlockPos(0, 0), {9, 9}));
+    writer.WaitForWrite(BlockFileType::BLOCK, CDiskBlockPos(0, 2));
+    writer.WaitForWrite(BlockFileType::BLOCK, CDiskBlockPos(0, 6));
+    BOOST_CHECK(ReadWriterTestFile(0, BlockFileType::BLOCK) == std::vector<unsigned char>({1, 2, 3, 4, 5, 6, 7, 8}));
+    writer.WaitForWrite(BlockFileType::UNDO, CDiskBlockPos(0, 1));
+    BOOST_CHECK(ReadWriterTestFile(0, BlockFileType::UNDO) == std::vector<unsigned char>({9, 9}));
+
+    // Finalizing truncates both files, after the writes queued before it.
+    BOOST_CHECK(writer.Write(BlockFileType::BLOCK, CDiskBlockPos(0, 8), {10, 11, 12}));
+    BOOST_CHECK(writer.Finalize(0, 10, 1));
+    BOOST_CHECK(writer.Write(BlockFileType::BLOCK, CDiskBlockPos(1, 0), {13}));
+    BOOST_CHECK(writer.Sync());
+    BOOST_CHECK(ReadWriterTestFile(0, BlockFileType::BLOCK) == std::vector<unsigned char>({1, 2, 3, 4, 5, 6, 7, 8, 10, 11}));
+    BOOST_CHECK(ReadWriterTestFile(0, BlockFileType::UNDO) == std::vector<unsigned char>({9}));
+    BOOST_CHECK(ReadWriterTestFile(1, BlockFileType::BLOCK) == std::vector<unsigned char>({13}));
+
+    // Writes queued before Stop() are still performed; later ones happen on the caller's thread.
+    BOOST_CHECK(writer.Write(BlockFileType::BLOCK, CDiskBlockPos(1, 1), {14}));
+    writer.Stop();
+    BOOST_CHECK(writer.Write(BlockFileType::BLOCK, CDiskBlockPos(1, 2), {15}));
+    BOOST_CHECK(ReadWriterTestFile(1, BlockFileType::BLOCK) == std::vector<unsigned char>({13, 14, 15}));
+    BOOST_CHECK(writer.Sync());
+
+    fs::remove(WriterTestPath(CDiskBlockPos(0, 0), BlockFileType::BLOCK));
+    fs::remove(WriterTestPath(CDiskBlockPos(0, 0), BlockFileType::UNDO));
+    fs::remove(WriterTestPath(CDiskBlockPos(1, 0), BlockFileType::BLOCK));
+}
+
+BOOST_AUTO_TEST_CASE(write_synchronous)
+{
+    CheckWriter(false);
+}
+
+BOOST_AUTO_TEST_CASE(write_threaded)
+{
+    CheckWriter(true);
+}
+
+BOOST_AUTO_TEST_CASE(write_failure)
+{
+    // A failed write is reported by the Sync() after it (and every write from then on).
+    CBlockFileWriter writer([](const CDiskBlockPos&, BlockFileType) { return (FILE*)nullptr; });
+    writer.Start();
+    writer.Write(BlockFileType::BLOCK, CDiskBlockPos(0, 0), {1});
+    BOOST_CHECK(!writer.Sync());
+    BOOST_CHECK(!writer.Write(BlockFileType::BLOCK, CDiskBlockPos(0, 1), {2}));
+    writer.Stop();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
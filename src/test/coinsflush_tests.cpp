@@ -0,0 +1,167 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <coins.h>
+#include <script/script.h>
+#include <test/test_bitcoin.h>
+#include <txdb.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(coinsflush_tests, BasicTestingSetup)
+
+static COutPoint RandomOutpoint()
+{
+    return COutPoint(InsecureRand256(), InsecureRandRange(4));
+}
+
+static Coin MakeCoin(CAmount nValue)
+{
+    return Coin(CTxOut(nValue, CScript() << OP_TRUE), 1, false, false, 1546300800);
+}
+
+BOOST_AUTO_TEST_CASE(sync_keeps_cache_warm)
+{
+    CCoinsViewDB db(1 << 20, true);
+    db.StartBackgroundWrites();
+    CCoinsViewCache tip(&db);
+    const COutPoint kept = RandomOutpoint(), spent = RandomOutpoint();
+
+    tip.AddCoin(kept, MakeCoin(1), false);
+    tip.AddCoin(spent, MakeCoin(2), false);
+    const uint256 hashFirst = InsecureRand256();
+    tip.SetBestBlock(hashFirst);
+    BOOST_CHECK(tip.Sync());
+    BOOST_CHECK_EQUAL(tip.GetCacheSize(), 2U);
+    // Whether or not the write has been committed yet, the database view
+    // already reflects it.
+    BOOST_CHECK(db.GetBestBlock() == hashFirst);
+    BOOST_CHECK(db.HaveCoin(spent));
+
+    BOOST_CHECK(tip.SpendCoin(spent));
+    const uint256 hashSecond = InsecureRand256();
+    tip.SetBestBlock(hashSecond);
+    BOOST_CHECK(tip.Sync());
+    BOOST_CHECK_EQUAL(tip.GetCacheSize(), 1U);
+    BOOST_CHECK(!tip.HaveCoin(spent));
+    BOOST_CHECK(!db.HaveCoin(spent));
+
+    BOOST_CHECK(db.WaitForWrite());
+    BOOST_CHECK(!db.IsWriting());
+    BOOST_CHECK(db.GetHeadBlocks().empty());
+    BOOST_CHECK(db.GetBestBlock() == hashSecond);
+    BOOST_CHECK(!db.HaveCoin(spent));
+    Coin coin;
+    BOOST_CHECK(db.GetCoin(kept, coin));
+    BOOST_CHECK_EQUAL(coin.out.nValue, 1);
+}
+
+BOOST_AUTO_TEST_CASE(sync_writes_every_change)
+{
+    CCoinsViewDB db(1 << 20, true);
+    CCoinsViewCache tip(&db);
+    const COutPoint a = RandomOutpoint(), b = RandomOutpoint(), c = RandomOutpoint(), d = RandomOutpoint();
+
+    tip.AddCoin(a, MakeCoin(1), false);
+    tip.AddCoin(b, MakeCoin(2), false);
+    tip.SetBestBlock(InsecureRand256());
+    BOOST_CHECK(tip.Sync());
+
+    // c is added, spent (erasing the fresh entry) and added again, so Sync()
+    // meets it twice; b and d are changed in a child cache and pushed up.
+    BOOST_CHECK(tip.SpendCoin(a));
+    tip.AddCoin(c, MakeCoin(3), false);
+    BOOST_CHECK(tip.SpendCoin(c));
+    tip.AddCoin(c, MakeCoin(4), false);
+    {
+        CCoinsViewCache view(&tip);
+        BOOST_CHECK(view.SpendCoin(b));
+        view.AddCoin(d, MakeCoin(5), false);
+        BOOST_CHECK(view.Flush());
+    }
+    tip.SetBestBlock(InsecureRand256());
+    BOOST_CHECK(tip.Sync());
+
+    // Everything left is unmodified, and the database has every change.
+    BOOST_CHECK_EQUAL(tip.GetCacheSize(), 2U);
+    tip.Trim(0);
+    BOOST_CHECK_EQUAL(tip.GetCacheSize(), 0U);
+    Coin coin;
+    BOOST_CHECK(!db.HaveCoin(a));
+    BOOST_CHECK(!db.HaveCoin(b));
+    BOOST_CHECK(db.GetCoin(c, coin));
+    BOOST_CHECK_EQUAL(coin.out.nValue, 4);
+    BOOST_CHECK(db.GetCoin(d, coin));
+    BOOST_CHECK_EQUAL(coin.out.nValue, 5);
+
+    // With nothing changed since, a Sync() writes nothing but the best block.
+    BOOST_CHECK(tip.Sync());
+    BOOST_CHECK_EQUAL(tip.GetCacheSize(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(have_any_coin)
+{
+    CCoinsViewDB db(1 << 20, true);
+    CCoinsViewCache tip(&db);
+    std::vector<COutPoint> stored;
+    for (int i = 0; i < 100; i++) {
+        stored.push_back(RandomOutpoint());
+        tip.AddCoin(stored.back(), MakeCoin(i + 1), false);
+    }
+    tip.SetBestBlock(InsecureRand256());
+    BOOST_CHECK(tip.Flush());
+
+    // Misses around and between the stored keys, and a hit among them.
+    std::vector<COutPoint> misses;
+    for (int i = 0; i < 200; i++) {
+        misses.push_back(RandomOutpoint());
+    }
+    misses.emplace_back(stored[7].hash, stored[7].n + 4);
+    BOOST_CHECK(!db.HaveAnyCoin({}));
+    BOOST_CHECK(!db.HaveAnyCoin(misses));
+    std::vector<COutPoint> outpoints(misses);
+    outpoints.push_back(stored[42]);
+    BOOST_CHECK(db.HaveAnyCoin(outpoints));
+    BOOST_CHECK(db.HaveAnyCoin({stored[0], stored[0]}));
+
+    // A write still being committed overrides the database: a coin it
+    // spends is gone and one it adds is there. Enough other coins go into
+    // it that it is most likely in flight, but either way the answers match.
+    db.StartBackgroundWrites();
+    const COutPoint added = RandomOutpoint();
+    BOOST_CHECK(tip.SpendCoin(stored[42]));
+    tip.AddCoin(added, MakeCoin(1000), false);
+    for (int i = 0; i < 20000; i++) {
+        tip.AddCoin(RandomOutpoint(), MakeCoin(1), false);
+    }
+    tip.SetBestBlock(InsecureRand256());
+    BOOST_CHECK(tip.Flush());
+    for (int i = 0; i < 2; i++) {
+        BOOST_CHECK(!db.HaveAnyCoin(outpoints));
+        BOOST_CHECK(!db.HaveAnyCoin({stored[42], misses[0]}));
+        BOOST_CHECK(db.HaveAnyCoin({misses[0], added}));
+        BOOST_CHECK(db.HaveAnyCoin({stored[42], stored[43]}));
+        BOOST_CHECK(db.WaitForWrite());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(trim_drops_only_clean_entries)
+{
+    CCoinsViewDB db(1 << 20, true);
+    CCoinsViewCache tip(&db);
+    const COutPoint clean = RandomOutpoint(), dirty = RandomOutpoint();
+
+    tip.AddCoin(clean, MakeCoin(1), false);
+    tip.SetBestBlock(InsecureRand256());
+    BOOST_CHECK(tip.Sync());
+    tip.AddCoin(dirty, MakeCoin(2), false);
+
+    tip.Trim(0);
+    BOOST_CHECK_EQUAL(tip.GetCacheSize(), 1U);
+    BOOST_CHECK(tip.HaveCoinInCache(dirty));
+    BOOST_CHECK(!tip.HaveCoinInCache(clean));
+    BOOST_CHECK_EQUAL(tip.AccessCoin(clean).out.nValue, 1);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
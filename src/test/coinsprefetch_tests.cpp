@@ -0,0 +1,129 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chainparams.h>
+#include <clientversion.h>
+#include <coinsprefetch.h>
+#include <consensus/merkle.h>
+#include <script/script.h>
+#include <streams.h>
+#include <test/test_bitcoin.h>
+#include <util/system.h>
+#include <util/time.h>
+#include <validation.h>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(coinsprefetch_tests, BasicTestingSetup)
+
+static COutPoint RandomOutpoint()
+{
+    return COutPoint(InsecureRand256(), InsecureRandRange(4));
+}
+
+static Coin MakeCoin(CAmount nValue)
+{
+    return Coin(CTxOut(nValue, CScript() << OP_TRUE), 1, false, false, 1546300800);
+}
+
+BOOST_AUTO_TEST_CASE(prefetch_serves_and_invalidates)
+{
+    CCoinsView dummy;
+    CCoinsViewCache base(&dummy);
+    const COutPoint kept = RandomOutpoint(), spent = RandomOutpoint(), rewritten = RandomOutpoint(), missing = RandomOutpoint();
+    base.AddCoin(kept, MakeCoin(1), false);
+    base.AddCoin(spent, MakeCoin(2), false);
+    base.AddCoin(rewritten, MakeCoin(3), false);
+
+    // No worker threads: stage synchronously.
+    CCoinsViewPrefetch prefetch(&base, 0);
+    {
+        CCoinsViewCache tip(&prefetch);
+        BOOST_CHECK(tip.HaveCoin(spent));
+        BOOST_CHECK(tip.HaveCoin(rewritten));
+        BOOST_CHECK_EQUAL(prefetch.GetMisses(), 2U);
+
+        // Stage copies of coins the tip is about to modify, as a read ahead
+        // of the tip would.
+        prefetch.Prefetch({kept, spent, rewritten, missing});
+        BOOST_CHECK(!tip.HaveCoin(missing));
+        BOOST_CHECK_EQUAL(prefetch.GetMisses(), 3U);
+
+        // Flushing writes through the prefetch layer, which must drop its
+        // now stale copies.
+        BOOST_CHECK(tip.SpendCoin(spent));
+        BOOST_CHECK(tip.SpendCoin(rewritten));
+        tip.AddCoin(rewritten, MakeCoin(4), true);
+        BOOST_CHECK(tip.Flush());
+    }
+
+    CCoinsViewCache tip(&prefetch);
+    BOOST_CHECK(!tip.HaveCoin(spent));
+    BOOST_CHECK_EQUAL(tip.AccessCoin(rewritten).out.nValue, 4);
+    BOOST_CHECK_EQUAL(prefetch.GetHits(), 0U);
+    BOOST_CHECK_EQUAL(tip.AccessCoin(kept).out.nValue, 1);
+    BOOST_CHECK_EQUAL(prefetch.GetHits(), 1U);
+    BOOST_CHECK_EQUAL(prefetch.GetMisses(), 5U);
+}
+
+BOOST_AUTO_TEST_CASE(prefetch_threads_read_scheduled_blocks)
+{
+    SetDataDir("coinsprefetch_threads");
+    ClearDatadirCache();
+
+    CCoinsView dummy;
+    CCoinsViewCache base(&dummy);
+    const COutPoint first = RandomOutpoint(), second = RandomOutpoint(), missing = RandomOutpoint();
+    base.AddCoin(first, MakeCoin(1), false);
+    base.AddCoin(second, MakeCoin(2), false);
+
+    // A block spending both coins and one the base view lacks, written to
+    // the first block file the way WriteBlockToDisk lays it out.
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << 1 << OP_0;
+    coinbase.vout.emplace_back(50 * COIN, CScript() << OP_TRUE);
+    CMutableTransaction spend;
+    for (const COutPoint& prevout : {first, second, missing}) {
+        spend.vin.emplace_back(prevout);
+    }
+    spend.vout.emplace_back(3, CScript() << OP_TRUE);
+    CBlock block;
+    block.vtx.push_back(MakeTransactionRef(std::move(coinbase)));
+    block.vtx.push_back(MakeTransactionRef(std::move(spend)));
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    {
+        CAutoFile fileout(fsbridge::fopen(GetBlockPosFilename(CDiskBlockPos(0, 0), "blk"), "wb"), SER_DISK, CLIENT_VERSION);
+        BOOST_REQUIRE(!fileout.IsNull());
+        fileout << Params().MessageStart() << (unsigned int)GetSerializeSize(block, CLIENT_VERSION) << block;
+    }
+    CBlockIndex index;
+    index.nHeight = 1;
+    index.nFile = 0;
+    index.nDataPos = 8;
+    index.nStatus = BLOCK_HAVE_DATA;
+
+    CCoinsViewPrefetch prefetch(&base, 2);
+    {
+        LOCK(cs_main);
+        prefetch.Schedule({&index});
+    }
+    for (int i = 0; i < 1000 && prefetch.GetStagedCount() < 2; i++) {
+        MilliSleep(10);
+    }
+    BOOST_CHECK_EQUAL(prefetch.GetStagedCount(), 2U);
+
+    // The lookups block connection makes are served from the staging area.
+    CCoinsViewCache tip(&prefetch);
+    BOOST_CHECK_EQUAL(tip.AccessCoin(first).out.nValue, 1);
+    BOOST_CHECK_EQUAL(tip.AccessCoin(second).out.nValue, 2);
+    BOOST_CHECK(!tip.HaveCoin(missing));
+    BOOST_CHECK_EQUAL(prefetch.GetHits(), 2U);
+    BOOST_CHECK_EQUAL(prefetch.GetMisses(), 1U);
+    BOOST_CHECK_EQUAL(prefetch.GetStagedCount(), 0U);
+
+    ClearDatadirCache();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
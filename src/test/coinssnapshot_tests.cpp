@@ -0,0 +1,109 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <coinssnapshot.h>
+#include <script/script.h>
+#include <test/test_bitcoin.h>
+
+#include <map>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(coinssnapshot_tests, BasicTestingSetup)
+
+static Coin MakeCoin(CAmount nValue)
+{
+    return Coin(CTxOut(nValue, CScript() << OP_TRUE), 1, false, false, 1546300800);
+}
+
+static void CheckSnapshot(CCoinsSnapshot& snapshot, const std::map<COutPoint, CAmount>& expected, const std::vector<COutPoint>& outpoints)
+{
+    for (const COutPoint& outpoint : outpoints) {
+        Coin coin;
+        auto it = expected.find(outpoint);
+        if (it == expected.end()) {
+            BOOST_CHECK(!snapshot.GetCoin(outpoint, coin));
+        } else {
+            BOOST_CHECK(snapshot.GetCoin(outpoint, coin));
+            BOOST_CHECK_EQUAL(coin.out.nValue, it->second);
+        }
+    }
+}
+
+static void CheckSnapshots(bool fBackground)
+{
+    CCoinsViewDB db(1 << 20, true, true);
+    if (fBackground) db.StartBackgroundWrites();
+    CCoinsViewCache tip(&db);
+
+    std::vector<COutPoint> outpoints;
+    for (int i = 0; i < 64; ++i) {
+        outpoints.emplace_back(InsecureRand256(), i);
+    }
+
+    std::map<COutPoint, CAmount> utxos;
+    tip.AddCoin(outpoints[0], MakeCoin(1), false);
+    utxos[outpoints[0]] = 1;
+    tip.SetBestBlock(InsecureRand256());
+    BOOST_CHECK(tip.Flush());
+    BOOST_CHECK(db.WaitForWrite());
+
+    CCoinsSnapshotManager manager;
+    BOOST_CHECK(!manager.Get());
+    manager.Reset(db, tip.GetBestBlock(), 0);
+
+    // Every published state stays readable as it was, whatever is written
+    // to the database afterwards.
+    std::vector<std::pair<std::shared_ptr<CCoinsSnapshot>, std::map<COutPoint, CAmount>>> history;
+    for (int nHeight = 0; nHeight <= 40; ++nHeight) {
+        if (nHeight > 0) {
+            // Connect a block: spend and add a few coins, some of them twice.
+            CCoinsViewCache view(&tip);
+            for (int i = 0; i < 6; ++i) {
+                const COutPoint& outpoint = outpoints[InsecureRandRange(outpoints.size())];
+                if (utxos.count(outpoint)) {
+                    BOOST_CHECK(view.SpendCoin(outpoint));
+                    utxos.erase(outpoint);
+                } else {
+                    view.AddCoin(outpoint, MakeCoin(nHeight * 100 + i), false);
+                    utxos[outpoint] = nHeight * 100 + i;
+                }
+            }
+            view.SetBestBlock(InsecureRand256());
+            manager.Publish(view, view.GetBestBlock(), nHeight);
+            BOOST_CHECK(view.Flush());
+        }
+        if (nHeight % 7 == 3) {
+            BOOST_CHECK(tip.Flush());
+        } else if (nHeight % 7 == 5) {
+            BOOST_CHECK(tip.Sync());
+        }
+
+        std::shared_ptr<CCoinsSnapshot> snapshot = manager.Get();
+        BOOST_REQUIRE(snapshot);
+        BOOST_CHECK(snapshot->GetBestBlock() == tip.GetBestBlock());
+        BOOST_CHECK_EQUAL(snapshot->GetHeight(), nHeight);
+        history.emplace_back(snapshot, utxos);
+        for (const auto& entry : history) {
+            CheckSnapshot(*entry.first, entry.second, outpoints);
+        }
+    }
+
+    history.clear();
+    manager.Clear();
+    BOOST_CHECK(!manager.Get());
+    BOOST_CHECK(db.WaitForWrite());
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_synchronous_writes)
+{
+    CheckSnapshots(false);
+}
+
+BOOST_AUTO_TEST_CASE(snapshot_background_writes)
+{
+    CheckSnapshots(true);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
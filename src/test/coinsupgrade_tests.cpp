@@ -0,0 +1,166 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <coins.h>
+#include <compressor.h>
+#include <dbwrapper.h>
+#include <script/script.h>
+#include <test/test_bitcoin.h>
+#include <txdb.h>
+#include <util/system.h>
+
+#include <map>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(coinsupgrade_tests, BasicTestingSetup)
+
+static const char DB_COINS = 'c';
+static const char DB_UPGRADE_MARKER = 'U';
+
+/** A transaction's outputs in the per-tx format CCoinsViewDB::Upgrade() converts */
+struct LegacyCoins
+{
+    std::vector<CTxOut> vout; // spent outputs are IsNull()
+    int nHeight;
+    bool fCoinBase;
+    bool fCoinStake;
+    uint32_t nTime;
+
+    template<typename Stream>
+    void Serialize(Stream& s) const
+    {
+        // Availability of the outputs after the first two, in bytes of eight
+        // bits; nMaskCode counts the non-zero ones.
+        std::vector<unsigned char> vMask;
+        unsigned int nMaskCode = 0;
+        for (size_t i = 2; i < vout.size(); i++) {
+            if ((i - 2) % 8 == 0) vMask.push_back(0);
+            if (!vout[i].IsNull()) vMask.back() |= 1 << ((i - 2) % 8);
+        }
+        while (!vMask.empty() && vMask.back() == 0) vMask.pop_back();
+        for (unsigned char chAvail : vMask) {
+            if (chAvail != 0) nMaskCode++;
+        }
+        const bool fFirst = vout.size() > 0 && !vout[0].IsNull();
+        const bool fSecond = vout.size() > 1 && !vout[1].IsNull();
+        unsigned int nVersion = 1;
+        unsigned int nCode = 8 * (nMaskCode - (fFirst || fSecond ? 0 : 1)) + (fCoinBase ? 1 : 0) + (fFirst ? 2 : 0) + (fSecond ? 4 : 0);
+        ::Serialize(s, VARINT(nVersion));
+        ::Serialize(s, VARINT(nCode));
+        for (unsigned char chAvail : vMask) {
+            ::Serialize(s, chAvail);
+        }
+        for (const CTxOut& out : vout) {
+            if (out.IsNull()) continue;
+            CTxOut txout(out);
+            ::Serialize(s, CTxOutCompressor(txout));
+        }
+        int nHeightOut = nHeight;
+        unsigned int nFlag = fCoinStake ? 1 : 0;
+        uint32_t nTimeOut = nTime;
+        ::Serialize(s, VARINT(nHeightOut, VarIntMode::NONNEGATIVE_SIGNED));
+        ::Serialize(s, VARINT(nFlag));
+        ::Serialize(s, VARINT(nTimeOut));
+    }
+};
+
+static uint256 TxidInPartition(int partition)
+{
+    uint256 txid = InsecureRand256();
+    *txid.begin() = (partition << 4) | (*txid.begin() & 0x0f);
+    return txid;
+}
+
+static LegacyCoins RandomLegacyCoins()
+{
+    LegacyCoins coins;
+    // Up to 20 outputs, so that some need the availability bitmask
+    coins.vout.resize(1 + InsecureRandRange(20));
+    for (size_t i = 0; i < coins.vout.size(); i++) {
+        switch (InsecureRandRange(4)) {
+        case 0: break; // spent
+        case 1: coins.vout[i] = CTxOut(InsecureRandRange(1000) + 1, CScript() << OP_RETURN); break;
+        default: coins.vout[i] = CTxOut(InsecureRandRange(1000) + 1, CScript() << OP_TRUE << InsecureRand32()); break;
+        }
+    }
+    // At least one output to convert
+    coins.vout.back() = CTxOut(1, CScript() << OP_TRUE);
+    coins.nHeight = InsecureRandRange(1000000);
+    coins.fCoinBase = InsecureRandBool();
+    coins.fCoinStake = !coins.fCoinBase && InsecureRandBool();
+    coins.nTime = 1546300800 + InsecureRand32() % 10000000;
+    return coins;
+}
+
+BOOST_AUTO_TEST_CASE(upgrade_partitions_and_resume)
+{
+    SetDataDir("coins_upgrade");
+    ClearDatadirCache();
+    const fs::path path = GetDataDir() / "chainstate";
+
+    // Legacy records spread over several partitions. Partition 7 was being
+    // upgraded when the node stopped: its marker names the last record
+    // converted (and erased), and a record before it is left in place to
+    // show that the resumed upgrade does not go back over it.
+    const int resumed = 7;
+    std::map<uint256, LegacyCoins> legacy;
+    for (int partition : {0, 3, resumed, 12, 15}) {
+        for (int i = 0; i < 10; i++) {
+            legacy.emplace(TxidInPartition(partition), RandomLegacyCoins());
+        }
+    }
+    std::vector<uint256> vResumed;
+    for (const auto& entry : legacy) {
+        if ((*entry.first.begin() >> 4) == resumed) vResumed.push_back(entry.first);
+    }
+    const uint256 before = vResumed[0], marker = vResumed[1];
+    legacy.erase(marker);
+    {
+        CDBWrapper db(path, 1 << 20, false, true, true);
+        CDBBatch batch(db);
+        for (const auto& entry : legacy) {
+            batch.Write(std::make_pair(DB_COINS, entry.first), entry.second);
+        }
+        batch.Write(std::make_pair(DB_UPGRADE_MARKER, (uint8_t)resumed), marker);
+        BOOST_REQUIRE(db.WriteBatch(batch, true));
+    }
+
+    {
+        CCoinsViewDB view(1 << 20);
+        BOOST_REQUIRE(view.Upgrade(4));
+        for (const auto& entry : legacy) {
+            const LegacyCoins& coins = entry.second;
+            for (size_t i = 0; i < coins.vout.size(); i++) {
+                Coin coin;
+                const bool fFound = view.GetCoin(COutPoint(entry.first, i), coin);
+                if (entry.first == before || coins.vout[i].IsNull() || coins.vout[i].scriptPubKey.IsUnspendable()) {
+                    BOOST_CHECK(!fFound);
+                    continue;
+                }
+                BOOST_REQUIRE(fFound);
+                BOOST_CHECK(coin.out == coins.vout[i]);
+                BOOST_CHECK_EQUAL((int)coin.nHeight, coins.nHeight);
+                BOOST_CHECK_EQUAL((bool)coin.fCoinBase, coins.fCoinBase);
+                BOOST_CHECK_EQUAL((bool)coin.fCoinStake, coins.fCoinStake);
+                BOOST_CHECK_EQUAL((uint32_t)coin.nTime, coins.nTime);
+            }
+        }
+    }
+
+    {
+        CDBWrapper db(path, 1 << 20, false, false, true);
+        for (const auto& entry : legacy) {
+            BOOST_CHECK_EQUAL(db.Exists(std::make_pair(DB_COINS, entry.first)), entry.first == before);
+        }
+        std::unique_ptr<CDBIterator> pcursor(db.NewIterator());
+        pcursor->Seek(std::make_pair(DB_UPGRADE_MARKER, (uint8_t)0));
+        std::pair<char, uint8_t> key;
+        BOOST_CHECK(!pcursor->Valid() || !pcursor->GetKey(key) || key.first != DB_UPGRADE_MARKER);
+    }
+    fs::remove_all(path);
+    ClearDatadirCache();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
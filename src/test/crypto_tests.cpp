@@ -5,6 +5,7 @@
 #include <crypto/aes.h>
 #include <crypto/chacha20.h>
 #include <crypto/ripemd160.h>
+#include <crypto/scrypt.h>
 #include <crypto/sha1.h>
 #include <crypto/sha256.h>
 #include <crypto/sha512.h>
@@ -562,4 +563,25 @@ BOOST_AUTO_TEST_CASE(sha256d64)
     }
 }
 
+BOOST_AUTO_TEST_CASE(scrypt_multi)
+{
+    // Covers full, padded and single-lane batches of every kernel.
+    for (int i = 0; i <= 2 * (int)SCRYPT_MAX_LANES + 1; i += (i < 4 ? 1 : 3)) {
+        std::vector<unsigned char> in(80 * i);
+        std::vector<unsigned char> out1(32 * i), out2(32 * i);
+        std::vector<const char*> inputs(i);
+        std::vector<char*> outputs(i);
+        for (int j = 0; j < 80 * i; ++j) {
+            in[j] = InsecureRandBits(8);
+        }
+        for (int j = 0; j < i; ++j) {
+            scrypt_1024_1_1_256((const char*)&in[80 * j], (char*)&out1[32 * j]);
+            inputs[j] = (const char*)&in[80 * j];
+            outputs[j] = (char*)&out2[32 * j];
+        }
+        scrypt_1024_1_1_256_multi(inputs.data(), outputs.data(), i);
+        BOOST_CHECK(out1 == out2);
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -317,6 +317,60 @@ BOOST_AUTO_TEST_CASE(iterator_string_ordering)
     }
 }
 
+BOOST_AUTO_TEST_CASE(dbwrapper_profiles)
+{
+    // The block index trades block cache for write buffer and larger blocks.
+    const DBProfile chainstate = GetDBProfile("chainstate");
+    const DBProfile index = GetDBProfile("index");
+    BOOST_CHECK(index.block_cache_percent < chainstate.block_cache_percent);
+    BOOST_CHECK(index.block_size > chainstate.block_size);
+    BOOST_CHECK_EQUAL(GetDBProfile("other").block_cache_percent, chainstate.block_cache_percent);
+
+    std::string error;
+    gArgs.ForceSetArg("-dbprofile", "txindex:blocksize=8192");
+    BOOST_CHECK(CheckDBProfileArgs(error));
+    BOOST_CHECK_EQUAL(GetDBProfile("txindex").block_size, 8192U);
+    BOOST_CHECK_EQUAL(GetDBProfile("chainstate").block_size, chainstate.block_size);
+
+    for (const char* arg : {"txindex:blocksize", "txindex:foo=1", "wallet:bloombits=1", "index:writebuffer=50", "chainstate:compression=1"}) {
+        gArgs.ForceSetArg("-dbprofile", arg);
+        BOOST_CHECK(!CheckDBProfileArgs(error));
+    }
+    BOOST_CHECK_THROW(GetDBProfile("chainstate"), std::runtime_error);
+
+    gArgs.ClearForcedArg("-dbprofile");
+    BOOST_CHECK(CheckDBProfileArgs(error));
+    BOOST_CHECK_EQUAL(GetDBProfile("txindex").block_size, GetDBProfile("chainstate").block_size);
+}
+
+BOOST_AUTO_TEST_CASE(dbwrapper_counters)
+{
+    fs::path ph = SetDataDir("dbwrapper_counters");
+    CDBWrapper dbw(ph, (1 << 20), true, false, false);
+    const DBCounters before = dbw.GetCounters();
 
+    uint256 in = InsecureRand256();
+    uint256 res;
+    BOOST_CHECK(dbw.Write('a', in));
+    BOOST_CHECK(dbw.Read('a', res));
+    BOOST_CHECK(!dbw.Read('b', res));
+    BOOST_CHECK(dbw.Exists('a'));
+    delete dbw.NewIterator();
+
+    const DBCounters after = dbw.GetCounters();
+    BOOST_CHECK_EQUAL(after.reads - before.reads, 3U);
+    BOOST_CHECK_EQUAL(after.read_misses - before.read_misses, 1U);
+    BOOST_CHECK_EQUAL(after.read_bytes - before.read_bytes, 2 * in.size());
+    BOOST_CHECK_EQUAL(after.batches - before.batches, 1U);
+    BOOST_CHECK(after.write_bytes > before.write_bytes);
+    BOOST_CHECK_EQUAL(after.iterators - before.iterators, 1U);
+
+    bool found = false;
+    ForEachDBWrapper([&](const CDBWrapper& db) { found |= &db == &dbw; });
+    BOOST_CHECK(found);
+    std::string stats;
+    BOOST_CHECK(dbw.GetProperty("leveldb.stats", stats));
+    BOOST_CHECK(!dbw.GetProperty("leveldb.nonexistent", stats));
+}
 
 BOOST_AUTO_TEST_SUITE_END()
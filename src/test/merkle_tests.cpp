@@ -2,8 +2,12 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <chainparams.h>
 #include <consensus/merkle.h>
+#include <consensus/validation.h>
+#include <streams.h>
 #include <test/test_bitcoin.h>
+#include <validation.h>
 
 #include <boost/test/unit_test.hpp>
 
@@ -170,6 +174,25 @@ static std::vector<uint256> BlockGetMerkleBranch(const CBlock& block, const std:
     return vMerkleBranch;
 }
 
+static uint256 SubtreeMerkleRoot(const CBlock& block, unsigned int height, bool* mutated)
+{
+    const size_t width = size_t{1} << height;
+    std::vector<uint256> roots;
+    bool mutation = false;
+    for (size_t pos = 0; pos < block.vtx.size(); pos += width) {
+        std::vector<uint256> leaves;
+        for (size_t i = pos; i < std::min(pos + width, block.vtx.size()); i++) {
+            leaves.push_back(block.vtx[i]->GetHash());
+        }
+        bool subtreeMutated = false;
+        roots.push_back(ComputeMerkleSubtreeRoot(std::move(leaves), height, &subtreeMutated));
+        mutation |= subtreeMutated;
+    }
+    uint256 root = ComputeMerkleRoot(std::move(roots), mutated);
+    *mutated |= mutation;
+    return root;
+}
+
 static inline int ctz(uint32_t i) {
     if (i == 0) return 0;
     int j = 0;
@@ -231,6 +254,12 @@ BOOST_AUTO_TEST_CASE(merkle_test)
             BOOST_CHECK((newRoot == uint256()) == (ntx == 0));
             BOOST_CHECK(oldMutated == newMutated);
             BOOST_CHECK(newMutated == !!mutate);
+            // Splitting the tree into subtrees gives the same root and finds the same mutations.
+            for (unsigned int height = 0; height <= 4 && ntx3 > (1 << height); height++) {
+                bool subtreeMutated = false;
+                BOOST_CHECK(SubtreeMerkleRoot(block, height, &subtreeMutated) == newRoot);
+                BOOST_CHECK(subtreeMutated == newMutated);
+            }
             // If no mutation was done (once for every ntx value), try up to 16 branches.
             if (mutate == 0) {
                 for (int loop = 0; loop < std::min(ntx, 16); loop++) {
@@ -249,4 +278,86 @@ BOOST_AUTO_TEST_CASE(merkle_test)
     }
 }
 
+static CBlock MakeCheckBlock(int ntx)
+{
+    CBlock block;
+    CMutableTransaction coinbase;
+    coinbase.vin.resize(1);
+    coinbase.vin[0].scriptSig = CScript() << 1 << OP_0;
+    coinbase.vout.emplace_back(50 * COIN, CScript() << OP_TRUE);
+    block.vtx.push_back(MakeTransactionRef(std::move(coinbase)));
+    for (int i = 1; i < ntx; i++) {
+        CMutableTransaction mtx;
+        mtx.vin.emplace_back(COutPoint(InsecureRand256(), 0));
+        mtx.vout.emplace_back(i, CScript() << OP_TRUE);
+        block.vtx.push_back(MakeTransactionRef(std::move(mtx)));
+    }
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    return block;
+}
+
+/** Check block as received from a peer (hashes deferred) and as hashed on deserialization; return the outcomes. */
+static std::pair<std::string, std::string> CheckDeferredBlock(const CBlock& block)
+{
+    std::pair<std::string, std::string> reasons;
+    CDataStream stream(SER_NETWORK, PROTOCOL_VERSION);
+    stream << block;
+    for (bool defer : {true, false}) {
+        CDataStream copy(stream);
+        copy.SetVersion(PROTOCOL_VERSION | (defer ? SERIALIZE_TRANSACTION_DEFER_HASH : 0));
+        CBlock received;
+        copy >> received;
+        BOOST_CHECK(received.vtx[0]->HasHashes() == !defer);
+        CValidationState state;
+        bool fValid = CheckBlock(received, state, Params().GetConsensus(), false);
+        BOOST_CHECK(fValid == state.IsValid());
+        for (size_t i = 0; i < block.vtx.size(); i++) {
+            BOOST_CHECK(received.vtx[i]->GetHash() == block.vtx[i]->GetHash());
+            BOOST_CHECK(received.vtx[i]->GetWitnessHash() == block.vtx[i]->GetWitnessHash());
+        }
+        (defer ? reasons.first : reasons.second) = state.GetRejectReason() + state.GetDebugMessage();
+    }
+    return reasons;
+}
+
+BOOST_AUTO_TEST_CASE(checkblock_deferred_hashes)
+{
+    // Valid, and small enough to be checked serially.
+    auto reasons = CheckDeferredBlock(MakeCheckBlock(10));
+    BOOST_CHECK_EQUAL(reasons.first, "");
+    BOOST_CHECK_EQUAL(reasons.second, "");
+
+    CBlock block = MakeCheckBlock(300);
+    reasons = CheckDeferredBlock(block);
+    BOOST_CHECK_EQUAL(reasons.first, "");
+    BOOST_CHECK_EQUAL(reasons.second, "");
+
+    // Duplicating the last transactions keeps the merkle root.
+    CBlock mutated = block;
+    for (int i = 0; i < 4; i++) {
+        mutated.vtx.push_back(mutated.vtx[296 + i]);
+    }
+    reasons = CheckDeferredBlock(mutated);
+    BOOST_CHECK_EQUAL(reasons.first, reasons.second);
+    BOOST_CHECK(reasons.first.find("bad-txns-duplicate") == 0);
+
+    CBlock merkle = block;
+    merkle.hashMerkleRoot = InsecureRand256();
+    reasons = CheckDeferredBlock(merkle);
+    BOOST_CHECK_EQUAL(reasons.first, reasons.second);
+    BOOST_CHECK(reasons.first.find("bad-txnmrklroot") == 0);
+
+    // The first invalid transaction is reported, whichever run it is in.
+    CBlock invalid = block;
+    for (int pos : {250, 150}) {
+        CMutableTransaction mtx(*invalid.vtx[pos]);
+        mtx.vout[0].nValue = -1;
+        invalid.vtx[pos] = MakeTransactionRef(std::move(mtx));
+    }
+    invalid.hashMerkleRoot = BlockMerkleRoot(invalid);
+    reasons = CheckDeferredBlock(invalid);
+    BOOST_CHECK_EQUAL(reasons.first, reasons.second);
+    BOOST_CHECK(reasons.first.find(invalid.vtx[150]->GetHash().ToString()) != std::string::npos);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -10,11 +10,16 @@
 #include <streams.h>
 #include <net.h>
 #include <netbase.h>
+#include <netmessagemaker.h>
 #include <chainparams.h>
 #include <util/system.h>
 
 #include <memory>
 
+#ifdef USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
 class CAddrManSerializationMock : public CAddrMan
 {
 public:
@@ -189,6 +194,307 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test)
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+static std::vector<unsigned char> MakeTestMessage(const std::vector<unsigned char>& payload, const char* pszCommand = NetMsgType::BLOCK)
+{
+    CMessageHeader hdr(Params().MessageStart(), pszCommand, payload.size());
+    uint256 hash = Hash(payload.begin(), payload.end());
+    memcpy(hdr.pchChecksum, hash.begin(), CMessageHeader::CHECKSUM_SIZE);
+    CDataStream ss(SER_NETWORK, INIT_PROTO_VERSION);
+    ss << hdr;
+    std::vector<unsigned char> msg(ss.begin(), ss.end());
+    msg.insert(msg.end(), payload.begin(), payload.end());
+    return msg;
+}
+
+BOOST_AUTO_TEST_CASE(cnetmessage_receive)
+{
+    for (size_t nSize : {0, 1000, 300000, 2000000}) {
+        std::vector<unsigned char> payload(nSize);
+        for (unsigned char& c : payload) c = InsecureRand32();
+        const std::vector<unsigned char> data = MakeTestMessage(payload);
+
+        // Received in chunks of any size, straight into the message where it allows.
+        for (bool fDirect : {false, true}) {
+            CNetMessage msg(Params().MessageStart(), SER_NETWORK, INIT_PROTO_VERSION);
+            size_t nPos = 0;
+            while (!msg.complete()) {
+                BOOST_REQUIRE(nPos < data.size());
+                unsigned int nBytes = 1 + InsecureRandRange(70000);
+                char* pch = fDirect ? msg.GetDataBuffer(0, nBytes) : nullptr;
+                if (pch) {
+                    BOOST_REQUIRE(nBytes > 0);
+                    nBytes = std::min<size_t>(std::min<size_t>(nBytes, 1 + InsecureRandRange(70000)), data.size() - nPos);
+                    memcpy(pch, data.data() + nPos, nBytes);
+                } else {
+                    nBytes = std::min<size_t>(nBytes, data.size() - nPos);
+                    pch = (char*)data.data() + nPos;
+                }
+                int handled = msg.in_data ? msg.readData(pch, nBytes) : msg.readHeader(pch, nBytes);
+                BOOST_REQUIRE(handled > 0);
+                nPos += handled;
+            }
+            BOOST_CHECK_EQUAL(nPos, data.size());
+            BOOST_CHECK_EQUAL(msg.hdr.GetCommand(), "block");
+            BOOST_CHECK(msg.GetMessageHash() == Hash(payload.begin(), payload.end()));
+            BOOST_CHECK(std::vector<unsigned char>(msg.vRecv.begin(), msg.vRecv.end()) == payload);
+            unsigned int nBytes;
+            BOOST_CHECK(!msg.GetDataBuffer(0, nBytes));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(cnode_receive_direct)
+{
+    CAddress addr(CService(CNetAddr(), 7777), NODE_NETWORK);
+    CNode node(0, NODE_NETWORK, 0, INVALID_SOCKET, addr, 0, 0, CAddress(), "", true);
+    std::vector<unsigned char> payload(200000);
+    for (unsigned char& c : payload) c = InsecureRand32();
+    const std::vector<unsigned char> data = MakeTestMessage(payload);
+
+    // Nothing to receive into before a message header is in.
+    unsigned int nBytes = 0;
+    BOOST_CHECK(!node.GetRecvBuffer(nBytes));
+    bool fComplete;
+    BOOST_CHECK(node.ReceiveMsgBytes((const char*)data.data(), CMessageHeader::HEADER_SIZE + 100, fComplete));
+    BOOST_CHECK(!fComplete);
+
+    size_t nPos = CMessageHeader::HEADER_SIZE + 100;
+    char* pch;
+    while ((pch = node.GetRecvBuffer(nBytes))) {
+        nBytes = std::min<size_t>(nBytes, 50000);
+        memcpy(pch, data.data() + nPos, nBytes);
+        BOOST_CHECK(node.ReceiveMsgBytes(pch, nBytes, fComplete));
+        nPos += nBytes;
+    }
+    // The tail of the message, under MIN_DIRECT_RECV_BYTES, is copied in.
+    BOOST_CHECK(!fComplete);
+    BOOST_CHECK(nPos < data.size());
+    BOOST_CHECK(node.ReceiveMsgBytes((const char*)data.data() + nPos, data.size() - nPos, fComplete));
+    BOOST_CHECK(fComplete);
+}
+
+BOOST_AUTO_TEST_CASE(message_buffer_pool)
+{
+    CNetMessageBufferPool pool;
+    CSerializeData buffer = pool.Get(1000);
+    BOOST_CHECK(buffer.empty());
+    BOOST_CHECK(buffer.capacity() >= 1000);
+    buffer.resize(1000);
+    const char* pBuffer = buffer.data();
+    pool.Put(std::move(buffer));
+
+    // A buffer comes back for requests its capacity covers, emptied.
+    CSerializeData reused = pool.Get(600);
+    BOOST_CHECK(reused.data() == pBuffer);
+    BOOST_CHECK(reused.empty());
+    BOOST_CHECK(pool.Get(600).data() != pBuffer);
+    pool.Put(std::move(reused));
+    BOOST_CHECK(pool.Get(2000).data() != pBuffer);
+
+    // Buffers too large to pool are dropped: the largest class stays empty,
+    // so a request for it gets a new buffer of just that size.
+    CSerializeData large;
+    large.reserve(CNetMessageBufferPool::MAX_BUFFER_SIZE * 2);
+    pool.Put(std::move(large));
+    const size_t nMaxSize = CNetMessageBufferPool::MAX_BUFFER_SIZE;
+    BOOST_CHECK_EQUAL(pool.Get(nMaxSize).capacity(), nMaxSize);
+}
+
+#ifndef WIN32
+BOOST_AUTO_TEST_CASE(send_queue)
+{
+    int fd[2];
+    BOOST_REQUIRE_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, fd), 0);
+    // Keep the socket buffer small, so that sends stop part way through messages
+    int nSendBuffer = 4096;
+    BOOST_CHECK_EQUAL(setsockopt(fd[0], SOL_SOCKET, SO_SNDBUF, &nSendBuffer, sizeof(nSendBuffer)), 0);
+
+    CConnmanTest connman(0x1337, 0x1337);
+    CAddress addr(CService(CNetAddr(), 7777), NODE_NETWORK);
+    std::unique_ptr<CNode> pnode = MakeUnique<CNode>(0, NODE_NETWORK, 0, fd[0], addr, 0, 0, CAddress(), "", true);
+    const CNetMsgMaker msgMaker(INIT_PROTO_VERSION);
+
+    std::vector<unsigned char> block(100000);
+    for (unsigned char& c : block) c = InsecureRand32();
+    std::shared_ptr<const CSharedNetMsgPayload> payload = msgMaker.Serialize(0, block);
+    BOOST_CHECK(payload->hash == Hash(payload->data.begin(), payload->data.end()));
+    // A payload borrowed from memory something else owns; the queue keeps the owner alive.
+    std::shared_ptr<const std::vector<unsigned char>> owner = std::make_shared<const std::vector<unsigned char>>(block.begin(), block.begin() + 30000);
+    const std::vector<unsigned char> borrowed(*owner);
+    std::weak_ptr<const std::vector<unsigned char>> weak_owner = owner;
+    std::shared_ptr<const CSharedNetMsgPayload> borrowed_payload = std::make_shared<const CSharedNetMsgPayload>(MakeSpan(*owner), std::move(owner));
+    BOOST_CHECK(borrowed_payload->data.empty());
+
+    // Owned, empty, shared and borrowed payloads, with many small messages queued behind a partial send
+    std::vector<unsigned char> expected;
+    for (int i = 0; i < 200; i++) {
+        std::vector<unsigned char> msg;
+        if (i % 50 == 1) {
+            connman.PushMessage(pnode.get(), CNetMsgMaker::MakeShared(NetMsgType::BLOCK, payload));
+            msg = MakeTestMessage(payload->data);
+        } else if (i == 120) {
+            connman.PushMessage(pnode.get(), CNetMsgMaker::MakeShared(NetMsgType::BLOCK, std::move(borrowed_payload)));
+            msg = MakeTestMessage(borrowed);
+        } else if (i % 10 == 2) {
+            connman.PushMessage(pnode.get(), msgMaker.Make(NetMsgType::VERACK));
+            msg = MakeTestMessage({}, NetMsgType::VERACK);
+        } else {
+            CDataStream ping(SER_NETWORK, INIT_PROTO_VERSION);
+            ping << (uint64_t)i;
+            connman.PushMessage(pnode.get(), msgMaker.Make(NetMsgType::PING, (uint64_t)i));
+            msg = MakeTestMessage(std::vector<unsigned char>(ping.begin(), ping.end()), NetMsgType::PING);
+        }
+        expected.insert(expected.end(), msg.begin(), msg.end());
+    }
+
+    // Everything arrives in order, however the sends were split up
+    std::vector<unsigned char> received;
+    for (int i = 0; i < 100000 && received.size() < expected.size(); i++) {
+        char buffer[5000];
+        int nBytes = recv(fd[1], buffer, sizeof(buffer), MSG_DONTWAIT);
+        if (nBytes > 0) {
+            received.insert(received.end(), buffer, buffer + nBytes);
+        } else {
+            connman.SocketSendData(*pnode);
+        }
+    }
+    BOOST_CHECK(received == expected);
+    {
+        LOCK(pnode->cs_vSend);
+        BOOST_CHECK(pnode->vSendMsg.empty());
+        BOOST_CHECK_EQUAL(pnode->nSendSize, 0U);
+        BOOST_CHECK_EQUAL(pnode->nSendBytes, expected.size());
+    }
+    BOOST_CHECK_EQUAL(payload.use_count(), 1);
+    BOOST_CHECK(weak_owner.expired());
+
+    pnode.reset();
+    close(fd[1]);
+}
+#endif
+
+#ifdef USE_EPOLL
+BOOST_AUTO_TEST_CASE(socket_events)
+{
+    int fd[2];
+    BOOST_REQUIRE_EQUAL(socketpair(AF_UNIX, SOCK_STREAM, 0, fd), 0);
+    CConnmanTest connman(0x1337, 0x1337);
+    CConnmanTest::SocketThread thread;
+    thread.epollfd = epoll_create1(EPOLL_CLOEXEC);
+    BOOST_REQUIRE(thread.epollfd >= 0);
+    CAddress addr(CService(CNetAddr(), 7777), NODE_NETWORK);
+    std::unique_ptr<CNode> pnode = MakeUnique<CNode>(0, NODE_NETWORK, 0, fd[0], addr, 0, 0, CAddress(), "", true);
+    const std::vector<unsigned char> msg = MakeTestMessage(std::vector<unsigned char>(100, 0x42));
+    struct epoll_event event;
+
+    // Registered, the socket is reported writable once: the events are edge-triggered
+    connman.UpdateSocketEvents(thread, pnode.get());
+    {
+        LOCK(pnode->cs_hSocket);
+        BOOST_CHECK_EQUAL(pnode->nSocketEpollFd, thread.epollfd);
+    }
+    BOOST_CHECK(pnode->nSocketEvents & EPOLLIN);
+    BOOST_REQUIRE_EQUAL(epoll_wait(thread.epollfd, &event, 1, 0), 1);
+    BOOST_CHECK(event.data.ptr == pnode.get());
+    BOOST_CHECK_EQUAL(event.events, (uint32_t)EPOLLOUT);
+    BOOST_CHECK_EQUAL(epoll_wait(thread.epollfd, &event, 1, 0), 0);
+
+    // A message received fills the process queue past the flood size (zero
+    // here), which pauses receiving: the socket stays registered without EPOLLIN.
+    BOOST_REQUIRE_EQUAL(send(fd[1], msg.data(), msg.size(), 0), (ssize_t)msg.size());
+    BOOST_REQUIRE_EQUAL(epoll_wait(thread.epollfd, &event, 1, 0), 1);
+    BOOST_CHECK(event.events & EPOLLIN);
+    connman.ServiceSocketEvents(thread, pnode.get(), event.events);
+    BOOST_CHECK(pnode->fPauseRecv);
+    BOOST_CHECK(!(pnode->nSocketEvents & EPOLLIN));
+    BOOST_CHECK_EQUAL(thread.setNodesPaused.count(pnode.get()), 1U);
+    {
+        LOCK(pnode->cs_vProcessMsg);
+        BOOST_CHECK_EQUAL(pnode->vProcessMsg.size(), 1U);
+    }
+
+    // Data arriving while paused is not reported...
+    BOOST_REQUIRE_EQUAL(send(fd[1], msg.data(), msg.size(), 0), (ssize_t)msg.size());
+    while (epoll_wait(thread.epollfd, &event, 1, 0) == 1) {
+        BOOST_CHECK(!(event.events & EPOLLIN));
+    }
+
+    // ...until the queue drains and receiving resumes, though its edge has passed.
+    {
+        LOCK(pnode->cs_vProcessMsg);
+        pnode->vProcessMsg.clear();
+        pnode->nProcessQueueSize = 0;
+        pnode->fPauseRecv = false;
+    }
+    connman.UpdateSocketEvents(thread, pnode.get());
+    BOOST_CHECK_EQUAL(thread.setNodesPaused.count(pnode.get()), 0U);
+    BOOST_REQUIRE_EQUAL(epoll_wait(thread.epollfd, &event, 1, 0), 1);
+    BOOST_CHECK(event.events & EPOLLIN);
+    connman.ServiceSocketEvents(thread, pnode.get(), event.events);
+    {
+        LOCK(pnode->cs_vProcessMsg);
+        BOOST_CHECK_EQUAL(pnode->vProcessMsg.size(), 1U);
+    }
+
+    // Disconnecting takes the socket out of epoll, even while another copy of
+    // it (as a child process could inherit) keeps it open.
+    int fdCopy = dup(fd[0]);
+    BOOST_REQUIRE(fdCopy >= 0);
+    pnode->CloseSocketDisconnect();
+    {
+        LOCK(pnode->cs_hSocket);
+        BOOST_CHECK_EQUAL(pnode->nSocketEpollFd, -1);
+    }
+    BOOST_REQUIRE_EQUAL(send(fd[1], msg.data(), msg.size(), 0), (ssize_t)msg.size());
+    BOOST_CHECK_EQUAL(epoll_wait(thread.epollfd, &event, 1, 0), 0);
+
+    close(fdCopy);
+    pnode.reset();
+    close(fd[1]);
+    close(thread.epollfd);
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(message_handler_wakes)
+{
+    CConnmanTest connman(0x1337, 0x1337);
+    uint64_t nWakesSeen[2] = {0, 0};
+    const std::chrono::milliseconds nowait(0);
+
+    // Nothing to see yet
+    BOOST_CHECK(!connman.WaitForMessageHandlerWake(nWakesSeen[0], nowait));
+
+    // One wakeup is seen by each thread, not taken by the first to look
+    connman.WakeMessageHandler();
+    BOOST_CHECK(connman.WaitForMessageHandlerWake(nWakesSeen[0], nowait));
+    BOOST_CHECK(!connman.WaitForMessageHandlerWake(nWakesSeen[0], nowait));
+    BOOST_CHECK(connman.WaitForMessageHandlerWake(nWakesSeen[1], nowait));
+    BOOST_CHECK(!connman.WaitForMessageHandlerWake(nWakesSeen[1], nowait));
+
+    // Several wakeups while a thread is busy are all seen at its next wait
+    connman.WakeMessageHandler();
+    connman.WakeMessageHandler();
+    BOOST_CHECK(connman.WaitForMessageHandlerWake(nWakesSeen[0], nowait));
+    BOOST_CHECK(!connman.WaitForMessageHandlerWake(nWakesSeen[0], nowait));
+
+    // Threads waiting at once are all woken by one wakeup, however they race
+    // for the lock: either each is waiting, or it finds the count moved on.
+    std::atomic<int> nWoken{0};
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; i++) {
+        const uint64_t nWakesBefore = nWakesSeen[0];
+        threads.emplace_back([&connman, &nWoken, nWakesBefore] {
+            uint64_t nWakes = nWakesBefore;
+            if (connman.WaitForMessageHandlerWake(nWakes, std::chrono::seconds(60))) nWoken++;
+        });
+    }
+    connman.WakeMessageHandler();
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    BOOST_CHECK_EQUAL(nWoken, 4);
+}
+
 // prior to PR #14728, this test triggers an undefined behavior
 BOOST_AUTO_TEST_CASE(ipv4_peer_with_ipv6_addrMe_test)
 {
@@ -2,14 +2,19 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include <arith_uint256.h>
 #include <chain.h>
 #include <chainparams.h>
+#include <checkqueue.h>
 #include <pow.h>
+#include <primitives/block.h>
 #include <random.h>
 #include <util/system.h>
+#include <validation.h>
 #include <test/test_bitcoin.h>
 
 #include <boost/test/unit_test.hpp>
+#include <boost/thread/thread.hpp>
 
 BOOST_FIXTURE_TEST_SUITE(pow_tests, BasicTestingSetup)
 
@@ -83,4 +88,235 @@ BOOST_AUTO_TEST_CASE(GetBlockProofEquivalentTime_test)
     }
 }
 
+BOOST_AUTO_TEST_CASE(block_hash_cache)
+{
+    CBlockHeader header;
+    header.nVersion = 1;
+    header.hashPrevBlock = InsecureRand256();
+    header.hashMerkleRoot = InsecureRand256();
+    header.nTime = 1500000000;
+    header.nBits = 0x207fffff;
+    header.nNonce = 42;
+
+    uint64_t count = GetBlockHashCount();
+    const uint256 hash = header.GetHash();
+    BOOST_CHECK_EQUAL(GetBlockHashCount(), count + 1);
+    BOOST_CHECK(header.GetHash() == hash);
+    BOOST_CHECK(header.GetPoWHash() == hash);
+    BOOST_CHECK_EQUAL(GetBlockHashCount(), count + 1);
+
+    // Copies carry the memoized hash
+    CBlock block(header);
+    BOOST_CHECK(block.GetHash() == hash);
+    BOOST_CHECK(block.GetBlockHeader().GetHash() == hash);
+    BOOST_CHECK_EQUAL(GetBlockHashCount(), count + 1);
+
+    // Changing a field without invalidating still yields the right hash
+    header.nNonce++;
+    const uint256 hash2 = header.GetHash();
+    BOOST_CHECK(hash2 != hash);
+    BOOST_CHECK_EQUAL(GetBlockHashCount(), count + 2);
+    header.nNonce--;
+    BOOST_CHECK(header.GetHash() == hash);
+    BOOST_CHECK_EQUAL(GetBlockHashCount(), count + 3);
+
+    header.InvalidateHash();
+    BOOST_CHECK(header.GetHash() == hash);
+    BOOST_CHECK_EQUAL(GetBlockHashCount(), count + 4);
+
+    SetBlockHashCache(false);
+    CBlockHeader uncached(header);
+    uncached.InvalidateHash();
+    BOOST_CHECK(uncached.GetHash() == hash);
+    BOOST_CHECK(uncached.GetHash() == hash);
+    BOOST_CHECK_EQUAL(GetBlockHashCount(), count + 6);
+    SetBlockHashCache(true);
+}
+
+BOOST_AUTO_TEST_CASE(header_hash_batch)
+{
+    std::vector<CBlockHeader> headers(100);
+    std::vector<uint256> expected;
+    for (CBlockHeader& header : headers) {
+        header.nVersion = 1;
+        header.hashPrevBlock = InsecureRand256();
+        header.hashMerkleRoot = InsecureRand256();
+        header.nTime = 1500000000;
+        header.nBits = 0x207fffff;
+        header.nNonce = InsecureRand32();
+        expected.push_back(CBlockHeader(header).GetHash());
+        header.InvalidateHash();
+    }
+
+    CCheckQueue<CHeaderHashCheck> queue{16};
+    boost::thread_group tg;
+    for (int i = 0; i < 3; ++i) {
+        tg.create_thread([&]{queue.Thread();});
+    }
+    HashBlockHeaders(headers, &queue);
+    tg.interrupt_all();
+    tg.join_all();
+
+    // Every header is memoized now, so no further scrypt work is done
+    uint64_t count = GetBlockHashCount();
+    for (size_t i = 0; i < headers.size(); ++i) {
+        BOOST_CHECK(headers[i].GetHash() == expected[i]);
+    }
+    BOOST_CHECK_EQUAL(GetBlockHashCount(), count);
+}
+
+static const CBlockIndex* WalkLastBlockIndex(const CBlockIndex* pindex, bool fProofOfStake)
+{
+    while (pindex && pindex->pprev && (pindex->IsProofOfStake() != fProofOfStake))
+        pindex = pindex->pprev;
+    return pindex;
+}
+
+static const CBlockIndex* WalkLastBlockIndex2(const CBlockIndex* pindex, bool fFlashStake)
+{
+    const Consensus::Params& params = Params().GetConsensus();
+    if (pindex->nHeight >= params.V222Height) {
+        while (pindex && pindex->pprev && !pindex->IsFPOS(fFlashStake))
+            pindex = pindex->pprev;
+    } else {
+        while (pindex && pindex->pprev && params.IsFlashStake(pindex->nTime) != fFlashStake)
+            pindex = pindex->pprev;
+        while (pindex && pindex->pprev && (!pindex->IsProofOfStake()))
+            pindex = pindex->pprev;
+    }
+    return pindex;
+}
+
+BOOST_AUTO_TEST_CASE(last_block_index_links)
+{
+    // Mixed chain of PoW and (flash) PoS stretches straddling V222Height,
+    // with a PoS-only run at the start so early lookups end at genesis.
+    std::vector<CBlockIndex> blocks(3000);
+    int nHeightStart = Params().GetConsensus().V222Height - 1500;
+    uint32_t nTime = 1546300800;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        blocks[i].pprev = i ? &blocks[i - 1] : nullptr;
+        blocks[i].nHeight = i ? nHeightStart + i : 0;
+        nTime += 30 + InsecureRandRange(600);
+        blocks[i].nTime = nTime;
+        if (i > 0 && (i < 100 || InsecureRandRange(8) != 0)) {
+            blocks[i].SetProofOfStake();
+        }
+        blocks[i].BuildPrevAlgo();
+    }
+
+    for (const CBlockIndex& block : blocks) {
+        for (bool f : {false, true}) {
+            BOOST_CHECK_EQUAL(GetLastBlockIndex(&block, f), WalkLastBlockIndex(&block, f));
+            BOOST_CHECK_EQUAL(GetLastBlockIndex2(&block, f), WalkLastBlockIndex2(&block, f));
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(target_cache)
+{
+    const Consensus::Params& params = Params().GetConsensus();
+    std::vector<CBlockIndex> blocks(200);
+    uint32_t nTime = 1546300800;
+    for (size_t i = 0; i < blocks.size(); i++) {
+        blocks[i].pprev = i ? &blocks[i - 1] : nullptr;
+        // Spans the switch from GetNextTargetRequiredV1 to V2.
+        blocks[i].nHeight = i ? 817900 + i : 0;
+        blocks[i].nTime = nTime += 60 + InsecureRandRange(300);
+        blocks[i].nBits = UintToArith256(params.powLimit).GetCompact() - InsecureRandRange(0x10000);
+        if (i > 0 && InsecureRandBool()) {
+            blocks[i].SetProofOfStake();
+        }
+        blocks[i].BuildPrevAlgo();
+    }
+
+    TargetCache cache;
+    CBlockHeader header;
+    for (size_t i = 2; i < blocks.size(); i++) {
+        // Siblings inside and outside flash windows, queried twice.
+        for (int n = 0; n < 8; n++) {
+            header.nTime = blocks[i].nTime + 60 + (n % 4) * 3600;
+            for (bool fProofOfStake : {false, true}) {
+                BOOST_CHECK_EQUAL(GetNextTargetRequired(&blocks[i], &header, params, fProofOfStake, cache),
+                                  GetNextTargetRequired(&blocks[i], &header, params, fProofOfStake));
+            }
+        }
+    }
+    BOOST_CHECK_EQUAL(cache.targets.size(), blocks.size() - 2);
+    cache.Clear();
+    BOOST_CHECK(cache.targets.empty());
+}
+
+static uint32_t WalkBaseStakeBits(const CBlockIndex* pindexBase)
+{
+    const CBlockIndex* pindex = pindexBase->GetAncestor((pindexBase->nHeight & ~1023) - 1024);
+    uint32_t nBestBits = 0;
+    for (int i = 0; i < 1024 && pindex; ++i) {
+        if (pindex->nBits < nBestBits || nBestBits == 0) {
+            nBestBits = pindex->nBits;
+        }
+        pindex = pindex->pprev;
+    }
+    return nBestBits;
+}
+
+BOOST_AUTO_TEST_CASE(stake_trust_window)
+{
+    // Two branches forking inside the stake trust window of height 4096.
+    std::vector<uint256> hashes(9000);
+    std::vector<CBlockIndex> vMain(5000), vFork(4000);
+    for (size_t i = 0; i < vMain.size() + vFork.size(); i++) {
+        bool fFork = i >= vMain.size();
+        size_t nHeight = fFork ? 3000 + (i - vMain.size()) : i;
+        CBlockIndex& block = fFork ? vFork[i - vMain.size()] : vMain[i];
+        hashes[i] = InsecureRand256();
+        block.phashBlock = &hashes[i];
+        block.pprev = nHeight == 0 ? nullptr : fFork && nHeight > 3000 ? &vFork[i - vMain.size() - 1] : &vMain[nHeight - 1];
+        block.nHeight = nHeight;
+        block.nBits = 0x1c000000 + InsecureRandRange(0x100000);
+        block.BuildSkip();
+    }
+
+    // Validate the branches alternately, as when competing headers interleave.
+    for (int nHeight = 1; nHeight < 5000; nHeight += 37) {
+        for (const std::vector<CBlockIndex>* branch : {&vMain, &vFork}) {
+            CBlockIndex* pindexBase = branch == &vMain ? &vMain[nHeight] : nHeight > 3000 ? &vFork[nHeight - 3000] : &vMain[nHeight];
+            arith_uint256 bnStakeTrust, bnTarget, bnExpected;
+            GetModTrust(bnStakeTrust, bnTarget, pindexBase, 0, true, false);
+            bnExpected.SetCompact(WalkBaseStakeBits(pindexBase));
+            BOOST_CHECK(bnStakeTrust == bnExpected);
+        }
+    }
+}
+
+static bool GmtimeIsFlashStake(const Consensus::Params& params, uint32_t nTime)
+{
+    struct tm ts;
+    time_t time_val = nTime;
+#ifdef _MSC_VER
+    gmtime_s(&ts, &time_val);
+#else
+    gmtime_r(&time_val, &ts);
+#endif
+    uint32_t nHour = ts.tm_hour;
+    return nHour == params.nHour1 || nHour == params.nHour2 || nHour == params.nHour3 || nHour == params.nHour4;
+}
+
+BOOST_AUTO_TEST_CASE(flash_stake_hour_mask)
+{
+    // Compare against the calendar at both edges of every hour of the
+    // 32-bit time range, plus a random second inside it.
+    const Consensus::Params& params = Params().GetConsensus();
+    const uint64_t nEnd = uint64_t{1} << 32;
+    for (uint64_t nHourStart = 0; nHourStart < nEnd; nHourStart += 3600) {
+        const uint32_t nLast = std::min(nHourStart + 3599, nEnd - 1);
+        for (uint32_t nTime : {(uint32_t)nHourStart, nLast, (uint32_t)(nHourStart + InsecureRandRange(nLast - nHourStart + 1))}) {
+            if (params.IsFlashStake(nTime) != GmtimeIsFlashStake(params, nTime)) {
+                BOOST_ERROR("IsFlashStake mismatch at " << nTime);
+                return;
+            }
+        }
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -113,6 +113,28 @@ BOOST_AUTO_TEST_CASE(streams_vector_reader)
     BOOST_CHECK_THROW(new_reader >> d, std::ios_base::failure);
 }
 
+BOOST_AUTO_TEST_CASE(streams_span_reader)
+{
+    const std::vector<unsigned char> vch = {1, 255, 3, 4, 5, 6};
+    const Span<const unsigned char> span(vch.data(), vch.size());
+
+    // Start past the first byte.
+    SpanReader reader(SER_NETWORK, INIT_PROTO_VERSION, span, 1);
+    BOOST_CHECK_EQUAL(reader.size(), 5);
+    signed char b;
+    reader >> b;
+    BOOST_CHECK_EQUAL(b, -1);
+
+    unsigned int c;
+    reader >> c;
+    BOOST_CHECK_EQUAL(c, 100992003); // 3,4,5,6 in little-endian base-256
+    BOOST_CHECK(reader.empty());
+
+    // Reading after the end of the span throws an error.
+    BOOST_CHECK_THROW(reader >> b, std::ios_base::failure);
+    BOOST_CHECK_THROW(SpanReader(SER_NETWORK, INIT_PROTO_VERSION, span, 7), std::ios_base::failure);
+}
+
 BOOST_AUTO_TEST_CASE(bitstream_reader_writer)
 {
     CDataStream data(SER_NETWORK, INIT_PROTO_VERSION);
@@ -8,6 +8,7 @@
 #include <chainparamsbase.h>
 #include <fs.h>
 #include <key.h>
+#include <net.h>
 #include <pubkey.h>
 #include <random.h>
 #include <scheduler.h>
@@ -68,11 +69,38 @@ private:
     const fs::path m_path_root;
 };
 
+/** Access to CConnman internals for tests. */
+struct CConnmanTest : public CConnman {
+    using CConnman::CConnman;
+    void AddNode(CNode& node)
+    {
+        LOCK(cs_vNodes);
+        vNodes.push_back(&node);
+    }
+    void ClearNodes()
+    {
+        LOCK(cs_vNodes);
+        for (CNode* node : vNodes) {
+            delete node;
+        }
+        vNodes.clear();
+    }
+    size_t SocketSendData(CNode& node)
+    {
+        LOCK(node.cs_vSend);
+        return CConnman::SocketSendData(&node);
+    }
+    using CConnman::WaitForMessageHandlerWake;
+#ifdef USE_EPOLL
+    using CConnman::SocketThread;
+    using CConnman::UpdateSocketEvents;
+    using CConnman::ServiceSocketEvents;
+#endif
+};
+
 /** Testing setup that configures a complete environment.
  * Included are data directory, coins database, script check threads setup.
  */
-class CConnman;
-class CNode;
 
 class PeerLogicValidation;
 struct TestingSetup : public BasicTestingSetup {
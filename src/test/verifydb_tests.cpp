@@ -0,0 +1,111 @@
+// Copyright (c) 2019 The Bitcoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include <chain.h>
+#include <chainparams.h>
+#include <miner.h>
+#include <pow.h>
+#include <script/script.h>
+#include <test/test_bitcoin.h>
+#include <util/time.h>
+#include <validation.h>
+
+#include <boost/test/unit_test.hpp>
+
+/** A regtest chain of 100 blocks, each two minutes after the last, as their times must increase */
+struct VerifyDBSetup : public TestingSetup
+{
+    VerifyDBSetup() : TestingSetup(CBaseChainParams::REGTEST)
+    {
+        const CChainParams& chainparams = Params();
+        int64_t nTime = chainparams.GenesisBlock().GetBlockTime();
+        for (int i = 0; i < 100; i++) {
+            nTime += 120;
+            SetMockTime(nTime);
+            std::unique_ptr<CBlockTemplate> pblocktemplate = BlockAssembler(chainparams).CreateNewBlock(CScript() << OP_TRUE);
+            CBlock& block = pblocktemplate->block;
+            {
+                LOCK(cs_main);
+                unsigned int extraNonce = 0;
+                IncrementExtraNonce(&block, chainActive.Tip(), extraNonce);
+            }
+            while (!CheckProofOfWork(block.GetPoWHash(), block.nBits, chainparams.GetConsensus())) ++block.nNonce;
+            BOOST_REQUIRE(ProcessNewBlock(chainparams, std::make_shared<const CBlock>(block), true, nullptr));
+        }
+    }
+
+    ~VerifyDBSetup()
+    {
+        SetMockTime(0);
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(verifydb_tests, VerifyDBSetup)
+
+/** Flip a byte of a block's header on disk, so that it no longer reads back as the block */
+static void FlipBlockByte(const CBlockIndex* pindex)
+{
+    FILE* file = OpenBlockFile(pindex->GetBlockPos());
+    BOOST_REQUIRE(file);
+    unsigned char ch = 0;
+    const long nPos = ftell(file) + 4;
+    BOOST_REQUIRE_EQUAL(fseek(file, nPos, SEEK_SET), 0);
+    BOOST_REQUIRE_EQUAL(fread(&ch, 1, 1, file), 1U);
+    ch ^= 0xff;
+    BOOST_REQUIRE_EQUAL(fseek(file, nPos, SEEK_SET), 0);
+    BOOST_REQUIRE_EQUAL(fwrite(&ch, 1, 1, file), 1U);
+    fclose(file);
+}
+
+BOOST_AUTO_TEST_CASE(verifydb_reports_first_failure_in_chain_order)
+{
+    const CChainParams& chainparams = Params();
+    CBlockIndex* pindexFirst;
+    CBlockIndex* pindexSecond;
+    {
+        LOCK(cs_main);
+        BOOST_REQUIRE_EQUAL(chainActive.Height(), 100);
+        pindexFirst = chainActive[90];
+        pindexSecond = chainActive[70];
+    }
+
+    {
+        CVerifyDB verifier;
+        BOOST_CHECK(verifier.VerifyDB(chainparams, pcoinsTip.get(), 3, 100));
+        BOOST_CHECK(verifier.pindexFailed == nullptr);
+    }
+
+    // The blocks of a window are checked over the block check threads in any
+    // order, but the failure reported is the first walking back from the
+    // tip, as when they were checked one at a time.
+    FlipBlockByte(pindexFirst);
+    FlipBlockByte(pindexSecond);
+    for (int nCheckLevel = 0; nCheckLevel <= 3; nCheckLevel++) {
+        CVerifyDB verifier;
+        BOOST_CHECK(!verifier.VerifyDB(chainparams, pcoinsTip.get(), nCheckLevel, 100));
+        BOOST_CHECK(verifier.pindexFailed == pindexFirst);
+    }
+
+    FlipBlockByte(pindexFirst);
+    {
+        CVerifyDB verifier;
+        BOOST_CHECK(!verifier.VerifyDB(chainparams, pcoinsTip.get(), 3, 100));
+        BOOST_CHECK(verifier.pindexFailed == pindexSecond);
+    }
+
+    // Blocks deeper than the check depth are not read
+    {
+        CVerifyDB verifier;
+        BOOST_CHECK(verifier.VerifyDB(chainparams, pcoinsTip.get(), 3, 100 - pindexSecond->nHeight));
+        BOOST_CHECK(verifier.pindexFailed == nullptr);
+    }
+
+    FlipBlockByte(pindexSecond);
+    {
+        CVerifyDB verifier;
+        BOOST_CHECK(verifier.VerifyDB(chainparams, pcoinsTip.get(), 3, 100));
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -12,10 +12,15 @@
 #include <shutdown.h>
 #include <uint256.h>
 #include <util/system.h>
+#include <util/time.h>
 #include <ui_interface.h>
 
 #include <stdint.h>
 
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
 #include <boost/thread.hpp>
 
 static const char DB_COIN = 'C';
@@ -28,6 +33,7 @@ static const char DB_HEAD_BLOCKS = 'H';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_UPGRADE_MARKER = 'U';
 
 namespace {
 
@@ -53,19 +59,73 @@ struct CoinEntry {
 
 }
 
-CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true)
+CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true), fWriting(false), fWriteFailed(false), fStopWriter(false)
 {
 }
 
+CCoinsViewDB::~CCoinsViewDB()
+{
+    if (threadWriter.joinable()) {
+        {
+            LOCK(cs_write);
+            fStopWriter = true;
+        }
+        condWrite.notify_all();
+        threadWriter.join();
+    }
+}
+
+int CCoinsViewDB::FindWriting(const COutPoint &outpoint, Coin *coin) const
+{
+    if (!fWriting) return -1;
+    CCoinsMap::const_iterator it = mapWriting->find(outpoint);
+    if (it == mapWriting->end() || !(it->second.flags & CCoinsCacheEntry::DIRTY)) return -1;
+    if (it->second.coin.IsSpent()) return 0;
+    if (coin) *coin = it->second.coin;
+    return 1;
+}
+
 bool CCoinsViewDB::GetCoin(const COutPoint &outpoint, Coin &coin) const {
+    {
+        LOCK(cs_write);
+        int nFound = FindWriting(outpoint, &coin);
+        if (nFound >= 0) return nFound;
+    }
     return db.Read(CoinEntry(&outpoint), coin);
 }
 
+bool CCoinsViewDB::GetCoinAt(const COutPoint &outpoint, Coin &coin, const leveldb::Snapshot* snapshot) const {
+    return db.Read(CoinEntry(&outpoint), coin, snapshot);
+}
+
 bool CCoinsViewDB::HaveCoin(const COutPoint &outpoint) const {
+    {
+        LOCK(cs_write);
+        int nFound = FindWriting(outpoint, nullptr);
+        if (nFound >= 0) return nFound;
+    }
     return db.Exists(CoinEntry(&outpoint));
 }
 
+bool CCoinsViewDB::HaveAnyCoin(const std::vector<COutPoint> &outpoints) const {
+    std::vector<CoinEntry> keys;
+    keys.reserve(outpoints.size());
+    {
+        LOCK(cs_write);
+        for (const COutPoint& outpoint : outpoints) {
+            int nFound = FindWriting(outpoint, nullptr);
+            if (nFound > 0) return true;
+            if (nFound < 0) keys.emplace_back(&outpoint);
+        }
+    }
+    return db.ExistsAny(keys);
+}
+
 uint256 CCoinsViewDB::GetBestBlock() const {
+    {
+        LOCK(cs_write);
+        if (fWriting) return hashWriting;
+    }
     uint256 hashBestChain;
     if (!db.Read(DB_BEST_BLOCK, hashBestChain))
         return uint256();
@@ -73,6 +133,7 @@ uint256 CCoinsViewDB::GetBestBlock() const {
 }
 
 std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
+    WaitForWrite();
     std::vector<uint256> vhashHeadBlocks;
     if (!db.Read(DB_HEAD_BLOCKS, vhashHeadBlocks)) {
         return std::vector<uint256>();
@@ -81,6 +142,30 @@ std::vector<uint256> CCoinsViewDB::GetHeadBlocks() const {
 }
 
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
+    if (!WaitForWrite()) {
+        return false;
+    }
+    ++nWritesStarted;
+    if (!threadWriter.joinable()) {
+        bool ret = WriteCoins(mapCoins, hashBlock);
+        ++nWritesCommitted;
+        mapCoins.clear();
+        return ret;
+    }
+    {
+        LOCK(cs_write);
+        // Moving the map takes its nodes over without copying them. (The
+        // hasher has const members, so maps cannot be swapped or assigned.)
+        mapWriting.reset(new CCoinsMap(std::move(mapCoins)));
+        mapCoins.clear();
+        hashWriting = hashBlock;
+        fWriting = true;
+    }
+    condWrite.notify_all();
+    return true;
+}
+
+bool CCoinsViewDB::WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock) {
     CDBBatch batch(db);
     size_t count = 0;
     size_t changed = 0;
@@ -88,10 +173,13 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     int crash_simulate = gArgs.GetArg("-dbcrashratio", 0);
     assert(!hashBlock.IsNull());
 
-    uint256 old_tip = GetBestBlock();
-    if (old_tip.IsNull()) {
+    // Read the markers directly: GetBestBlock() would report the block
+    // being written here.
+    uint256 old_tip;
+    if (!db.Read(DB_BEST_BLOCK, old_tip)) {
         // We may be in the middle of replaying.
-        std::vector<uint256> old_heads = GetHeadBlocks();
+        std::vector<uint256> old_heads;
+        db.Read(DB_HEAD_BLOCKS, old_heads);
         if (old_heads.size() == 2) {
             assert(old_heads[0] == hashBlock);
             old_tip = old_heads[1];
@@ -105,7 +193,9 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     batch.Erase(DB_BEST_BLOCK);
     batch.Write(DB_HEAD_BLOCKS, std::vector<uint256>{hashBlock, old_tip});
 
-    for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
+    // The map is left intact (it may be read concurrently while a background
+    // write is in progress); the caller discards it afterwards.
+    for (CCoinsMap::const_iterator it = mapCoins.begin(); it != mapCoins.end(); ++it) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
             CoinEntry entry(&it->first);
             if (it->second.coin.IsSpent())
@@ -115,8 +205,6 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
             changed++;
         }
         count++;
-        CCoinsMap::iterator itOld = it++;
-        mapCoins.erase(itOld);
         if (batch.SizeEstimate() > batch_size) {
             LogPrint(BCLog::COINDB, "Writing partial batch of %.2f MiB\n", batch.SizeEstimate() * (1.0 / 1048576.0));
             db.WriteBatch(batch);
@@ -141,6 +229,66 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     return ret;
 }
 
+void CCoinsViewDB::StartBackgroundWrites()
+{
+    if (!threadWriter.joinable()) {
+        threadWriter = std::thread([this] { TraceThread("coinswriter", [this] { ThreadWriter(); }); });
+    }
+}
+
+bool CCoinsViewDB::IsWriting() const
+{
+    LOCK(cs_write);
+    return fWriting;
+}
+
+bool CCoinsViewDB::WaitForWrite() const
+{
+    WAIT_LOCK(cs_write, lock);
+    condWrite.wait(lock, [this]() EXCLUSIVE_LOCKS_REQUIRED(cs_write) { return !fWriting; });
+    return !fWriteFailed;
+}
+
+void CCoinsViewDB::ThreadWriter()
+{
+    while (true) {
+        uint256 hashBlock;
+        const CCoinsMap* pmapCoins;
+        {
+            WAIT_LOCK(cs_write, lock);
+            condWrite.wait(lock, [this]() EXCLUSIVE_LOCKS_REQUIRED(cs_write) { return fStopWriter || fWriting; });
+            // Finish a pending write before stopping.
+            if (!fWriting) return;
+            hashBlock = hashWriting;
+            pmapCoins = mapWriting.get();
+        }
+
+        // The map is not modified until fWriting is cleared, so it can be
+        // read here without the lock while lookups search it concurrently.
+        const int64_t nStart = GetTimeMicros();
+        bool fOk = false;
+        try {
+            fOk = WriteCoins(*pmapCoins, hashBlock);
+        } catch (const std::runtime_error& e) {
+            LogPrintf("Error writing to coin database: %s\n", e.what());
+        }
+        if (!fOk) {
+            uiInterface.ThreadSafeMessageBox(_("Error writing to database, shutting down."), "", CClientUIInterface::MSG_ERROR);
+            StartShutdown();
+        }
+        LogPrint(BCLog::COINDB, "Background write of best block %s took %.2fms\n", hashBlock.ToString(), (GetTimeMicros() - nStart) * 0.001);
+        ++nWritesCommitted;
+
+        {
+            LOCK(cs_write);
+            mapWriting.reset();
+            fWriting = false;
+            fWriteFailed |= !fOk;
+        }
+        condWrite.notify_all();
+    }
+}
+
 size_t CCoinsViewDB::EstimateSize() const
 {
     return db.EstimateSize(DB_COIN, (char)(DB_COIN+1));
@@ -170,6 +318,8 @@ bool CBlockTreeDB::ReadLastBlockFile(int &nFile) {
 
 CCoinsViewCursor *CCoinsViewDB::Cursor() const
 {
+    // The cursor iterates the database itself, which must be up to date.
+    WaitForWrite();
     CCoinsViewDBCursor *i = new CCoinsViewDBCursor(const_cast<CDBWrapper&>(db).NewIterator(), GetBestBlock());
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
@@ -259,8 +409,10 @@ bool CBlockTreeDB::LoadBlockIndexGuts(const Consensus::Params& consensusParams,
         if (pcursor->GetKey(key) && key.first == DB_BLOCK_INDEX) {
             CDiskBlockIndex diskindex;
             if (pcursor->GetValue(diskindex)) {
-                // Construct block index object
-                CBlockIndex* pindexNew = insertBlockIndex(diskindex.GetBlockHash());
+                // Construct block index object. The entry is keyed by its
+                // block hash, so there is no need to rerun scrypt on the
+                // header; -verifyblockindex rechecks the keys if desired.
+                CBlockIndex* pindexNew = insertBlockIndex(key.second);
                 pindexNew->pprev          = insertBlockIndex(diskindex.hashPrev);
                 pindexNew->nHeight        = diskindex.nHeight;
                 pindexNew->nFile          = diskindex.nFile;
@@ -278,7 +430,7 @@ bool CBlockTreeDB::LoadBlockIndexGuts(const Consensus::Params& consensusParams,
 
                 // [PINK] Litecoin uses the sha256 hash for the block index for performance reasons
                 // [PINK] so it does not check PoW here (old Pinkcoin code neither I think).
-                // [PINK] TODO: Remove that check?
+                // [PINK] This compares the stored hash against nBits only and is cheap.
                 if (pindexNew->IsProofOfWork()) {
                     if (!CheckProofOfWork(pindexNew->GetBlockHash(), pindexNew->nBits, consensusParams))
                         return error("%s: CheckProofOfWork failed: %s", __func__, pindexNew->ToString());
@@ -371,70 +523,183 @@ public:
 
 }
 
+namespace {
+
+//! Number of key-range partitions the upgrade splits the legacy records into.
+//! Fixed (rather than derived from the thread count) so that the progress
+//! markers left by an interrupted upgrade stay meaningful on the next start.
+static const int UPGRADE_PARTITIONS = 16;
+
+//! First txid in the given partition; partitions are keyed on the top nibble
+//! of the first serialized byte of the txid.
+uint256 UpgradePartitionStart(int partition)
+{
+    uint256 hash;
+    *hash.begin() = partition << 4;
+    return hash;
+}
+
+//! One past the last txid in the given partition (inclusive for the last one).
+uint256 UpgradePartitionEnd(int partition)
+{
+    if (partition + 1 < UPGRADE_PARTITIONS) return UpgradePartitionStart(partition + 1);
+    uint256 hash;
+    memset(hash.begin(), 0xff, hash.size());
+    return hash;
+}
+
+bool InUpgradePartition(const std::pair<unsigned char, uint256>& key, int partition)
+{
+    return key.first == DB_COINS && (*key.second.begin() >> 4) == partition;
+}
+
+/** Shared state of the upgrade workers. */
+struct CoinsUpgradeState {
+    std::atomic<int> next_partition{0};
+    std::atomic<int64_t> txs{0};
+    std::atomic<int64_t> outputs{0};
+    std::atomic<int64_t> bytes{0};
+    //! Per-partition progress, as the 16 bits following the partition nibble.
+    std::atomic<uint32_t> position[UPGRADE_PARTITIONS];
+    std::atomic<bool> failed{false};
+    std::atomic<int> finished{0};
+
+    CoinsUpgradeState()
+    {
+        for (auto& pos : position) pos = 0;
+    }
+};
+
+/**
+ * Convert the legacy records of one partition. Every batch also records the
+ * last converted key under DB_UPGRADE_MARKER, so an interrupted upgrade resumes
+ * where it stopped instead of scanning the erased (but not yet compacted)
+ * records again.
+ */
+bool UpgradePartition(CDBWrapper& db, int partition, CoinsUpgradeState& state)
+{
+    const std::pair<unsigned char, uint8_t> marker_key{DB_UPGRADE_MARKER, (uint8_t)partition};
+    std::pair<unsigned char, uint256> key{DB_COINS, UpgradePartitionStart(partition)};
+    uint256 marker;
+    if (db.Read(marker_key, marker)) {
+        key.second = marker;
+    }
+    std::pair<unsigned char, uint256> prev_key = key;
+
+    std::unique_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(key);
+    const size_t batch_size = 1 << 24;
+    CDBBatch batch(db);
+    bool dirty = false;
+    while (pcursor->Valid() && !ShutdownRequested() && !state.failed) {
+        std::pair<unsigned char, uint256> next;
+        if (!pcursor->GetKey(next) || !InUpgradePartition(next, partition)) {
+            break;
+        }
+        key = next;
+        CCoins old_coins;
+        if (!pcursor->GetValue(old_coins)) {
+            state.failed = true;
+            return error("%s: cannot parse CCoins record", __func__);
+        }
+        state.bytes += pcursor->GetValueSize();
+        COutPoint outpoint(key.second, 0);
+        for (size_t i = 0; i < old_coins.vout.size(); ++i) {
+            if (!old_coins.vout[i].IsNull() && !old_coins.vout[i].scriptPubKey.IsUnspendable()) {
+                Coin newcoin(std::move(old_coins.vout[i]), old_coins.nHeight, old_coins.fCoinBase, old_coins.fCoinStake, old_coins.nTime);
+                outpoint.n = i;
+                CoinEntry entry(&outpoint);
+                batch.Write(entry, newcoin);
+                ++state.outputs;
+            }
+        }
+        batch.Erase(key);
+        dirty = true;
+        ++state.txs;
+        if (batch.SizeEstimate() > batch_size) {
+            batch.Write(marker_key, key.second);
+            db.WriteBatch(batch);
+            batch.Clear();
+            dirty = false;
+            db.CompactRange(prev_key, key);
+            prev_key = key;
+        }
+        state.position[partition] = ((*key.second.begin() & 0x0f) << 12) | (*(key.second.begin() + 1) << 4) | (*(key.second.begin() + 2) >> 4);
+        pcursor->Next();
+    }
+    if (dirty) {
+        batch.Write(marker_key, key.second);
+        db.WriteBatch(batch);
+    }
+    if (ShutdownRequested() || state.failed) {
+        return false;
+    }
+    // Partition done; the marker is no longer needed.
+    db.Erase(marker_key);
+    db.CompactRange(prev_key, std::pair<unsigned char, uint256>{DB_COINS, UpgradePartitionEnd(partition)});
+    state.position[partition] = 1 << 16;
+    return true;
+}
+
+}
+
 /** Upgrade the database from older formats.
  *
  * Currently implemented: from the per-tx utxo model (0.8..0.14.x) to per-txout.
+ *
+ * The legacy records are split into UPGRADE_PARTITIONS disjoint txid ranges
+ * that nThreads workers convert concurrently; see UpgradePartition.
  */
-bool CCoinsViewDB::Upgrade() {
+bool CCoinsViewDB::Upgrade(int nThreads) {
     std::unique_ptr<CDBIterator> pcursor(db.NewIterator());
     pcursor->Seek(std::make_pair(DB_COINS, uint256()));
-    if (!pcursor->Valid()) {
+    std::pair<unsigned char, uint256> key;
+    if (!pcursor->Valid() || !pcursor->GetKey(key) || key.first != DB_COINS) {
         return true;
     }
+    pcursor.reset();
 
-    int64_t count = 0;
-    LogPrintf("Upgrading utxo-set database...\n");
+    nThreads = std::max(1, std::min(nThreads, UPGRADE_PARTITIONS));
+    LogPrintf("Upgrading utxo-set database using %d threads...\n", nThreads);
     LogPrintf("[0%%]..."); /* Continued */
     uiInterface.ShowProgress(_("Upgrading UTXO database"), 0, true);
-    size_t batch_size = 1 << 24;
-    CDBBatch batch(db);
-    int reportDone = 0;
-    std::pair<unsigned char, uint256> key;
-    std::pair<unsigned char, uint256> prev_key = {DB_COINS, uint256()};
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        if (ShutdownRequested()) {
-            break;
-        }
-        if (pcursor->GetKey(key) && key.first == DB_COINS) {
-            if (count++ % 256 == 0) {
-                uint32_t high = 0x100 * *key.second.begin() + *(key.second.begin() + 1);
-                int percentageDone = (int)(high * 100.0 / 65536.0 + 0.5);
-                uiInterface.ShowProgress(_("Upgrading UTXO database"), percentageDone, true);
-                if (reportDone < percentageDone/10) {
-                    // report max. every 10% step
-                    LogPrintf("[%d%%]...", percentageDone); /* Continued */
-                    reportDone = percentageDone/10;
-                }
+    const int64_t nStart = GetTimeMicros();
+
+    CoinsUpgradeState state;
+    std::vector<std::thread> workers;
+    for (int i = 0; i < nThreads; ++i) {
+        auto worker = [this, &state] {
+            int partition;
+            while ((partition = state.next_partition++) < UPGRADE_PARTITIONS) {
+                if (!UpgradePartition(db, partition, state)) break;
             }
-            CCoins old_coins;
-            if (!pcursor->GetValue(old_coins)) {
-                return error("%s: cannot parse CCoins record", __func__);
-            }
-            COutPoint outpoint(key.second, 0);
-            for (size_t i = 0; i < old_coins.vout.size(); ++i) {
-                if (!old_coins.vout[i].IsNull() && !old_coins.vout[i].scriptPubKey.IsUnspendable()) {
-                    Coin newcoin(std::move(old_coins.vout[i]), old_coins.nHeight, old_coins.fCoinBase, old_coins.fCoinStake, old_coins.nTime);
-                    outpoint.n = i;
-                    CoinEntry entry(&outpoint);
-                    batch.Write(entry, newcoin);
-                }
-            }
-            batch.Erase(key);
-            if (batch.SizeEstimate() > batch_size) {
-                db.WriteBatch(batch);
-                batch.Clear();
-                db.CompactRange(prev_key, key);
-                prev_key = key;
-            }
-            pcursor->Next();
-        } else {
-            break;
+            ++state.finished;
+        };
+        workers.emplace_back(&TraceThread<decltype(worker)>, "coinsupgrade", worker);
+    }
+
+    int reportDone = 0;
+    while (state.finished < nThreads) {
+        MilliSleep(100);
+        uint64_t done = 0;
+        for (const auto& pos : state.position) done += pos;
+        int percentageDone = (int)(done * 100.0 / ((uint64_t)UPGRADE_PARTITIONS << 16) + 0.5);
+        uiInterface.ShowProgress(_("Upgrading UTXO database"), percentageDone, true);
+        if (reportDone < percentageDone/10) {
+            // report max. every 10% step
+            LogPrintf("[%d%%]...", percentageDone); /* Continued */
+            reportDone = percentageDone/10;
         }
     }
-    db.WriteBatch(batch);
-    db.CompactRange({DB_COINS, uint256()}, key);
+    for (auto& thread : workers) {
+        thread.join();
+    }
+
+    const double elapsed = std::max(GetTimeMicros() - nStart, (int64_t)1) * 0.000001;
     uiInterface.ShowProgress("", 100, false);
-    LogPrintf("[%s].\n", ShutdownRequested() ? "CANCELLED" : "DONE");
-    return !ShutdownRequested();
+    LogPrintf("[%s].\n", ShutdownRequested() ? "CANCELLED" : state.failed ? "FAILED" : "DONE");
+    LogPrintf("Upgraded %d transactions (%d outputs, %.2f MiB) in %.2fs: %.0f tx/s, %.2f MiB/s\n",
+        state.txs.load(), state.outputs.load(), state.bytes * (1.0 / (1 << 20)), elapsed,
+        state.txs / elapsed, state.bytes * (1.0 / (1 << 20)) / elapsed);
+    return !ShutdownRequested() && !state.failed;
 }
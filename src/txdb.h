@@ -10,10 +10,14 @@
 #include <dbwrapper.h>
 #include <chain.h>
 #include <primitives/block.h>
+#include <sync.h>
 
+#include <atomic>
+#include <condition_variable>
 #include <map>
 #include <memory>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -45,19 +49,62 @@ class CCoinsViewDB final : public CCoinsView
 {
 protected:
     CDBWrapper db;
+
+    /**
+     * With background writes enabled, BatchWrite takes over the map and
+     * returns; a writer thread then commits it, in -dbbatchsize partial
+     * batches under the usual head-blocks marker. Until it is committed the
+     * map stays readable, so lookups see the state being written rather
+     * than the older one on disk.
+     */
+    mutable Mutex cs_write;
+    mutable std::condition_variable condWrite;
+    std::unique_ptr<CCoinsMap> mapWriting GUARDED_BY(cs_write);
+    uint256 hashWriting GUARDED_BY(cs_write);
+    bool fWriting GUARDED_BY(cs_write);
+    bool fWriteFailed GUARDED_BY(cs_write);
+    bool fStopWriter GUARDED_BY(cs_write);
+    std::thread threadWriter;
+
+    //! BatchWrite calls so far, and how many of them have been committed (in order)
+    std::atomic<uint64_t> nWritesStarted{0};
+    std::atomic<uint64_t> nWritesCommitted{0};
+
+    bool WriteCoins(const CCoinsMap &mapCoins, const uint256 &hashBlock);
+    void ThreadWriter();
+    //! Look up an outpoint in the write in progress: 1 if unspent there, 0 if spent, -1 if absent
+    int FindWriting(const COutPoint &outpoint, Coin *coin) const EXCLUSIVE_LOCKS_REQUIRED(cs_write);
+
 public:
     explicit CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
+    ~CCoinsViewDB();
 
     bool GetCoin(const COutPoint &outpoint, Coin &coin) const override;
     bool HaveCoin(const COutPoint &outpoint) const override;
+    bool HaveAnyCoin(const std::vector<COutPoint> &outpoints) const override;
     uint256 GetBestBlock() const override;
     std::vector<uint256> GetHeadBlocks() const override;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) override;
     CCoinsViewCursor *Cursor() const override;
 
-    //! Attempt to update from an older database format. Returns whether an error occurred.
-    bool Upgrade();
+    //! Attempt to update from an older database format, using up to nThreads
+    //! threads. Resumes an interrupted upgrade. Returns whether an error occurred.
+    bool Upgrade(int nThreads = 1);
     size_t EstimateSize() const override;
+
+    //! Commit BatchWrite calls from a background thread from now on.
+    void StartBackgroundWrites();
+    //! Whether a background write is still being committed.
+    bool IsWriting() const;
+    //! Wait until no background write is in progress. Returns false if one failed.
+    bool WaitForWrite() const;
+
+    //! Read a coin as of a snapshot of the database, ignoring any write in progress.
+    bool GetCoinAt(const COutPoint &outpoint, Coin &coin, const leveldb::Snapshot* snapshot) const;
+    //! A snapshot of what has been committed to the database, for GetCoinAt().
+    std::shared_ptr<const leveldb::Snapshot> GetSnapshot() const { return db.GetSnapshot(); }
+    uint64_t GetWritesStarted() const { return nWritesStarted; }
+    uint64_t GetWritesCommitted() const { return nWritesCommitted; }
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -29,7 +29,7 @@ public:
     template<typename Stream>
     void Serialize(Stream &s) const {
         ::Serialize(s, VARINT(txout->nHeight * 4 + (txout->fCoinBase ? 1u : 0u) + (txout->fCoinStake ? 2u : 0u)));
-        ::Serialize(s, VARINT(txout->nTime));
+        ::Serialize(s, VARINT((uint32_t)txout->nTime));
         if (txout->nHeight > 0) {
             // Required to maintain compatibility with older undo format.
             ::Serialize(s, (unsigned char)0);
@@ -51,7 +51,7 @@ public:
         ::Unserialize(s, VARINT(nCode));
         txout->nHeight = nCode / 4;
         txout->fCoinBase = nCode & 1;
-        txout->fCoinStake = nCode & 2;
+        txout->fCoinStake = (nCode >> 1) & 1;
         uint32_t nTime = 0;
         ::Unserialize(s, VARINT(nTime));
         txout->nTime = nTime;
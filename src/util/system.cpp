@@ -539,6 +539,12 @@ void ArgsManager::ForceSetArg(const std::string& strArg, const std::string& strV
     m_override_args[strArg] = {strValue};
 }
 
+void ArgsManager::ClearForcedArg(const std::string& strArg)
+{
+    LOCK(cs_args);
+    m_override_args.erase(strArg);
+}
+
 void ArgsManager::AddArg(const std::string& name, const std::string& help, const bool debug_only, const OptionsCategory& cat)
 {
     // Split arg name from its help param
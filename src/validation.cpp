@@ -6,14 +6,20 @@
 #include <validation.h>
 
 #include <arith_uint256.h>
+#include <blockfilemap.h>
+#include <blockimport.h>
+#include <blockwriter.h>
 #include <chain.h>
 #include <chainparams.h>
 #include <checkpoints.h>
 #include <checkqueue.h>
+#include <coinsprefetch.h>
+#include <coinssnapshot.h>
 #include <consensus/consensus.h>
 #include <consensus/merkle.h>
 #include <consensus/tx_verify.h>
 #include <consensus/validation.h>
+#include <crypto/scrypt.h>
 #include <cuckoocache.h>
 #include <hash.h>
 #include <index/txindex.h>
@@ -227,10 +233,6 @@ RecursiveMutex cs_main;
 BlockMap& mapBlockIndex = g_chainstate.mapBlockIndex;
 CChain& chainActive = g_chainstate.chainActive;
 CBlockIndex *pindexBestHeader = nullptr;
-// [PINK] https://github.com/Pink2Dev/Pink2/blob/2.2.3.0/src/main.cpp#L44
-arith_uint256 nBaseStakeTrust = 0;
-// [PINK] https://github.com/Pink2Dev/Pink2/blob/2.2.3.0/src/main.cpp#L45
-int nBaseStakeTrustHeight = 0;
 Mutex g_best_block_mutex;
 std::condition_variable g_best_block_cv;
 uint256 g_best_block;
@@ -242,7 +244,9 @@ bool fPruneMode = false;
 bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fRequireStandard = true;
 bool fCheckBlockIndex = false;
+bool fVerifyBlockIndex = DEFAULT_VERIFYBLOCKINDEX;
 bool fCheckpointsEnabled = DEFAULT_CHECKPOINTS_ENABLED;
+bool fIncrementalFlush = DEFAULT_INCREMENTAL_FLUSH;
 size_t nCoinCacheUsage = 5000 * 300;
 uint64_t nPruneTarget = 0;
 int64_t nMaxTipAge = DEFAULT_MAX_TIP_AGE;
@@ -263,6 +267,8 @@ CScript COINBASE_FLAGS;
 
 const std::string strMessageMagic = "Pinkcoin Signed Message:\n";
 
+static FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
+
 // Internal stuff
 namespace {
     CBlockIndex *&pindexBestInvalid = g_chainstate.pindexBestInvalid;
@@ -275,6 +281,12 @@ namespace {
     CCriticalSection cs_LastBlockFile;
     std::vector<CBlockFileInfo> vinfoBlockFile;
     int nLastBlockFile = 0;
+    /** Mappings of the block files before nLastBlockFile, which are no longer written to. */
+    CBlockFileMap g_blockfilemap(MAX_MAPPED_BLOCK_FILES);
+    /** Writes block and undo data to the positions FindBlockPos and FindUndoPos allocated. */
+    CBlockFileWriter g_blockwriter([](const CDiskBlockPos& pos, BlockFileType type) {
+        return type == BlockFileType::BLOCK ? OpenBlockFile(pos) : OpenUndoFile(pos);
+    });
     /** Global flag to indicate we should check to see if there are
      *  block/undo files that should be deleted.  Set on startup
      *  or if we allocate more file space when we're in prune mode
@@ -308,7 +320,9 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 std::unique_ptr<CCoinsViewDB> pcoinsdbview;
+std::unique_ptr<CCoinsViewPrefetch> pcoinsprefetch;
 std::unique_ptr<CCoinsViewCache> pcoinsTip;
+CCoinsSnapshotManager g_coins_snapshot;
 std::unique_ptr<CBlockTreeDB> pblocktree;
 
 enum class FlushStateMode {
@@ -323,7 +337,6 @@ static bool FlushStateToDisk(const CChainParams& chainParams, CValidationState &
 static void FindFilesToPruneManual(std::set<int>& setFilesToPrune, int nManualPruneHeight);
 static void FindFilesToPrune(std::set<int>& setFilesToPrune, uint64_t nPruneAfterHeight);
 bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsViewCache &inputs, bool fScriptChecks, unsigned int flags, bool cacheSigStore, bool cacheFullScriptStore, PrecomputedTransactionData& txdata, std::vector<CScriptCheck> *pvChecks = nullptr);
-static FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly = false);
 
 bool CheckFinalTx(const CTransaction &tx, int flags)
 {
@@ -1010,8 +1023,7 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
  */
 bool GetTransaction(const uint256& hash, CTransactionRef& txOut, const Consensus::Params& consensusParams, uint256& hashBlock, const CBlockIndex* const block_index)
 {
-    LOCK(cs_main);
-
+    // No cs_main: the mempool, the txindex and block reads do their own locking.
     if (!block_index) {
         CTransactionRef ptx = mempool.get(hash);
         if (ptx) {
@@ -1050,40 +1062,56 @@ bool GetTransaction(const uint256& hash, CTransactionRef& txOut, const Consensus
 
 static bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart)
 {
-    // Open history file to append
-    CAutoFile fileout(OpenBlockFile(pos), SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("WriteBlockToDisk: OpenBlockFile failed");
-
-    // Write index header
-    unsigned int nSize = GetSerializeSize(block, fileout.GetVersion());
-    fileout << messageStart << nSize;
-
-    // Write block
-    long fileOutPos = ftell(fileout.Get());
-    if (fileOutPos < 0)
-        return error("WriteBlockToDisk: ftell failed");
-    pos.nPos = (unsigned int)fileOutPos;
-    fileout << block;
+    // Serialize index header and block
+    unsigned int nSize = GetSerializeSize(block, CLIENT_VERSION);
+    std::vector<unsigned char> data;
+    data.reserve(nSize + 8);
+    CVectorWriter(SER_DISK, CLIENT_VERSION, data, 0) << messageStart << nSize << block;
+
+    // Hand them to the writer, which appends them at the position allocated for them
+    if (!g_blockwriter.Write(BlockFileType::BLOCK, pos, std::move(data)))
+        return error("WriteBlockToDisk: write failed");
+    pos.nPos += 8;
 
     return true;
 }
 
+/** Return a mapping of block file nFile, or null if it is still being appended to (or cannot be mapped). */
+static std::shared_ptr<const CMappedFile> MapBlockFile(int nFile)
+{
+    {
+        LOCK(cs_LastBlockFile);
+        if (nFile >= nLastBlockFile) return nullptr;
+    }
+    return g_blockfilemap.Get(nFile, GetBlockPosFilename(CDiskBlockPos(nFile, 0), "blk"));
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
 {
     block.SetNull();
 
-    // Open history file to read
-    CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull())
-        return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
+    g_blockwriter.WaitForWrite(BlockFileType::BLOCK, pos);
+    std::shared_ptr<const CMappedFile> file = MapBlockFile(pos.nFile);
+    if (file) {
+        // Read block
+        try {
+            SpanReader(SER_DISK, CLIENT_VERSION, file->GetData(), pos.nPos) >> block;
+        } catch (const std::exception& e) {
+            return error("%s: Deserialize error - %s at %s", __func__, e.what(), pos.ToString());
+        }
+    } else {
+        // Open history file to read
+        CAutoFile filein(OpenBlockFile(pos, true), SER_DISK, CLIENT_VERSION);
+        if (filein.IsNull())
+            return error("ReadBlockFromDisk: OpenBlockFile failed for %s", pos.ToString());
 
-    // Read block
-    try {
-        filein >> block;
-    }
-    catch (const std::exception& e) {
-        return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        // Read block
+        try {
+            filein >> block;
+        }
+        catch (const std::exception& e) {
+            return error("%s: Deserialize or I/O error - %s at %s", __func__, e.what(), pos.ToString());
+        }
     }
 
     // Check the header
@@ -1109,12 +1137,17 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
-bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& message_start)
+bool ReadRawBlockFromDisk(CRawBlock& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& message_start)
 {
     CDiskBlockPos hpos = pos;
     hpos.nPos -= 8; // Seek back 8 bytes for meta header
-    CAutoFile filein(OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
-    if (filein.IsNull()) {
+
+    block.data = Span<const uint8_t>();
+    block.vBuffer.clear();
+    g_blockwriter.WaitForWrite(BlockFileType::BLOCK, hpos);
+    block.file = MapBlockFile(pos.nFile);
+    CAutoFile filein(block.file ? nullptr : OpenBlockFile(hpos, true), SER_DISK, CLIENT_VERSION);
+    if (!block.file && filein.IsNull()) {
         return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
     }
 
@@ -1122,7 +1155,11 @@ bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CDiskBlockPos& pos,
         CMessageHeader::MessageStartChars blk_start;
         unsigned int blk_size;
 
-        filein >> blk_start >> blk_size;
+        if (block.file) {
+            SpanReader(SER_DISK, CLIENT_VERSION, block.file->GetData(), hpos.nPos) >> blk_start >> blk_size;
+        } else {
+            filein >> blk_start >> blk_size;
+        }
 
         if (memcmp(blk_start, message_start, CMessageHeader::MESSAGE_START_SIZE)) {
             return error("%s: Block magic mismatch for %s: %s versus expected %s", __func__, pos.ToString(),
@@ -1135,8 +1172,16 @@ bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CDiskBlockPos& pos,
                     blk_size, MAX_SIZE);
         }
 
-        block.resize(blk_size); // Zeroing of memory is intentional here
-        filein.read((char*)block.data(), blk_size);
+        if (block.file) {
+            if (pos.nPos + (size_t)blk_size > block.file->size()) {
+                return error("%s: Block data extends past the end of the file for %s", __func__, pos.ToString());
+            }
+            block.data = block.file->GetData().subspan(pos.nPos, blk_size);
+        } else {
+            block.vBuffer.resize(blk_size); // Zeroing of memory is intentional here
+            filein.read((char*)block.vBuffer.data(), blk_size);
+            block.data = Span<const uint8_t>(block.vBuffer.data(), block.vBuffer.size());
+        }
     } catch(const std::exception& e) {
         return error("%s: Read from block file failed: %s for %s", __func__, e.what(), pos.ToString());
     }
@@ -1144,7 +1189,7 @@ bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CDiskBlockPos& pos,
     return true;
 }
 
-bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start)
+bool ReadRawBlockFromDisk(CRawBlock& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start)
 {
     CDiskBlockPos block_pos;
     {
@@ -1515,27 +1560,23 @@ namespace {
 
 bool UndoWriteToDisk(const CBlockUndo& blockundo, CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
 {
-    // Open history file to append
-    CAutoFile fileout(OpenUndoFile(pos), SER_DISK, CLIENT_VERSION);
-    if (fileout.IsNull())
-        return error("%s: OpenUndoFile failed", __func__);
-
-    // Write index header
-    unsigned int nSize = GetSerializeSize(blockundo, fileout.GetVersion());
-    fileout << messageStart << nSize;
-
-    // Write undo data
-    long fileOutPos = ftell(fileout.Get());
-    if (fileOutPos < 0)
-        return error("%s: ftell failed", __func__);
-    pos.nPos = (unsigned int)fileOutPos;
-    fileout << blockundo;
-
-    // calculate & write checksum
+    // Serialize index header and undo data
+    unsigned int nSize = GetSerializeSize(blockundo, CLIENT_VERSION);
+    std::vector<unsigned char> data;
+    data.reserve(nSize + 40);
+    CVectorWriter writer(SER_DISK, CLIENT_VERSION, data, 0);
+    writer << messageStart << nSize << blockundo;
+
+    // calculate & append checksum
     CHashWriter hasher(SER_GETHASH, PROTOCOL_VERSION);
     hasher << hashBlock;
     hasher << blockundo;
-    fileout << hasher.GetHash();
+    writer << hasher.GetHash();
+
+    // Hand them to the writer, which appends them at the position allocated for them
+    if (!g_blockwriter.Write(BlockFileType::UNDO, pos, std::move(data)))
+        return error("%s: write failed", __func__);
+    pos.nPos += 8;
 
     return true;
 }
@@ -1684,27 +1725,19 @@ DisconnectResult CChainState::DisconnectBlock(const CBlock& block, const CBlockI
     return fClean ? DISCONNECT_OK : DISCONNECT_UNCLEAN;
 }
 
+/**
+ * Finalize the block file being left (truncating it and its undo file, and
+ * committing both after the writes queued before), or wait until all block
+ * and undo data written so far is committed to disk.
+ */
 void static FlushBlockFile(bool fFinalize = false)
 {
-    LOCK(cs_LastBlockFile);
-
-    CDiskBlockPos posOld(nLastBlockFile, 0);
-    bool status = true;
-
-    FILE *fileOld = OpenBlockFile(posOld);
-    if (fileOld) {
-        if (fFinalize)
-            status &= TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nSize);
-        status &= FileCommit(fileOld);
-        fclose(fileOld);
-    }
-
-    fileOld = OpenUndoFile(posOld);
-    if (fileOld) {
-        if (fFinalize)
-            status &= TruncateFile(fileOld, vinfoBlockFile[nLastBlockFile].nUndoSize);
-        status &= FileCommit(fileOld);
-        fclose(fileOld);
+    bool status;
+    if (fFinalize) {
+        LOCK(cs_LastBlockFile);
+        status = g_blockwriter.Finalize(nLastBlockFile, vinfoBlockFile[nLastBlockFile].nSize, vinfoBlockFile[nLastBlockFile].nUndoSize);
+    } else {
+        status = g_blockwriter.Sync();
     }
 
     if (!status) {
@@ -1740,8 +1773,132 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+static CCheckQueue<CHeaderHashCheck> headerhashqueue(16);
+
+void ThreadHeaderHashCheck() {
+    RenameThread("pinkcoin-hdrhash");
+    headerhashqueue.Thread();
+}
+
+bool CHeaderHashCheck::operator()() {
+    const CBlockHeader* headers[SCRYPT_MAX_LANES];
+    for (size_t i = 0; i < nCount; i += SCRYPT_MAX_LANES) {
+        const size_t n = std::min(nCount - i, SCRYPT_MAX_LANES);
+        for (size_t j = 0; j < n; ++j) {
+            headers[j] = &pheader[i + j];
+        }
+        CBlockHeader::MemoizeHashes(headers, n);
+    }
+    return true;
+}
+
+void HashBlockHeaders(const std::vector<CBlockHeader>& headers, CCheckQueue<CHeaderHashCheck>* queue)
+{
+    if (queue == nullptr) {
+        CHeaderHashCheck(headers.data(), headers.size())();
+        return;
+    }
+
+    // One check per full set of scrypt lanes keeps every worker's kernel busy.
+    const size_t lanes = ScryptLanes();
+    CCheckQueueControl<CHeaderHashCheck> control(queue);
+    std::vector<CHeaderHashCheck> vChecks;
+    vChecks.reserve((headers.size() + lanes - 1) / lanes);
+    for (size_t i = 0; i < headers.size(); i += lanes) {
+        vChecks.emplace_back(&headers[i], std::min(headers.size() - i, lanes));
+    }
+    control.Add(vChecks);
+    control.Wait();
+}
+
+namespace {
+
+/** log2 of the number of transactions per CBlockTxCheck */
+static const unsigned int BLOCK_TX_CHECK_SUBTREE_HEIGHT = 6;
+
+/** Outcome of a CBlockTxCheck */
+struct BlockTxCheckResult
+{
+    uint256 hashRoot;
+    bool fMutated = false;
+    //! First transaction of the run to fail CheckTransaction, if any, and why
+    const CTransaction* ptxFailed = nullptr;
+    CValidationState state;
+};
+
+/**
+ * Closure hashing a run of consecutive block transactions deserialized with
+ * SERIALIZE_TRANSACTION_DEFER_HASH, computing the root of the merkle subtree
+ * over them and running CheckTransaction on each, so CheckBlock can spread
+ * this work over several threads.
+ * Note that this stores references to the transactions and the result
+ */
+class CBlockTxCheck
+{
+private:
+    const CTransactionRef *ptx;
+    size_t nCount;
+    BlockTxCheckResult *result;
+
+public:
+    CBlockTxCheck(): ptx(nullptr), nCount(0), result(nullptr) {}
+    CBlockTxCheck(const CTransactionRef* txIn, size_t nCountIn, BlockTxCheckResult* resultIn) : ptx(txIn), nCount(nCountIn), result(resultIn) {}
+
+    bool operator()() {
+        std::vector<uint256> leaves(nCount);
+        for (size_t i = 0; i < nCount; ++i) {
+            leaves[i] = ptx[i]->GetHash();
+            if (!result->ptxFailed && !CheckTransaction(*ptx[i], result->state, true)) {
+                result->ptxFailed = ptx[i].get();
+            }
+        }
+        result->hashRoot = ComputeMerkleSubtreeRoot(std::move(leaves), BLOCK_TX_CHECK_SUBTREE_HEIGHT, &result->fMutated);
+        return true;
+    }
+
+    void swap(CBlockTxCheck &check) {
+        std::swap(ptx, check.ptx);
+        std::swap(nCount, check.nCount);
+        std::swap(result, check.result);
+    }
+};
+
+} // namespace
+
+static CCheckQueue<CBlockTxCheck> blocktxqueue(4);
+
+void ThreadBlockTxCheck() {
+    RenameThread("pinkcoin-blocktx");
+    blocktxqueue.Thread();
+}
+
+/** Run the CBlockTxChecks of a block over the block transaction threads, one result per run. */
+static void CheckBlockTransactions(const CBlock& block, std::vector<BlockTxCheckResult>& results)
+{
+    const size_t nRun = size_t{1} << BLOCK_TX_CHECK_SUBTREE_HEIGHT;
+    results.resize((block.vtx.size() + nRun - 1) / nRun);
+    std::vector<CBlockTxCheck> vChecks;
+    vChecks.reserve(results.size());
+    for (size_t i = 0; i < results.size(); ++i) {
+        vChecks.emplace_back(&block.vtx[i * nRun], std::min(nRun, block.vtx.size() - i * nRun), &results[i]);
+    }
+    CCheckQueueControl<CBlockTxCheck> control(&blocktxqueue);
+    control.Add(vChecks);
+    control.Wait();
+}
+
+/** Whole blocks checked at once, for the block import and VerifyDB */
+static CCheckQueue<CTaskCheck> blockcheckqueue(1);
+
+void ThreadBlockCheck() {
+    RenameThread("pinkcoin-blockchk");
+    blockcheckqueue.Thread();
+}
+
 VersionBitsCache versionbitscache GUARDED_BY(cs_main);
 
+TargetCache targetcache GUARDED_BY(cs_main);
+
 int32_t ComputeBlockVersion(const CBlockIndex* pindexPrev, const Consensus::Params& params)
 {
     // [PINK] Temporary disable BIP 9 (Version bits).
@@ -2013,14 +2170,18 @@ bool CChainState::ConnectBlock(const CBlock& block, CValidationState& state, CBl
     // consensus change that ensures coinbases at those heights can not
     // duplicate earlier coinbases.
     if (fEnforceBIP30 || pindex->nHeight >= BIP34_IMPLIES_BIP30_LIMIT) {
+        // Check all of the block's new outputs as one batch, so that cache
+        // misses reach the database as a single sorted pass.
+        std::vector<COutPoint> outpoints;
         for (const auto& tx : block.vtx) {
             for (size_t o = 0; o < tx->vout.size(); o++) {
-                if (view.HaveCoin(COutPoint(tx->GetHash(), o))) {
-                    return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
-                                     REJECT_INVALID, "bad-txns-BIP30");
-                }
+                outpoints.emplace_back(tx->GetHash(), o);
             }
         }
+        if (view.HaveAnyCoin(outpoints)) {
+            return state.DoS(100, error("ConnectBlock(): tried to overwrite transaction"),
+                             REJECT_INVALID, "bad-txns-BIP30");
+        }
     }
 
     // Start enforcing BIP68 (sequence locks) and BIP112 (CHECKSEQUENCEVERIFY) using versionbits logic.
@@ -2200,6 +2361,13 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
         bool fPeriodicFlush = mode == FlushStateMode::PERIODIC && nNow > nLastFlush + (int64_t)DATABASE_FLUSH_INTERVAL * 1000000;
         // Combine all conditions that result in a full cache flush.
         fDoFullFlush = (mode == FlushStateMode::ALWAYS) || fCacheLarge || fCacheCritical || fPeriodicFlush || fFlushForPrune;
+        // With incremental flushing, write the cache in the background and keep it, unless memory or disk
+        // space has to be freed now or the caller needs everything on disk. Do it on every block index
+        // write as well, so that few changes pile up between writes.
+        bool fKeepCache = fIncrementalFlush && mode != FlushStateMode::ALWAYS && !fCacheCritical && !fFlushForPrune;
+        if (fKeepCache) {
+            fDoFullFlush = fDoFullFlush || fPeriodicWrite;
+        }
         // Write blocks and block index to disk.
         if (fDoFullFlush || fPeriodicWrite) {
             // Depend on nMinDiskSpace to ensure we can write block index
@@ -2240,10 +2408,25 @@ bool static FlushStateToDisk(const CChainParams& chainparams, CValidationState &
             if (!CheckDiskSpace(48 * 2 * 2 * pcoinsTip->GetCacheSize()))
                 return state.Error("out of disk space");
             // Flush the chainstate (which may refer to block index entries).
-            if (!pcoinsTip->Flush())
-                return AbortNode(state, "Failed to write to coin database");
-            nLastFlush = nNow;
-            full_flush_completed = true;
+            if (fKeepCache) {
+                // Skip this round if the previous write is still being committed rather than wait for it.
+                if (!pcoinsdbview->IsWriting()) {
+                    if (!pcoinsTip->Sync())
+                        return AbortNode(state, "Failed to write to coin database");
+                    if (fCacheLarge)
+                        pcoinsTip->Trim(nTotalSpace / 2);
+                    nLastFlush = nNow;
+                    full_flush_completed = true;
+                }
+            } else {
+                if (!pcoinsTip->Flush())
+                    return AbortNode(state, "Failed to write to coin database");
+                // Everything must be on disk before returning, ahead of pruning or shutdown.
+                if ((mode == FlushStateMode::ALWAYS || fFlushForPrune) && !pcoinsdbview->WaitForWrite())
+                    return AbortNode(state, "Failed to write to coin database");
+                nLastFlush = nNow;
+                full_flush_completed = true;
+            }
         }
     }
     if (full_flush_completed) {
@@ -2366,6 +2549,7 @@ bool CChainState::DisconnectTip(CValidationState& state, const CChainParams& cha
         assert(view.GetBestBlock() == pindexDelete->GetBlockHash());
         if (DisconnectBlock(block, pindexDelete, view) != DISCONNECT_OK)
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
+        g_coins_snapshot.Publish(view, pindexDelete->pprev->GetBlockHash(), pindexDelete->pprev->nHeight);
         bool flushed = view.Flush();
         assert(flushed);
     }
@@ -2500,6 +2684,11 @@ bool CChainState::ConnectTip(CValidationState& state, const CChainParams& chainp
         }
         nTime3 = GetTimeMicros(); nTimeConnectTotal += nTime3 - nTime2;
         LogPrint(BCLog::BENCH, "  - Connect total: %.2fms [%.2fs (%.2fms/blk)]\n", (nTime3 - nTime2) * MILLI, nTimeConnectTotal * MICRO, nTimeConnectTotal * MILLI / nBlocksTotal);
+        if (pcoinsprefetch && LogAcceptCategory(BCLog::BENCH)) {
+            const uint64_t nHits = pcoinsprefetch->GetHits(), nLookups = nHits + pcoinsprefetch->GetMisses();
+            LogPrint(BCLog::BENCH, "  - Prefetch hits: %u/%u [%.2f%%]\n", nHits, nLookups, nLookups ? 100.0 * nHits / nLookups : 0.0);
+        }
+        g_coins_snapshot.Publish(view, pindexNew->GetBlockHash(), pindexNew->nHeight);
         bool flushed = view.Flush();
         assert(flushed);
     }
@@ -2636,6 +2825,11 @@ bool CChainState::ActivateBestChainStep(CValidationState& state, const CChainPar
         }
         nHeight = nTargetHeight;
 
+        // Have the inputs of the blocks about to be connected read ahead.
+        if (pcoinsprefetch) {
+            pcoinsprefetch->Schedule(vpindexToConnect);
+        }
+
         // Connect new blocks.
         for (CBlockIndex *pindexConnect : reverse_iterate(vpindexToConnect)) {
             if (!ConnectTip(state, chainparams, pindexConnect, pindexConnect == pindexMostWork ? pblock : std::shared_ptr<const CBlock>(), connectTrace, disconnectpool)) {
@@ -3005,6 +3199,10 @@ CBlockIndex* CChainState::AddToBlockIndex(const CBlockHeader& block)
         pindexNew->pprev = (*miPrev).second;
         pindexNew->nHeight = pindexNew->pprev->nHeight + 1;
         pindexNew->BuildSkip();
+        pindexNew->BuildPrevAlgo();
+        // Fill the stake trust window of each new 1024-block boundary up front.
+        if ((pindexNew->nHeight & 1023) == 0)
+            GetBaseStakeBits(pindexNew);
     }
     pindexNew->nTimeMax = (pindexNew->pprev ? std::max(pindexNew->pprev->nTimeMax, pindexNew->nTime) : pindexNew->nTime);
     // [PINK] TODO: Change GetBlockProof to work like GetBlockTrust
@@ -3175,10 +3373,32 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
     if (!CheckBlockHeader(block, state, consensusParams, fCheckPOW))
         return false;
 
+    // Transactions received without their hashes (see
+    // SERIALIZE_TRANSACTION_DEFER_HASH) are hashed here, in runs spread over
+    // the block transaction threads that also compute the merkle subtrees
+    // above them and run the transaction checks below.
+    std::vector<BlockTxCheckResult> vTxResults;
+    if (fCheckMerkleRoot && nScriptCheckThreads && block.vtx.size() > (size_t{1} << BLOCK_TX_CHECK_SUBTREE_HEIGHT) && !block.vtx[0]->HasHashes()) {
+        CheckBlockTransactions(block, vTxResults);
+    }
+
     // Check the merkle root.
     if (fCheckMerkleRoot) {
         bool mutated;
-        uint256 hashMerkleRoot2 = BlockMerkleRoot(block, &mutated);
+        uint256 hashMerkleRoot2;
+        if (vTxResults.empty()) {
+            hashMerkleRoot2 = BlockMerkleRoot(block, &mutated);
+        } else {
+            std::vector<uint256> roots;
+            roots.reserve(vTxResults.size());
+            for (const BlockTxCheckResult& result : vTxResults) {
+                roots.push_back(result.hashRoot);
+            }
+            hashMerkleRoot2 = ComputeMerkleRoot(std::move(roots), &mutated);
+            for (const BlockTxCheckResult& result : vTxResults) {
+                mutated |= result.fMutated;
+            }
+        }
         if (block.hashMerkleRoot != hashMerkleRoot2)
             return state.DoS(100, false, REJECT_INVALID, "bad-txnmrklroot", true, "hashMerkleRoot mismatch");
 
@@ -3207,10 +3427,26 @@ bool CheckBlock(const CBlock& block, CValidationState& state, const Consensus::P
             return state.DoS(100, false, REJECT_INVALID, "bad-cb-multiple", false, "more than one coinbase");
 
     // Check transactions
-    for (const auto& tx : block.vtx)
-        if (!CheckTransaction(*tx, state, true))
-            return state.Invalid(false, state.GetRejectCode(), state.GetRejectReason(),
-                                 strprintf("Transaction check failed (tx hash %s) %s", tx->GetHash().ToString(), state.GetDebugMessage()));
+    const CTransaction* ptxFailed = nullptr;
+    if (vTxResults.empty()) {
+        for (const auto& tx : block.vtx) {
+            if (!CheckTransaction(*tx, state, true)) {
+                ptxFailed = tx.get();
+                break;
+            }
+        }
+    } else {
+        for (const BlockTxCheckResult& result : vTxResults) {
+            if (result.ptxFailed) {
+                ptxFailed = result.ptxFailed;
+                state = result.state;
+                break;
+            }
+        }
+    }
+    if (ptxFailed)
+        return state.Invalid(false, state.GetRejectCode(), state.GetRejectReason(),
+                             strprintf("Transaction check failed (tx hash %s) %s", ptxFailed->GetHash().ToString(), state.GetDebugMessage()));
 
     unsigned int nSigOps = 0;
     for (const auto& tx : block.vtx)
@@ -3310,11 +3546,11 @@ static bool ContextualCheckBlockHeader(const CBlockHeader& block, CValidationSta
 
     // Check proof of work / proof of stake
     const Consensus::Params& consensusParams = params.GetConsensus();
-    // [PINK] Hack: fix it somehow or at least rewrite GetNextTargetRequired in more optimal way :/
     // [PINK] It's not possible to find out whether we are dealing wtih PoW or PoS block headers...
     // [PINK] To fix it we need to add that info to headers
-    if (block.nBits != GetNextTargetRequired(pindexPrev, &block, consensusParams, false)) { // PoW check
-        if (block.nBits != GetNextTargetRequired(pindexPrev, &block, consensusParams, true)) { // PoS check
+    // Both targets are memoized per parent, so sibling headers share them.
+    if (block.nBits != GetNextTargetRequired(pindexPrev, &block, consensusParams, false, targetcache)) { // PoW check
+        if (block.nBits != GetNextTargetRequired(pindexPrev, &block, consensusParams, true, targetcache)) { // PoS check
             return state.DoS(100, false, REJECT_INVALID, "bad-diffbits", false, "incorrect proof of work / proof of stake");
         }
         // block.SetPoWFlag(false);
@@ -3526,6 +3762,15 @@ bool CChainState::AcceptBlockHeader(const CBlockHeader& block, CValidationState&
 bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& headers, CValidationState& state, const CChainParams& chainparams, const CBlockIndex** ppindex, CBlockHeader *first_invalid)
 {
     if (first_invalid != nullptr) first_invalid->SetNull();
+
+    // Scrypt-hash the whole batch across the worker threads before taking
+    // cs_main, so AcceptBlockHeader below only sees memoized hashes.
+    if (nScriptCheckThreads && headers.size() > 1) {
+        int64_t nTimeStart = GetTimeMicros();
+        HashBlockHeaders(headers, &headerhashqueue);
+        LogPrint(BCLog::BENCH, "    - Hash %u headers: %.2fms\n", headers.size(), 0.001 * (GetTimeMicros() - nTimeStart));
+    }
+
     {
         LOCK(cs_main);
         for (const CBlockHeader& header : headers) {
@@ -3757,6 +4002,7 @@ void UnlinkPrunedFiles(const std::set<int>& setFilesToPrune)
 {
     for (std::set<int>::iterator it = setFilesToPrune.begin(); it != setFilesToPrune.end(); ++it) {
         CDiskBlockPos pos(*it, 0);
+        g_blockfilemap.Drop(*it);
         fs::remove(GetBlockPosFilename(pos, "blk"));
         fs::remove(GetBlockPosFilename(pos, "rev"));
         LogPrintf("Prune: %s deleted blk/rev (%05u)\n", __func__, *it);
@@ -3901,14 +4147,27 @@ static FILE* OpenDiskFile(const CDiskBlockPos &pos, const char *prefix, bool fRe
 }
 
 FILE* OpenBlockFile(const CDiskBlockPos &pos, bool fReadOnly) {
+    // Do not read ahead of a queued write of the same data
+    if (fReadOnly) g_blockwriter.WaitForWrite(BlockFileType::BLOCK, pos);
     return OpenDiskFile(pos, "blk", fReadOnly);
 }
 
 /** Open an undo file (rev?????.dat) */
 static FILE* OpenUndoFile(const CDiskBlockPos &pos, bool fReadOnly) {
+    if (fReadOnly) g_blockwriter.WaitForWrite(BlockFileType::UNDO, pos);
     return OpenDiskFile(pos, "rev", fReadOnly);
 }
 
+void StartBlockFileWriter()
+{
+    g_blockwriter.Start();
+}
+
+void StopBlockFileWriter()
+{
+    g_blockwriter.Stop();
+}
+
 fs::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix)
 {
     return GetBlocksDir() / strprintf("%s%05u.dat", prefix, pos.nFile);
@@ -3934,11 +4193,48 @@ CBlockIndex * CChainState::InsertBlockIndex(const uint256& hash)
     return pindexNew;
 }
 
+/**
+ * Recompute the scrypt hash of every block index entry and check that it
+ * matches the hash the entry was stored under. The headers are hashed in
+ * chunks on the header hash threads to bound memory use.
+ */
+static bool VerifyBlockIndexHashes(const BlockMap& block_index)
+{
+    static const size_t CHUNK_SIZE = 16384;
+
+    int64_t nStart = GetTimeMillis();
+    std::vector<const CBlockIndex*> vIndex;
+    std::vector<CBlockHeader> vHeaders;
+    vIndex.reserve(CHUNK_SIZE);
+    vHeaders.reserve(CHUNK_SIZE);
+    BlockMap::const_iterator it = block_index.begin();
+    while (it != block_index.end()) {
+        boost::this_thread::interruption_point();
+        vIndex.clear();
+        vHeaders.clear();
+        for (; it != block_index.end() && vIndex.size() < CHUNK_SIZE; ++it) {
+            vIndex.push_back(it->second);
+            vHeaders.push_back(it->second->GetBlockHeader());
+        }
+        HashBlockHeaders(vHeaders, nScriptCheckThreads ? &headerhashqueue : nullptr);
+        for (size_t i = 0; i < vIndex.size(); i++) {
+            if (vHeaders[i].GetHash() != vIndex[i]->GetBlockHash()) {
+                return error("%s: block hash mismatch: %s", __func__, vIndex[i]->ToString());
+            }
+        }
+    }
+    LogPrintf("%s: verified %u block index hashes in %dms\n", __func__, block_index.size(), GetTimeMillis() - nStart);
+    return true;
+}
+
 bool CChainState::LoadBlockIndex(const Consensus::Params& consensus_params, CBlockTreeDB& blocktree)
 {
     if (!blocktree.LoadBlockIndexGuts(consensus_params, [this](const uint256& hash) EXCLUSIVE_LOCKS_REQUIRED(cs_main) { return this->InsertBlockIndex(hash); }))
         return false;
 
+    if (fVerifyBlockIndex && !VerifyBlockIndexHashes(mapBlockIndex))
+        return false;
+
     // [PINK] TODO: Replace with https://github.com/Pink2Dev/Pink2/blob/master/src/txdb-leveldb.cpp#L393
     // Calculate nChainWork
     std::vector<std::pair<int, CBlockIndex*> > vSortedByHeight;
@@ -3976,8 +4272,10 @@ bool CChainState::LoadBlockIndex(const Consensus::Params& consensus_params, CBlo
             setBlockIndexCandidates.insert(pindex);
         if (pindex->nStatus & BLOCK_FAILED_MASK && (!pindexBestInvalid || pindex->nChainWork > pindexBestInvalid->nChainWork))
             pindexBestInvalid = pindex;
-        if (pindex->pprev)
+        if (pindex->pprev) {
             pindex->BuildSkip();
+            pindex->BuildPrevAlgo();
+        }
         if (pindex->IsValid(BLOCK_VALID_TREE) && (pindexBestHeader == nullptr || CBlockIndexWorkComparator()(pindexBestHeader, pindex)))
             pindexBestHeader = pindex;
     }
@@ -4081,6 +4379,67 @@ CVerifyDB::~CVerifyDB()
     uiInterface.ShowProgress("", 100, false);
 }
 
+/** Blocks read and checked ahead per VerifyDB worker, before the ordered level 3 pass catches up */
+static const size_t VERIFYDB_BLOCKS_PER_THREAD = 16;
+
+/** The results of the independent (level 0 to 2) checks of one block in VerifyDB */
+struct CVerifiedBlock
+{
+    CBlockIndex* pindex;
+    CDiskBlockPos pos;
+    CBlock block;
+    std::string strError;
+    bool fChecked = false;
+};
+
+/** Read a block and, depending on the check level, check it and its undo data. */
+static void VerifyBlockIndependent(CVerifiedBlock& verified, const Consensus::Params& consensusParams, int nCheckLevel)
+{
+    const CBlockIndex* pindex = verified.pindex;
+    // check level 0: read from disk (by position: cs_main is held by the caller of VerifyDB)
+    if (!ReadBlockFromDisk(verified.block, verified.pos, consensusParams) || verified.block.GetHash() != pindex->GetBlockHash()) {
+        verified.strError = strprintf("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+        return;
+    }
+    // check level 1: verify block validity
+    CValidationState state;
+    if (nCheckLevel >= 1 && !CheckBlock(verified.block, state, consensusParams)) {
+        verified.strError = strprintf("%s: *** found bad block at %d, hash=%s (%s)\n", "VerifyDB",
+                pindex->nHeight, pindex->GetBlockHash().ToString(), FormatStateMessage(state));
+        return;
+    }
+    // check level 2: verify undo validity
+    if (nCheckLevel >= 2) {
+        CBlockUndo undo;
+        if (!pindex->GetUndoPos().IsNull()) {
+            if (!UndoReadFromDisk(undo, pindex)) {
+                verified.strError = strprintf("VerifyDB(): *** found bad undo data at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
+                return;
+            }
+        }
+    }
+    verified.fChecked = true;
+}
+
+/** Closure running VerifyBlockIndependent on one block of a VerifyDB window */
+class CVerifyBlockCheck
+{
+private:
+    CVerifiedBlock* pverified;
+    const Consensus::Params* pconsensusParams;
+    int nCheckLevel;
+
+public:
+    CVerifyBlockCheck(CVerifiedBlock& verifiedIn, const Consensus::Params& consensusParamsIn, int nCheckLevelIn) :
+        pverified(&verifiedIn), pconsensusParams(&consensusParamsIn), nCheckLevel(nCheckLevelIn) {}
+
+    bool operator()() {
+        // A failure is reported through pverified; VerifyDB stops at the first.
+        if (!ShutdownRequested()) VerifyBlockIndependent(*pverified, *pconsensusParams, nCheckLevel);
+        return true;
+    }
+};
+
 bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview, int nCheckLevel, int nCheckDepth)
 {
     LOCK(cs_main);
@@ -4091,66 +4450,93 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
     if (nCheckDepth <= 0 || nCheckDepth > chainActive.Height())
         nCheckDepth = chainActive.Height();
     nCheckLevel = std::max(0, std::min(4, nCheckLevel));
-    LogPrintf("Verifying last %i blocks at level %i\n", nCheckDepth, nCheckLevel);
+    const int nThreads = std::max(nScriptCheckThreads, 1);
+    LogPrintf("Verifying last %i blocks at level %i using %i threads\n", nCheckDepth, nCheckLevel, nThreads);
     CCoinsViewCache coins(coinsview);
-    CBlockIndex* pindex;
+    CBlockIndex* pindex = chainActive.Tip();
     CBlockIndex* pindexFailure = nullptr;
     int nGoodTransactions = 0;
     CValidationState state;
     int reportDone = 0;
+    const int64_t nStart = GetTimeMicros();
+    int nVerified = 0;
     LogPrintf("[0%%]..."); /* Continued */
-    for (pindex = chainActive.Tip(); pindex && pindex->pprev; pindex = pindex->pprev) {
+    bool fEnd = false;
+    while (!fEnd) {
         boost::this_thread::interruption_point();
-        const int percentageDone = std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindex->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100))));
-        if (reportDone < percentageDone/10) {
-            // report every 10% step
-            LogPrintf("[%d%%]...", percentageDone); /* Continued */
-            reportDone = percentageDone/10;
-        }
-        uiInterface.ShowProgress(_("Verifying blocks..."), percentageDone, false);
-        if (pindex->nHeight <= chainActive.Height()-nCheckDepth)
-            break;
-        if (fPruneMode && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
-            // If pruning, only go back as far as we have data.
-            LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
-            break;
-        }
-        CBlock block;
-        // check level 0: read from disk
-        if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
-            return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-        // check level 1: verify block validity
-        if (nCheckLevel >= 1 && !CheckBlock(block, state, chainparams.GetConsensus()))
-            return error("%s: *** found bad block at %d, hash=%s (%s)\n", __func__,
-                         pindex->nHeight, pindex->GetBlockHash().ToString(), FormatStateMessage(state));
-        // check level 2: verify undo validity
-        if (nCheckLevel >= 2 && pindex) {
-            CBlockUndo undo;
-            if (!pindex->GetUndoPos().IsNull()) {
-                if (!UndoReadFromDisk(undo, pindex)) {
-                    return error("VerifyDB(): *** found bad undo data at %d, hash=%s\n", pindex->nHeight, pindex->GetBlockHash().ToString());
-                }
+
+        // Collect the next window of blocks, walking back from the tip. When
+        // this stops, pindex is the first block not to verify, as below.
+        std::vector<CVerifiedBlock> vWindow;
+        vWindow.reserve(VERIFYDB_BLOCKS_PER_THREAD * nThreads);
+        while (vWindow.size() < VERIFYDB_BLOCKS_PER_THREAD * nThreads) {
+            if (!pindex || !pindex->pprev || pindex->nHeight <= chainActive.Height()-nCheckDepth) {
+                fEnd = true;
+                break;
             }
+            if (fPruneMode && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
+                // If pruning, only go back as far as we have data.
+                LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
+                fEnd = true;
+                break;
+            }
+            vWindow.emplace_back();
+            vWindow.back().pindex = pindex;
+            vWindow.back().pos = pindex->GetBlockPos();
+            pindex = pindex->pprev;
         }
-        // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
-        if (nCheckLevel >= 3 && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
-            assert(coins.GetBestBlock() == pindex->GetBlockHash());
-            DisconnectResult res = g_chainstate.DisconnectBlock(block, pindex, coins);
-            if (res == DISCONNECT_FAILED) {
-                return error("VerifyDB(): *** irrecoverable inconsistency in block data at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
+
+        // Levels 0 to 2 check each block on its own: spread them over the
+        // block check threads.
+        std::vector<CTaskCheck> vChecks;
+        vChecks.reserve(vWindow.size());
+        for (CVerifiedBlock& verified : vWindow) {
+            vChecks.emplace_back(CVerifyBlockCheck(verified, chainparams.GetConsensus(), nCheckLevel));
+        }
+        CCheckQueueControl<CTaskCheck> control(&blockcheckqueue);
+        control.Add(vChecks);
+        control.Wait();
+
+        // Level 3 disconnects the blocks in order, from the tip down.
+        for (CVerifiedBlock& verified : vWindow) {
+            CBlockIndex* pindexVerified = verified.pindex;
+            const int percentageDone = std::max(1, std::min(99, (int)(((double)(chainActive.Height() - pindexVerified->nHeight)) / (double)nCheckDepth * (nCheckLevel >= 4 ? 50 : 100))));
+            if (reportDone < percentageDone/10) {
+                // report every 10% step
+                LogPrintf("[%d%%]...", percentageDone); /* Continued */
+                reportDone = percentageDone/10;
             }
-            if (res == DISCONNECT_UNCLEAN) {
-                nGoodTransactions = 0;
-                pindexFailure = pindex;
-            } else {
-                nGoodTransactions += block.vtx.size();
+            uiInterface.ShowProgress(_("Verifying blocks..."), percentageDone, false);
+            if (ShutdownRequested())
+                return true;
+            if (!verified.fChecked) {
+                pindexFailed = pindexVerified;
+                return error("%s", verified.strError);
+            }
+            // check level 3: check for inconsistencies during memory-only disconnect of tip blocks
+            if (nCheckLevel >= 3 && (coins.DynamicMemoryUsage() + pcoinsTip->DynamicMemoryUsage()) <= nCoinCacheUsage) {
+                assert(coins.GetBestBlock() == pindexVerified->GetBlockHash());
+                DisconnectResult res = g_chainstate.DisconnectBlock(verified.block, pindexVerified, coins);
+                if (res == DISCONNECT_FAILED) {
+                    pindexFailed = pindexVerified;
+                    return error("VerifyDB(): *** irrecoverable inconsistency in block data at %d, hash=%s", pindexVerified->nHeight, pindexVerified->GetBlockHash().ToString());
+                }
+                if (res == DISCONNECT_UNCLEAN) {
+                    nGoodTransactions = 0;
+                    pindexFailure = pindexVerified;
+                } else {
+                    nGoodTransactions += verified.block.vtx.size();
+                }
             }
+            ++nVerified;
         }
         if (ShutdownRequested())
             return true;
     }
-    if (pindexFailure)
+    if (pindexFailure) {
+        pindexFailed = pindexFailure;
         return error("VerifyDB(): *** coin database inconsistencies found (last %i blocks, %i good transactions before that)\n", chainActive.Height() - pindexFailure->nHeight + 1, nGoodTransactions);
+    }
 
     // store block count as we move pindex at check level >= 4
     int block_count = chainActive.Height() - pindex->nHeight;
@@ -4168,15 +4554,21 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
             uiInterface.ShowProgress(_("Verifying blocks..."), percentageDone, false);
             pindex = chainActive.Next(pindex);
             CBlock block;
-            if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()))
+            if (!ReadBlockFromDisk(block, pindex, chainparams.GetConsensus())) {
+                pindexFailed = pindex;
                 return error("VerifyDB(): *** ReadBlockFromDisk failed at %d, hash=%s", pindex->nHeight, pindex->GetBlockHash().ToString());
-            if (!g_chainstate.ConnectBlock(block, state, pindex, coins, chainparams))
+            }
+            if (!g_chainstate.ConnectBlock(block, state, pindex, coins, chainparams)) {
+                pindexFailed = pindex;
                 return error("VerifyDB(): *** found unconnectable block at %d, hash=%s (%s)", pindex->nHeight, pindex->GetBlockHash().ToString(), FormatStateMessage(state));
+            }
         }
     }
 
     LogPrintf("[DONE].\n");
     LogPrintf("No coin database inconsistencies in last %i blocks (%i transactions)\n", block_count, nGoodTransactions);
+    const int64_t nTime = GetTimeMicros() - nStart;
+    LogPrintf("Verified %i blocks in %.2fs (%.1f blocks/s)\n", nVerified, nTime * 0.000001, nTime ? nVerified * 1000000.0 / nTime : 0.0);
 
     return true;
 }
@@ -4442,6 +4834,7 @@ void UnloadBlockIndex()
     setDirtyBlockIndex.clear();
     setDirtyFileInfo.clear();
     versionbitscache.Clear();
+    targetcache.Clear();
     for (int b = 0; b < VERSIONBITS_NUM_BITS; b++) {
         warningcache[b].clear();
     }
@@ -4515,43 +4908,22 @@ bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskB
 
     int nLoaded = 0;
     try {
-        // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
-        CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
-        uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
+        // Blocks are located, deserialized, hashed and checked ahead on other
+        // threads, and arrive here in file order.
+        CBlockImportReader reader(fileIn, chainparams.MessageStart(), chainparams.GetConsensus(), &blockcheckqueue, nScriptCheckThreads);
+        CImportedBlock imported;
+        while (reader.Next(imported)) {
             boost::this_thread::interruption_point();
 
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[CMessageHeader::MESSAGE_START_SIZE];
-                blkdat.FindByte(chainparams.MessageStart()[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> buf;
-                if (memcmp(buf, chainparams.MessageStart(), CMessageHeader::MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
-                break;
+            if (!imported.pblock) {
+                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, imported.strError);
+                continue;
             }
             try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
                 if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                std::shared_ptr<CBlock> pblock = std::make_shared<CBlock>();
+                    dbp->nPos = imported.nPos;
+                std::shared_ptr<CBlock> pblock = std::move(imported.pblock);
                 CBlock& block = *pblock;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
 
                 uint256 hash = block.GetHash();
                 {
@@ -32,12 +32,16 @@
 
 #include <atomic>
 
+class CBlockHeader;
 class CBlockIndex;
 class CBlockTreeDB;
 class CChainParams;
+class CCoinsSnapshotManager;
 class CCoinsViewDB;
+class CCoinsViewPrefetch;
 class CInv;
 class CConnman;
+struct CRawBlock;
 class CScriptCheck;
 class CBlockPolicyEstimator;
 class CTxMemPool;
@@ -46,6 +50,9 @@ struct ChainTxData;
 
 struct PrecomputedTransactionData;
 struct LockPoints;
+struct TargetCache;
+
+template <typename T> class CCheckQueue;
 
 /** Default for -whitelistrelay. */
 static const bool DEFAULT_WHITELISTRELAY = true;
@@ -117,6 +124,8 @@ static const int64_t MAX_FEE_ESTIMATION_TIP_AGE = 3 * 60 * 60;
 /** Default for -permitbaremultisig */
 static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
+static const bool DEFAULT_INCREMENTAL_FLUSH = false;
+static const bool DEFAULT_VERIFYBLOCKINDEX = false;
 static const bool DEFAULT_TXINDEX = false;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 /** Default for -persistmempool */
@@ -162,7 +171,11 @@ extern int nScriptCheckThreads;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
+/** Whether to recompute and check every block index hash when loading the block index */
+extern bool fVerifyBlockIndex;
 extern bool fCheckpointsEnabled;
+/** Whether to write the coins cache in the background and keep it warm, rather than dropping it on every flush */
+extern bool fIncrementalFlush;
 extern size_t nCoinCacheUsage;
 /** A fee rate smaller than this is considered zero fee (for relaying, mining and transaction creation) */
 extern CFeeRate minRelayTxFee;
@@ -181,11 +194,6 @@ extern arith_uint256 nMinimumChainWork;
 /** Best header we've seen so far (used for getheaders queries' starting points). */
 extern CBlockIndex *pindexBestHeader;
 
-// [PINK] https://github.com/Pink2Dev/Pink2/blob/2.2.3.0/src/main.cpp#L44
-extern arith_uint256 nBaseStakeTrust;
-// [PINK] https://github.com/Pink2Dev/Pink2/blob/2.2.3.0/src/main.cpp#L45
-extern int nBaseStakeTrustHeight;
-
 /** Minimum disk space required - used in CheckDiskSpace() */
 static const uint64_t nMinDiskSpace = 52428800;
 
@@ -257,6 +265,10 @@ bool ProcessNewBlockHeaders(const std::vector<CBlockHeader>& block, CValidationS
 bool CheckDiskSpace(uint64_t nAdditionalBytes = 0, bool blocks_dir = false);
 /** Open a block file (blk?????.dat) */
 FILE* OpenBlockFile(const CDiskBlockPos &pos, bool fReadOnly = false);
+/** Write block and undo data from a background thread from now on */
+void StartBlockFileWriter();
+/** Write out the block and undo data still queued, and go back to writing it synchronously */
+void StopBlockFileWriter();
 /** Translation to a filesystem path */
 fs::path GetBlockPosFilename(const CDiskBlockPos &pos, const char *prefix);
 /** Import blocks from an external file */
@@ -272,6 +284,12 @@ bool LoadChainTip(const CChainParams& chainparams) EXCLUSIVE_LOCKS_REQUIRED(cs_m
 void UnloadBlockIndex();
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the header hashing thread */
+void ThreadHeaderHashCheck();
+/** Run an instance of the block transaction hashing thread */
+void ThreadBlockTxCheck();
+/** Run an instance of the block check thread, decoding blocks for the import (see CBlockImportReader) and checking them for CVerifyDB */
+void ThreadBlockCheck();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Retrieve a transaction (from memory pool, or from disk, if possible) */
@@ -403,12 +421,43 @@ public:
 /** Initializes the script-execution cache */
 void InitScriptExecutionCache();
 
+/**
+ * Closure computing the (memoized) scrypt hashes of a run of consecutive
+ * block headers, used to hash a whole headers batch in parallel before it is
+ * validated serially. Each run is hashed with the multi-lane scrypt kernels.
+ * Note that this stores a reference to the headers
+ */
+class CHeaderHashCheck
+{
+private:
+    const CBlockHeader *pheader;
+    size_t nCount;
+
+public:
+    CHeaderHashCheck(): pheader(nullptr), nCount(0) {}
+    CHeaderHashCheck(const CBlockHeader* headersIn, size_t nCountIn) : pheader(headersIn), nCount(nCountIn) {}
+
+    bool operator()();
+
+    void swap(CHeaderHashCheck &check) {
+        std::swap(pheader, check.pheader);
+        std::swap(nCount, check.nCount);
+    }
+};
+
+/**
+ * Compute and memoize the hashes of a batch of headers, spreading the work
+ * over the given queue's workers (serially if queue is nullptr).
+ */
+void HashBlockHeaders(const std::vector<CBlockHeader>& headers, CCheckQueue<CHeaderHashCheck>* queue);
+
 
 /** Functions for disk access for blocks */
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
-bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& message_start);
-bool ReadRawBlockFromDisk(std::vector<uint8_t>& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start);
+/** Read a serialized block, as a view into the mapped block file unless it is still being appended to */
+bool ReadRawBlockFromDisk(CRawBlock& block, const CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& message_start);
+bool ReadRawBlockFromDisk(CRawBlock& block, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& message_start);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -439,6 +488,8 @@ public:
     CVerifyDB();
     ~CVerifyDB();
     bool VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview, int nCheckLevel, int nCheckDepth);
+    //! The block VerifyDB() failed at, if it found one bad
+    const CBlockIndex* pindexFailed = nullptr;
 };
 
 /** Replay blocks that aren't fully applied to the database. */
@@ -473,9 +524,15 @@ extern CChain& chainActive;
 /** Global variable that points to the coins database (protected by cs_main) */
 extern std::unique_ptr<CCoinsViewDB> pcoinsdbview;
 
+/** Global variable that points to the prefetching layer beneath pcoinsTip, if any (protected by cs_main) */
+extern std::unique_ptr<CCoinsViewPrefetch> pcoinsprefetch;
+
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern std::unique_ptr<CCoinsViewCache> pcoinsTip;
 
+/** Lock-free snapshots of the UTXO set at the chain tip, for RPC and REST lookups */
+extern CCoinsSnapshotManager g_coins_snapshot;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern std::unique_ptr<CBlockTreeDB> pblocktree;
 
@@ -488,6 +545,9 @@ int GetSpendHeight(const CCoinsViewCache& inputs);
 
 extern VersionBitsCache versionbitscache;
 
+/** Expected nBits of the children of recently seen parents (protected by cs_main). */
+extern TargetCache targetcache;
+
 /**
  * Determine what nVersion a new block should use.
  */
@@ -22,7 +22,7 @@ from test_framework.util import (
     hex_str_to_bytes,
 )
 
-from test_framework.messages import BLOCK_HEADER_SIZE
+from test_framework.messages import BLOCK_HEADER_SIZE, COutPoint, ser_compact_size
 
 class ReqType(Enum):
     JSON = 1
@@ -198,12 +198,14 @@ class RESTTest (BitcoinTestFramework):
         self.test_rest_request("/getutxos/checkmempool", http_method='POST', req_type=ReqType.JSON, status=400, ret_type=RetType.OBJ)
 
         # Test limits
-        long_uri = '/'.join(["{}-{}".format(txid, n_) for n_ in range(20)])
-        self.test_rest_request("/getutxos/checkmempool/{}".format(long_uri), http_method='POST', status=400, ret_type=RetType.OBJ)
-
-        long_uri = '/'.join(['{}-{}'.format(txid, n_) for n_ in range(15)])
+        long_uri = '/'.join(['{}-{}'.format(txid, n_) for n_ in range(20)])
         self.test_rest_request("/getutxos/checkmempool/{}".format(long_uri), http_method='POST', status=200)
 
+        outpoints = b''.join(COutPoint(int(txid, 16), n_).serialize() for n_ in range(1000))
+        self.test_rest_request("/getutxos", http_method='POST', req_type=ReqType.BIN, body=b'\x01' + ser_compact_size(1000) + outpoints, status=200, ret_type=RetType.BYTES)
+        outpoints += COutPoint(int(txid, 16), 1000).serialize()
+        self.test_rest_request("/getutxos", http_method='POST', req_type=ReqType.BIN, body=b'\x01' + ser_compact_size(1001) + outpoints, status=400, ret_type=RetType.OBJ)
+
         self.nodes[0].generate(1)  # generate block to not affect upcoming tests
         self.sync_all()
 
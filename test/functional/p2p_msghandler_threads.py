@@ -0,0 +1,84 @@
+#!/usr/bin/env python3
+# Copyright (c) 2019 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test processing peer messages on several threads (-msghandlerthreads).
+
+Each thread serves its share of the peers. Check that every peer still has
+its messages processed in order, and that what crosses between peers served
+by different threads, relayed addresses, still arrives; and that getdata is
+answered on every thread.
+"""
+import time
+
+from test_framework.messages import CAddress, CInv, msg_addr, msg_getdata, msg_ping
+from test_framework.mininode import P2PInterface, mininode_lock
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, wait_until
+
+NUM_PEERS = 8
+NUM_MESSAGES = 200
+
+class MessageRecorder(P2PInterface):
+    def __init__(self):
+        super().__init__()
+        self.pongs = []
+        self.addrs = []
+        self.notfound = []
+
+    def on_pong(self, message):
+        self.pongs.append(message.nonce)
+
+    def on_addr(self, message):
+        self.addrs.extend(message.addrs)
+
+    def on_notfound(self, message):
+        self.notfound.extend(inv.hash for inv in message.vec)
+
+class MessageHandlerThreadsTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.num_nodes = 1
+        self.setup_clean_chain = True
+        self.extra_args = [["-msghandlerthreads=4"]]
+
+    def run_test(self):
+        node = self.nodes[0]
+        peers = [node.add_p2p_connection(MessageRecorder()) for _ in range(NUM_PEERS)]
+
+        self.log.info("Check that each peer's messages are processed in order")
+        for i, peer in enumerate(peers):
+            for n in range(NUM_MESSAGES):
+                peer.send_message(msg_ping(nonce=i * NUM_MESSAGES + n))
+        for i, peer in enumerate(peers):
+            wait_until(lambda: len(peer.pongs) == NUM_MESSAGES, lock=mininode_lock)
+            with mininode_lock:
+                assert_equal(peer.pongs, list(range(i * NUM_MESSAGES, (i + 1) * NUM_MESSAGES)))
+
+        self.log.info("Check that addresses from one peer are relayed to the others")
+        addrs = []
+        for i in range(10):
+            addr = CAddress()
+            addr.time = int(time.time())
+            addr.nServices = 1
+            addr.ip = "123.123.%d.%d" % (i, i + 1)
+            addr.port = 8333
+            addrs.append(addr)
+        msg = msg_addr()
+        msg.addrs = addrs
+        peers[0].send_message(msg)
+        sent = set(addr.ip for addr in addrs)
+        # Addresses are sent on a timer of 30s on average, not mocked
+        wait_until(lambda: any(sent & set(addr.ip for addr in peer.addrs) for peer in peers[1:]), timeout=180, lock=mininode_lock)
+
+        self.log.info("Check that getdata is answered for every peer, in order")
+        # Transactions the node does not have, each answered with notfound
+        for i, peer in enumerate(peers):
+            for n in range(NUM_MESSAGES):
+                peer.send_message(msg_getdata([CInv(1, i * NUM_MESSAGES + n)]))
+        for i, peer in enumerate(peers):
+            wait_until(lambda: len(peer.notfound) == NUM_MESSAGES, lock=mininode_lock)
+            with mininode_lock:
+                assert_equal(peer.notfound, list(range(i * NUM_MESSAGES, (i + 1) * NUM_MESSAGES)))
+
+if __name__ == '__main__':
+    MessageHandlerThreadsTest().main()
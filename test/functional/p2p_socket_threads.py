@@ -0,0 +1,75 @@
+#!/usr/bin/env python3
+# Copyright (c) 2019 The Bitcoin Core developers
+# Distributed under the MIT software license, see the accompanying
+# file COPYING or http://www.opensource.org/licenses/mit-license.php.
+"""Test serving peers from several socket threads, and without epoll.
+
+Node 0 shares its peers among four epoll socket threads (-socketthreads=4),
+node 1 serves them all from the one poll() thread (-noepoll). With a small
+-maxreceivebuffer, a peer sending many messages at once has its receiving
+paused and resumed many times over.
+"""
+from test_framework.messages import msg_ping
+from test_framework.mininode import P2PInterface, mininode_lock
+from test_framework.test_framework import BitcoinTestFramework
+from test_framework.util import assert_equal, sync_blocks, wait_until
+
+ADDRESS = "mfWxJ45yp2SFn7UciZyNpvDKrzbhyfKrY8"
+NUM_PEERS = 8
+NUM_PINGS = 200
+
+class PongRecorder(P2PInterface):
+    def __init__(self):
+        super().__init__()
+        self.pongs = []
+
+    def on_pong(self, message):
+        self.pongs.append(message.nonce)
+
+class SocketThreadsTest(BitcoinTestFramework):
+    def set_test_params(self):
+        self.num_nodes = 2
+        self.setup_clean_chain = True
+        self.extra_args = [["-socketthreads=4", "-maxreceivebuffer=1"], ["-noepoll", "-maxreceivebuffer=1"]]
+
+    def mine(self, node, count):
+        # One block at a time, each later than the last
+        block_time = node.getblockheader(node.getbestblockhash())['time']
+        for i in range(count):
+            block_time += 120
+            for n in self.nodes:
+                n.setmocktime(block_time)
+            node.generatetoaddress(1, ADDRESS)
+
+    def run_test(self):
+        for node in self.nodes:
+            self.log.info("Check that node%d answers all of its peers' pings, in order" % node.index)
+            num_nodes = len(node.getpeerinfo())
+            peers = [node.add_p2p_connection(PongRecorder()) for _ in range(NUM_PEERS)]
+            for i, peer in enumerate(peers):
+                for n in range(NUM_PINGS):
+                    peer.send_message(msg_ping(nonce=i * NUM_PINGS + n))
+            for i, peer in enumerate(peers):
+                wait_until(lambda: len(peer.pongs) == NUM_PINGS, lock=mininode_lock)
+                with mininode_lock:
+                    assert_equal(peer.pongs, list(range(i * NUM_PINGS, (i + 1) * NUM_PINGS)))
+
+            self.log.info("Check that node%d keeps serving its peers as others disconnect" % node.index)
+            for peer in peers[:NUM_PEERS // 2]:
+                peer.peer_disconnect()
+                peer.wait_for_disconnect()
+            wait_until(lambda: len(node.getpeerinfo()) == num_nodes + NUM_PEERS // 2)
+            for peer in peers[NUM_PEERS // 2:]:
+                peer.sync_with_ping()
+            node.disconnect_p2ps()
+            wait_until(lambda: len(node.getpeerinfo()) == num_nodes)
+
+        self.log.info("Check that blocks relay both ways between the two")
+        self.mine(self.nodes[0], 5)
+        sync_blocks(self.nodes)
+        self.mine(self.nodes[1], 5)
+        sync_blocks(self.nodes)
+        assert_equal(self.nodes[0].getbestblockhash(), self.nodes[1].getbestblockhash())
+
+if __name__ == '__main__':
+    SocketThreadsTest().main()
@@ -127,6 +127,8 @@ BASE_SCRIPTS = [
     'rpc_signrawtransaction.py',
     'wallet_groups.py',
     'p2p_disconnect_ban.py',
+    'p2p_socket_threads.py',
+    'p2p_msghandler_threads.py',
     'rpc_decodescript.py',
     'rpc_blockchain.py',
     'rpc_deprecated.py',